@@ -0,0 +1,140 @@
+#pragma once
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dynarr.h"
+
+// bump allocator for everything that lives as long as one compilation:
+// lexer, parser, tree nodes, identifier strings, asm writers and arglists.
+// nothing allocated from it is freed on its own, the whole arena is released at once with arena_free.
+
+typedef struct ArenaAllocator {
+    // where the arena gets its blocks from, defaults to malloc/free
+    void* (*alloc)(size_t size, void* user);
+    void (*free)(void* ptr, void* user);
+    void* user;
+} ArenaAllocator;
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    _Alignas(16) char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock* head;
+    ArenaAllocator allocator;
+    size_t block_size;
+} Arena;
+
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+void* arena_default_alloc(size_t size, void* user) {
+    (void)user;
+    return malloc(size);
+}
+
+void arena_default_free(void* ptr, void* user) {
+    (void)user;
+    free(ptr);
+}
+
+Arena* arena_create_with(ArenaAllocator allocator, size_t block_size) {
+    Arena* arena = allocator.alloc(sizeof(Arena), allocator.user);
+    if (arena == NULL) {
+        fail("Out of memory!");
+        return NULL;
+    }
+    arena->head = NULL;
+    arena->allocator = allocator;
+    arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    return arena;
+}
+
+Arena* arena_create() {
+    const ArenaAllocator allocator = {
+            .alloc = arena_default_alloc,
+            .free = arena_default_free,
+            .user = NULL
+    };
+    return arena_create_with(allocator, ARENA_DEFAULT_BLOCK_SIZE);
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    if (stats_enabled) exec_stats.arena_allocs++;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaBlock* block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        // oversized requests get a block of their own
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        block = arena->allocator.alloc(sizeof(ArenaBlock) + block_size, arena->allocator.user);
+        if (stats_enabled) exec_stats.arena_blocks++;
+        if (block == NULL) {
+            fail("Out of memory!");
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void* ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t len) {
+    char* out = arena_alloc(arena, len + 1);
+    memcpy(out, str, len);
+    out[len] = '\0';
+    return out;
+}
+
+// releases every allocation but keeps the newest block around for the next compilation
+void arena_reset(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    if (block == NULL) return;
+    ArenaBlock* next = block->next;
+    while (next) {
+        ArenaBlock* after = next->next;
+        arena->allocator.free(next, arena->allocator.user);
+        next = after;
+    }
+    block->next = NULL;
+    block->used = 0;
+}
+
+// moves every block of other into arena, which frees them from then on, and releases other.
+// both must have been created with the same allocator
+void arena_adopt(Arena* arena, Arena* other) {
+    ArenaBlock* last = other->head;
+    if (last) {
+        while (last->next) last = last->next;
+        // behind the head, so arena keeps filling the block it's filling now
+        if (arena->head) {
+            last->next = arena->head->next;
+            arena->head->next = other->head;
+        } else {
+            arena->head = other->head;
+        }
+    }
+    other->allocator.free(other, other->allocator.user);
+}
+
+void arena_free(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        arena->allocator.free(block, arena->allocator.user);
+        block = next;
+    }
+    arena->allocator.free(arena, arena->allocator.user);
+}
+
+#endif //_ARENA_H
@@ -2,14 +2,120 @@
 #ifndef _ASM_H
 #define _ASM_H
 
+#include <math.h>
+
 #include "parser.h"
 #include "dynarr.h"
 
 // above is an expression parser, that creates a tree.
 // below converts the tree into assembly-like instructions
 
+// identifiers are interned once at codegen time, so the vm can address them by index instead of by name.
+// the table is process-wide and owns its strings, so a symbol index (and its name) stays valid for every program.
+dynarr(StringArr, char*);
+typedef struct StringArr StringArr;
+
+typedef struct SymbolTable {
+    StringArr* names; // symbol index -> name
+    int* buckets; // open addressing, holds symbol indices, -1 means empty
+    uint32_t bucket_count;
+} SymbolTable;
+
+// the process-wide table every compiled program refers to. the symbol_table_ functions work on any table,
+// like the private ones parallel compilation interns into before its names are merged in here.
+static SymbolTable symbols = { NULL, NULL, 0 };
+
+uint32_t symbol_hash(const char* name) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void symbol_table_grow(SymbolTable* table) {
+    uint32_t count = table->bucket_count ? table->bucket_count * 2 : 64;
+    free(table->buckets);
+    table->buckets = malloc(count * sizeof(int));
+    table->bucket_count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        table->buckets[i] = -1;
+    }
+    for (int i = 0; i < table->names->size; i++) {
+        uint32_t b = symbol_hash(table->names->data[i]) & (count - 1);
+        while (table->buckets[b] != -1) b = (b + 1) & (count - 1);
+        table->buckets[b] = i;
+    }
+}
+
+// returns the index of the name, or -1 if it has never been interned
+int symbol_table_find(SymbolTable* table, const char* name) {
+    if (table->bucket_count == 0) return -1;
+    uint32_t b = symbol_hash(name) & (table->bucket_count - 1);
+    while (table->buckets[b] != -1) {
+        if (strcmp(table->names->data[table->buckets[b]], name) == 0) {
+            return table->buckets[b];
+        }
+        b = (b + 1) & (table->bucket_count - 1);
+    }
+    return -1;
+}
+
+int symbol_table_intern(SymbolTable* table, const char* name) {
+    int found = symbol_table_find(table, name);
+    if (found != -1) return found;
+    if (table->names == NULL) {
+        table->names = newStringArr();
+    }
+    // keep the load factor under 1/2
+    if ((uint32_t)(table->names->size + 1) * 2 > table->bucket_count) {
+        symbol_table_grow(table);
+    }
+    int index = table->names->size;
+    pushStringArr(table->names, strdup(name));
+    uint32_t b = symbol_hash(name) & (table->bucket_count - 1);
+    while (table->buckets[b] != -1) b = (b + 1) & (table->bucket_count - 1);
+    table->buckets[b] = index;
+    return index;
+}
+
+uint32_t symbol_table_count(SymbolTable* table) {
+    return table->names ? table->names->size : 0;
+}
+
+void symbol_table_free(SymbolTable* table) {
+    if (table->names) {
+        for (int i = 0; i < table->names->size; i++) {
+            free(table->names->data[i]);
+        }
+        delStringArr(table->names);
+    }
+    free(table->buckets);
+    table->names = NULL;
+    table->buckets = NULL;
+    table->bucket_count = 0;
+}
+
+int symbol_find(const char* name) {
+    return symbol_table_find(&symbols, name);
+}
+
+int symbol_intern(const char* name) {
+    return symbol_table_intern(&symbols, name);
+}
+
+uint32_t symbol_count() {
+    return symbol_table_count(&symbols);
+}
+
+const char* symbol_name(int index) {
+    return symbols.names->data[index];
+}
+
 typedef enum DataType {
-    CONSTANT, VARIABLE, IDENTIFIER, ARGLIST
+    CONSTANT, VARIABLE, IDENTIFIER, ARGLIST, FUNCTION
 } DataType;
 
 typedef struct Data {
@@ -18,22 +124,101 @@ typedef struct Data {
     union {
         double constant; // EX: 1
         int variable; // EX: %1
-        char *identifier; // EX: x
+        struct {
+            char *name; // EX: x, owned by the symbol table
+            int symbol; // interned index of name
+        } ident;
         struct {
             // constant, variable, or identifier, not arglist, you can't have an arglist of arglists
             struct Data* args;
             int len;
         } arglist;
+        int function; // builtin the callee of a call was resolved to, an index into builtins
     } data;
 } Data;
 
 typedef enum BinaryOp {
-    ADD, SUB, MUL, DIV, CALL, ASSIGN
+    ADD, SUB, MUL, DIV, CALL, ASSIGN, POW, MINIMUM, MAXIMUM
 } BinaryOp;
 typedef enum UnaryOp {
-    NEG
+    NEG, SQRT, EXP, LOG, ABS, SIN, COS
 } UnaryOp;
 
+// the functions a call can name. callees are resolved while compiling, so a call never compares names at run time.
+// a math builtin called with as many arguments as it takes compiles to an instruction of its own, like an operator:
+// no arglist, folded by the optimizer when its arguments are constants, and run by every engine including batch.
+typedef enum BuiltinKind {
+    BUILTIN_OUTPUT, BUILTIN_UNARY, BUILTIN_BINARY
+} BuiltinKind;
+
+typedef struct Builtin {
+    const char* name;
+    BuiltinKind kind;
+    int op; // UnaryOp or BinaryOp
+} Builtin;
+
+#define BUILTIN_PRINT 0
+
+static const Builtin builtins[] = {
+        [BUILTIN_PRINT] = { "print", BUILTIN_OUTPUT, 0 },
+        { "sqrt", BUILTIN_UNARY, SQRT },
+        { "exp", BUILTIN_UNARY, EXP },
+        { "log", BUILTIN_UNARY, LOG },
+        { "abs", BUILTIN_UNARY, ABS },
+        { "sin", BUILTIN_UNARY, SIN },
+        { "cos", BUILTIN_UNARY, COS },
+        { "pow", BUILTIN_BINARY, POW },
+        { "min", BUILTIN_BINARY, MINIMUM },
+        { "max", BUILTIN_BINARY, MAXIMUM },
+};
+
+#define BUILTIN_COUNT ((int)(sizeof(builtins) / sizeof(builtins[0])))
+
+// -1 if no builtin has the name
+int builtin_find(const char* name) {
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        if (strcmp(builtins[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// -1 for any number of arguments
+int builtin_arity(int builtin) {
+    switch (builtins[builtin].kind) {
+        case BUILTIN_UNARY: return 1;
+        case BUILTIN_BINARY: return 2;
+        default: return -1;
+    }
+}
+
+// what every engine computes for the math ops. min and max return the second operand unless the first one is
+// strictly smaller (larger), which is what minsd/maxsd do, so NaNs and signed zeros agree with the simd paths
+static inline double math_unary(UnaryOp op, double x) {
+    switch (op) {
+        case NEG: return -x;
+        case SQRT: return sqrt(x);
+        case EXP: return exp(x);
+        case LOG: return log(x);
+        case ABS: return fabs(x);
+        case SIN: return sin(x);
+        case COS: return cos(x);
+    }
+    return 0;
+}
+
+static inline double math_binary(BinaryOp op, double a, double b) {
+    switch (op) {
+        case ADD: return a + b;
+        case SUB: return a - b;
+        case MUL: return a * b;
+        case DIV: return a / b;
+        case POW: return pow(a, b);
+        case MINIMUM: return a < b ? a : b;
+        case MAXIMUM: return a > b ? a : b;
+        default: return 0;
+    }
+}
+
 typedef enum InstructionType {
     BINARY, UNARY, SET
     // SET isn't really needed, but it might be useful later
@@ -66,13 +251,14 @@ dynarr(InstructionArr, Instruction);
 typedef struct InstructionArr InstructionArr;
 
 typedef struct AsmWriter {
+    Arena* arena; // arglists are allocated here, so they live as long as the arena the program was compiled into
     InstructionArr* instructions;
+    SymbolTable* symbols; // where identifiers are interned
     uint32_t depth;
     uint32_t cur_var;
+    bool failed; // the statement had a syntax error, which was printed, and compiled to nothing
 } AsmWriter;
 
-Data get_data(ExprNode* expr, AsmWriter* aw);
-
 BinaryOp get_expr_bin_op(const ExprNode* expr) {
     switch(expr->type) {
         case NT_ADD: return ADD;
@@ -86,153 +272,274 @@ BinaryOp get_expr_bin_op(const ExprNode* expr) {
     }
 }
 
-int parse_expr_tree(ExprNode* expr_tree, AsmWriter* aw) {
-    switch(get_node_class(expr_tree)) {
-        case NC_BINARY: {
-            Data left = get_data(expr_tree->binary.left, aw);
-            Data right = get_data(expr_tree->binary.right, aw);
-            if (expr_tree->type == NT_ASSIGN && right.type == VARIABLE) {
-                Instruction instr = {
-                        .out = -1,
-                        .type = BINARY,
-                        .data.binary = {
-                                .left = left,
-                                .right = right,
-                                .op = get_expr_bin_op(expr_tree)
-                        },
-                };
-                pushInstructionArr(aw->instructions, instr);
-                return instr.out;
-            } else {
+// lowering walks the tree with a heap-allocated stack of frames, like the parser, so it doesn't run out of c stack
+// on deep trees either. a frame lowers one node to a Data: the frame for an operator pushes a frame per operand, in
+// order, and emits its instruction once the last one has returned, so slots are numbered in the same post-order a
+// recursive walk would number them in. an argument list is a loop in its frame.
+
+typedef enum LowerStep {
+    LS_START, LS_BINARY, LS_BINARY_DONE, LS_UNARY_DONE, LS_BUILTIN, LS_BUILTIN_DONE, LS_CALL, LS_CALL_DONE, LS_ARGS
+} LowerStep;
+
+typedef struct LowerFrame {
+    LowerStep step;
+    int index; // the argument being lowered
+    ExprNode* node; // the argument list at index, for LS_ARGS
+    Data left; // the first operand, or the callee
+    Data* args;
+    int builtin;
+} LowerFrame;
+
+dynarr(LowerFrameArr, LowerFrame);
+
+static inline void lower_push(struct LowerFrameArr* stack, ExprNode* node) {
+    LowerFrame frame = { .step = LS_START, .node = node };
+    pushLowerFrameArr(stack, frame);
+}
+
+static inline Data lower_emit(AsmWriter* aw, Instruction instr) {
+    instr.out = aw->cur_var++;
+    pushInstructionArr(aw->instructions, instr);
+    return (Data){ .type = VARIABLE, .data.variable = instr.out };
+}
+
+// the node's value as an operand: constants and names as they are, an argument list as an ARGLIST, anything else
+// is computed into a slot
+Data get_data(ExprNode* expr, AsmWriter* aw) {
+    struct LowerFrameArr stack = {0};
+    lower_push(&stack, expr);
+    // what the last frame to finish returned
+    Data result = {0};
+    while (stack.size > 0) {
+        LowerFrame* frame = &stack.data[stack.size - 1];
+        ExprNode* node = frame->node;
+        switch (frame->step) {
+            case LS_START:
+                if (node->type == NT_NUMBER) {
+                    result = (Data){ .type = CONSTANT, .data.constant = node->number };
+                    stack.size--;
+                    break;
+                } else if (node->type == NT_IDENT) {
+                    const int symbol = symbol_table_intern(aw->symbols, node->ident.identifier);
+                    result = (Data){
+                            .type = IDENTIFIER,
+                            .data.ident = { .name = aw->symbols->names->data[symbol], .symbol = symbol }
+                    };
+                    stack.size--;
+                    break;
+                } else if (node->type == NT_ARGS) {
+                    int size = 0;
+                    for (const ExprNode* cur = node; cur && cur->type == NT_ARGS; cur = cur->binary.right) {
+                        size++;
+                    }
+                    frame->args = arena_alloc(aw->arena, sizeof(Data) * size);
+                    frame->index = 0;
+                    frame->left = (Data){ .type = ARGLIST, .data.arglist = { .args = frame->args, .len = size } };
+                    frame->step = LS_ARGS;
+                    lower_push(&stack, node->binary.left);
+                    break;
+                }
+                switch (get_node_class(node)) {
+                    case NC_BINARY:
+                        frame->step = LS_BINARY;
+                        lower_push(&stack, node->binary.left);
+                        break;
+                    case NC_UNARY:
+                        frame->step = LS_UNARY_DONE;
+                        lower_push(&stack, node->unary.operand);
+                        break;
+                    case NC_CALL: {
+                        ExprNode* callee = node->binary.left;
+                        ExprNode* args = node->binary.right;
+                        int builtin = callee->type == NT_IDENT ? builtin_find(callee->ident.identifier) : -1;
+                        int argc = 0;
+                        for (ExprNode* arg = args; arg && arg->type == NT_ARGS; arg = arg->binary.right) argc++;
+                        frame->builtin = builtin;
+                        if (builtin >= 0 && builtin_arity(builtin) == argc) {
+                            // a math builtin with the right number of arguments is an op
+                            frame->step = builtins[builtin].kind == BUILTIN_UNARY ? LS_BUILTIN_DONE : LS_BUILTIN;
+                            lower_push(&stack, args->binary.left);
+                        } else if (builtin >= 0) {
+                            frame->left = (Data){ .type = FUNCTION, .data.function = builtin };
+                            frame->step = LS_CALL_DONE;
+                            lower_push(&stack, args);
+                        } else {
+                            // unknown names stay identifiers, calling them is an error at run time
+                            frame->step = LS_CALL;
+                            lower_push(&stack, callee);
+                        }
+                    } break;
+                    default:
+                        printf("ERROR: unknown node class\n");
+                        result = (Data){ .type = VARIABLE, .data.variable = -1 };
+                        stack.size--;
+                        break;
+                }
+                break;
+            case LS_BINARY:
+                frame->left = result;
+                frame->step = LS_BINARY_DONE;
+                lower_push(&stack, node->binary.right);
+                break;
+            case LS_BINARY_DONE: {
                 Instruction instr = {
-                        .out = aw->cur_var++,
                         .type = BINARY,
-                        .data.binary = {
-                                .left = left,
-                                .right = right,
-                                .op = get_expr_bin_op(expr_tree)
-                        },
+                        .data.binary = { .left = frame->left, .right = result, .op = get_expr_bin_op(node) },
                 };
-                pushInstructionArr(aw->instructions, instr);
-                return instr.out;
-            }
-        } break;
-        case NC_UNARY: {
-            Data operand = get_data(expr_tree->unary.operand, aw);
-            Instruction instr = {
-                    .out = aw->cur_var++,
-                    .type = UNARY,
-                    .data.unary = {
-                            .operand = operand,
-                            .op = NEG
-                    }
-            };
-            pushInstructionArr(aw->instructions, instr);
-            return instr.out;
-        } break;
-        case NC_VALUE: {
-            return get_data(expr_tree, aw).data.variable;
-        } break;
-        case NC_CALL: {
-            Data left = get_data(expr_tree->binary.left, aw);
-            Data right = get_data(expr_tree->binary.right, aw);
-            Instruction instr = {
-                    .out = aw->cur_var++,
-                    .type = BINARY,
-                    .data.binary = {
-                            .left = left,
-                            .right = right,
-                            .op = CALL
-                    }
-            };
-            pushInstructionArr(aw->instructions, instr);
-            return instr.out;
-        } break;
-        default:
-            printf("ERROR: unknown node class\n");
-            return -1;
+                stack.size--;
+                if (node->type == NT_ASSIGN && result.type == VARIABLE) {
+                    // the name is now bound to the right side's slot, which is also the value of the assignment
+                    instr.out = -1;
+                    pushInstructionArr(aw->instructions, instr);
+                } else {
+                    result = lower_emit(aw, instr);
+                }
+            } break;
+            case LS_UNARY_DONE:
+                stack.size--;
+                if (node->type == NT_POSITIVE) {
+                    // +x is just a copy, the optimizer removes it
+                    result = lower_emit(aw, (Instruction){ .type = SET, .data.set = result });
+                } else {
+                    result = lower_emit(aw, (Instruction){ .type = UNARY, .data.unary = { .operand = result, .op = NEG } });
+                }
+                break;
+            case LS_BUILTIN:
+                frame->left = result;
+                frame->step = LS_BUILTIN_DONE;
+                lower_push(&stack, node->binary.right->binary.right->binary.left);
+                break;
+            case LS_BUILTIN_DONE: {
+                const Builtin* builtin = &builtins[frame->builtin];
+                stack.size--;
+                if (builtin->kind == BUILTIN_UNARY) {
+                    result = lower_emit(aw, (Instruction){
+                            .type = UNARY, .data.unary = { .operand = result, .op = (UnaryOp)builtin->op } });
+                } else {
+                    result = lower_emit(aw, (Instruction){
+                            .type = BINARY,
+                            .data.binary = { .left = frame->left, .right = result, .op = (BinaryOp)builtin->op } });
+                }
+            } break;
+            case LS_CALL:
+                frame->left = result;
+                frame->step = LS_CALL_DONE;
+                lower_push(&stack, node->binary.right);
+                break;
+            case LS_CALL_DONE: {
+                Data callee = frame->left;
+                stack.size--;
+                result = lower_emit(aw, (Instruction){
+                        .type = BINARY, .data.binary = { .left = callee, .right = result, .op = CALL } });
+            } break;
+            case LS_ARGS:
+                frame->args[frame->index++] = result;
+                frame->node = node->binary.right;
+                if (frame->index < frame->left.data.arglist.len) {
+                    lower_push(&stack, frame->node->binary.left);
+                } else {
+                    result = frame->left;
+                    stack.size--;
+                }
+                break;
+        }
     }
-    // will return out index
+    free(stack.data);
+    return result;
 }
 
-Data get_data(ExprNode* expr, AsmWriter* aw) {
-    if (expr->type == NT_NUMBER) {
-        const Data data = {
-                .type = CONSTANT,
-                .data.constant = expr->number
-        };
-        return data;
-    } else if (expr->type == NT_IDENT) {
-        const Data data = {
-                .type = IDENTIFIER,
-                .data.identifier = expr->ident.identifier
-        };
-        return data;
-    } else if (expr->type == NT_ARGS) {
-        int size = 0;
-        const ExprNode* cur = expr;
-        while (cur && cur->type == NT_ARGS) {
-            size++;
-            cur = cur->binary.right;
-        }
-        Data* args = malloc(sizeof(Data) * size);
-        cur = expr;
-        for (int i = 0; i < size; i++) {
-            args[i] = get_data(cur->binary.left, aw);
-            cur = cur->binary.right;
-        }
-        const Data arglist = {
-                .type = ARGLIST,
-                .data.arglist = {
-                        .args = args,
-                        .len = size
-                }
-        };
-
-        return arglist;
-    }
-    else {
-        // it's a variable
-        Data data = {
-                .type = VARIABLE,
-                .data.variable = parse_expr_tree(expr, aw)
-        };
-        return data;
+// lowers a statement's tree and returns the slot of its value
+int parse_expr_tree(ExprNode* expr_tree, AsmWriter* aw) {
+    if (get_node_class(expr_tree) == NC_ARGS) {
+        printf("ERROR: unknown node class\n");
+        return -1;
     }
+    return get_data(expr_tree, aw).data.variable;
 }
 
-InstructionArr* generate_instructions(const char* expr, uint32_t var_offset) {
-    Parser* parser = parser_create(expr);
+InstructionArr* generate_instructions(const char* expr, uint32_t var_offset, Arena* arena) {
+    Parser* parser = parser_create(expr, arena);
     ExprNode* expr_tree = parser_parse_expr(parser, PREC_MIN);
+    if (parser->failed) expr_tree = NULL;
     InstructionArr* instructions = newInstructionArr();
     AsmWriter aw = {
+            .arena = arena,
             .instructions = instructions,
+            .symbols = &symbols,
             .depth = 0,
             .cur_var = var_offset
     };
-    parse_expr_tree(expr_tree, &aw);
+    if (expr_tree) {
+        parse_expr_tree(expr_tree, &aw);
+    }
     return instructions;
 }
 
-AsmWriter* asm_writer_create(const char* expr, uint32_t var_offset) {
-    Parser* parser = parser_create(expr);
-    ExprNode* expr_tree = parser_parse_expr(parser, PREC_MIN);
-    InstructionArr* instructions = newInstructionArr();
-    AsmWriter* aw = malloc(sizeof(AsmWriter));
+// with stats on, the statement is lexed once on its own first, so lexing can be told apart from parsing
+void asm_stats_lex(const char* expr) {
+    Lexer lexer = { .start = (char*)expr, .current = (char*)expr, .line = 1 };
+    while (lexer_next_token(&lexer).type != TT_EOF) {
+        exec_stats.tokens++;
+    }
+}
+
+// compiles one statement onto the end of instructions, which stay the caller's.
+// names are interned into table, the process-wide symbol table if it's NULL
+AsmWriter* asm_writer_create_into(const char* expr, uint32_t var_offset, Arena* arena, InstructionArr* instructions,
+                                  SymbolTable* table) {
+    AsmWriter* aw = arena_alloc(arena, sizeof(AsmWriter));
+    aw->arena = arena;
     aw->instructions = instructions;
+    aw->symbols = table ? table : &symbols;
     aw->depth = 0;
     aw->cur_var = var_offset;
-    parse_expr_tree(expr_tree, aw);
+    aw->failed = false;
+    // a blank statement, like the newline after the last ';', compiles to nothing, the way the stream runner skips it
+    const char* first = expr;
+    while (is_whitespace(*first)) first++;
+    if (*first == '\0') return aw;
+
+    double start = 0, lexed = 0, parsed = 0;
+    if (stats_enabled) {
+        start = stats_now();
+        asm_stats_lex(expr);
+        lexed = stats_now();
+    }
+    Parser* parser = parser_create(expr, arena);
+    ExprNode* expr_tree = parser_parse_expr(parser, PREC_MIN);
+    if (stats_enabled) parsed = stats_now();
+    int emitted = instructions->size;
+    // one with a syntax error has had its errors printed, and compiles to nothing too
+    aw->failed = parser->failed;
+    if (expr_tree && !parser->failed) {
+        parse_expr_tree(expr_tree, aw);
+    }
+    if (stats_enabled) {
+        // lexing is the separate pass. the parser pulls its own tokens again, and that stays in its time
+        stats_add_time(STATS_LEX, lexed - start);
+        stats_add_time(STATS_PARSE, parsed - lexed);
+        stats_add_time(STATS_CODEGEN, stats_now() - parsed);
+        emitted = instructions->size - emitted;
+        exec_stats.statements++;
+        exec_stats.instructions += emitted;
+        if ((uint64_t)emitted > exec_stats.max_statement_instructions) {
+            exec_stats.max_statement_instructions = emitted;
+        }
+    }
     return aw;
 }
 
+AsmWriter* asm_writer_create(const char* expr, uint32_t var_offset, Arena* arena) {
+    return asm_writer_create_into(expr, var_offset, arena, newInstructionArr(), NULL);
+}
+
 void free_instructions(InstructionArr* instructions) {
     delInstructionArr(instructions);
 }
 
 void asm_writer_free(AsmWriter* aw) {
+    // the writer itself belongs to the arena
     free_instructions(aw->instructions);
-    free(aw);
 }
 
 void print_data(Data d) {
@@ -244,7 +551,7 @@ void print_data(Data d) {
             printf("%%%d", d.data.variable);
             break;
         case IDENTIFIER:
-            printf("'%s'", d.data.identifier);
+            printf("'%s'", d.data.ident.name);
             break;
         case ARGLIST:
             printf("arglist(");
@@ -256,6 +563,9 @@ void print_data(Data d) {
             }
             printf(")");
             break;
+        case FUNCTION:
+            printf("%s", builtins[d.data.function].name);
+            break;
     }
 }
 
@@ -283,6 +593,15 @@ void print_instruction(Instruction i) {
                 case ASSIGN:
                     printf(" = ");
                     break;
+                case POW:
+                    printf(" pow ");
+                    break;
+                case MINIMUM:
+                    printf(" min ");
+                    break;
+                case MAXIMUM:
+                    printf(" max ");
+                    break;
             }
             print_data(i.data.binary.right);
             break;
@@ -291,6 +610,24 @@ void print_instruction(Instruction i) {
                 case NEG:
                     printf("- ");
                     break;
+                case SQRT:
+                    printf("sqrt ");
+                    break;
+                case EXP:
+                    printf("exp ");
+                    break;
+                case LOG:
+                    printf("log ");
+                    break;
+                case ABS:
+                    printf("abs ");
+                    break;
+                case SIN:
+                    printf("sin ");
+                    break;
+                case COS:
+                    printf("cos ");
+                    break;
             }
             print_data(i.data.unary.operand);
             break;
@@ -307,26 +644,65 @@ void print_instructions(InstructionArr* instructions) {
     }
 }
 
-InstructionArr* gen_code(const char* expr) {
+void track_frame_size(uint32_t* frame_size, Data d) {
+    if (d.type == VARIABLE && d.data.variable >= 0 && (uint32_t)d.data.variable + 1 > *frame_size) {
+        *frame_size = d.data.variable + 1;
+    } else if (d.type == ARGLIST) {
+        for (int i = 0; i < d.data.arglist.len; i++) {
+            track_frame_size(frame_size, d.data.arglist.args[i]);
+        }
+    }
+}
+
+// number of % slots the instructions can touch
+uint32_t instructions_frame_size(InstructionArr* instructions) {
+    uint32_t frame_size = 0;
+    for (int i = 0; i < instructions->size; i++) {
+        Instruction* instr = &instructions->data[i];
+        if (instr->out >= 0 && (uint32_t)instr->out + 1 > frame_size) {
+            frame_size = instr->out + 1;
+        }
+        switch (instr->type) {
+            case BINARY:
+                track_frame_size(&frame_size, instr->data.binary.left);
+                track_frame_size(&frame_size, instr->data.binary.right);
+                break;
+            case UNARY:
+                track_frame_size(&frame_size, instr->data.unary.operand);
+                break;
+            case SET:
+                track_frame_size(&frame_size, instr->data.set);
+                break;
+        }
+    }
+    return frame_size;
+}
+
+// everything the compilation allocates, including the arglists the instructions point to, comes from arena.
+// the instructions stay valid until the arena is freed or reset.
+// failed is set if a statement had a syntax error, the others are compiled anyway. it can be NULL
+InstructionArr* gen_code_checked(const char* expr, Arena* arena, bool* failed) {
     // split by semicolons, and offset variables by previous instructions
     // then return the instructions
     // split string
-    char* str = strdup(expr);
+    char* str = arena_strndup(arena, expr, strlen(expr));
     char* token = strtok(str, ";");
     InstructionArr* instructions = newInstructionArr();
     uint32_t offset = 0;
+    if (failed) *failed = false;
     while (token) {
-        AsmWriter* aw = asm_writer_create(token, offset);
-        for (int i = 0; i < aw->instructions->size; i++) {
-            pushInstructionArr(instructions, aw->instructions->data[i]);
-        }
+        // every statement is written straight onto the end of the result, there's nothing to merge afterwards
+        AsmWriter* aw = asm_writer_create_into(token, offset, arena, instructions, NULL);
         offset = aw->cur_var;
-        asm_writer_free(aw);
+        if (failed && aw->failed) *failed = true;
         token = strtok(NULL, ";");
     }
-    free(str);
     return instructions;
 }
 
+InstructionArr* gen_code(const char* expr, Arena* arena) {
+    return gen_code_checked(expr, arena, NULL);
+}
+
 
 #endif //_ASM_H
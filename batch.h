@@ -0,0 +1,347 @@
+#pragma once
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include "bytecode.h"
+
+// batch evaluation: run one compiled program over many input rows at once.
+// free identifiers (read before they are assigned) are bound to caller columns,
+// and every instruction is applied to a whole block of rows before moving on to the next one,
+// so the per-instruction work is a tight loop the SSE2/AVX2 kernels below can chew through.
+// named variables can be read back as output columns.
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__GNUC__) || defined(__clang__)
+#define BATCH_X86 1
+#include <immintrin.h>
+#endif
+#endif
+#ifndef BATCH_X86
+#define BATCH_X86 0
+#endif
+
+typedef enum BatchIsa {
+    BATCH_SCALAR, BATCH_SSE2, BATCH_AVX2
+} BatchIsa;
+
+typedef struct BatchKernels {
+    BatchIsa isa;
+    const char* name;
+    void (*add)(double* out, const double* a, const double* b, size_t n);
+    void (*sub)(double* out, const double* a, const double* b, size_t n);
+    void (*mul)(double* out, const double* a, const double* b, size_t n);
+    void (*div)(double* out, const double* a, const double* b, size_t n);
+    void (*neg)(double* out, const double* a, size_t n);
+    void (*min)(double* out, const double* a, const double* b, size_t n);
+    void (*max)(double* out, const double* a, const double* b, size_t n);
+    void (*sqrt)(double* out, const double* a, size_t n);
+    void (*abs)(double* out, const double* a, size_t n);
+} BatchKernels;
+
+// a named column of `rows` doubles
+typedef struct BatchColumn {
+    const char* name;
+    double* data;
+} BatchColumn;
+
+typedef struct BatchProgram {
+    BcProgram* bytecode;
+    const BatchKernels* kernels;
+} BatchProgram;
+
+void batch_add_scalar(double* out, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; i++) out[i] = a[i] + b[i]; }
+void batch_sub_scalar(double* out, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; i++) out[i] = a[i] - b[i]; }
+void batch_mul_scalar(double* out, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; i++) out[i] = a[i] * b[i]; }
+void batch_div_scalar(double* out, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; i++) out[i] = a[i] / b[i]; }
+void batch_neg_scalar(double* out, const double* a, size_t n) { for (size_t i = 0; i < n; i++) out[i] = -a[i]; }
+void batch_min_scalar(double* out, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; i++) out[i] = math_binary(MINIMUM, a[i], b[i]); }
+void batch_max_scalar(double* out, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; i++) out[i] = math_binary(MAXIMUM, a[i], b[i]); }
+void batch_sqrt_scalar(double* out, const double* a, size_t n) { for (size_t i = 0; i < n; i++) out[i] = sqrt(a[i]); }
+void batch_abs_scalar(double* out, const double* a, size_t n) { for (size_t i = 0; i < n; i++) out[i] = fabs(a[i]); }
+
+// pow, exp, log, sin and cos have no vector instruction, every isa runs them through libm
+void batch_pow(double* out, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; i++) out[i] = pow(a[i], b[i]); }
+void batch_exp(double* out, const double* a, size_t n) { for (size_t i = 0; i < n; i++) out[i] = exp(a[i]); }
+void batch_log(double* out, const double* a, size_t n) { for (size_t i = 0; i < n; i++) out[i] = log(a[i]); }
+void batch_sin(double* out, const double* a, size_t n) { for (size_t i = 0; i < n; i++) out[i] = sin(a[i]); }
+void batch_cos(double* out, const double* a, size_t n) { for (size_t i = 0; i < n; i++) out[i] = cos(a[i]); }
+
+static const BatchKernels batch_scalar_kernels = {
+        BATCH_SCALAR, "scalar", batch_add_scalar, batch_sub_scalar, batch_mul_scalar, batch_div_scalar, batch_neg_scalar,
+        batch_min_scalar, batch_max_scalar, batch_sqrt_scalar, batch_abs_scalar
+};
+
+#if BATCH_X86
+
+// columns may point anywhere into caller memory, so every load and store is unaligned.
+// the tails go through the scalar kernels.
+#define BATCH_BINARY_KERNEL(name, isa, vec, width, load, store, op, tail)                                    \
+    __attribute__((target(isa))) void name(double* out, const double* a, const double* b, size_t n) {       \
+        size_t i = 0;                                                                                         \
+        for (; i + width <= n; i += width) {                                                                  \
+            vec va = load(a + i);                                                                             \
+            vec vb = load(b + i);                                                                             \
+            store(out + i, op(va, vb));                                                                       \
+        }                                                                                                     \
+        tail(out + i, a + i, b + i, n - i);                                                                   \
+    }
+
+BATCH_BINARY_KERNEL(batch_add_sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, batch_add_scalar)
+BATCH_BINARY_KERNEL(batch_sub_sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, batch_sub_scalar)
+BATCH_BINARY_KERNEL(batch_mul_sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, batch_mul_scalar)
+BATCH_BINARY_KERNEL(batch_div_sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd, batch_div_scalar)
+BATCH_BINARY_KERNEL(batch_add_avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, batch_add_scalar)
+BATCH_BINARY_KERNEL(batch_sub_avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, batch_sub_scalar)
+BATCH_BINARY_KERNEL(batch_mul_avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, batch_mul_scalar)
+BATCH_BINARY_KERNEL(batch_div_avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_div_pd, batch_div_scalar)
+// minpd/maxpd pick like math_binary does
+BATCH_BINARY_KERNEL(batch_min_sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_min_pd, batch_min_scalar)
+BATCH_BINARY_KERNEL(batch_max_sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_max_pd, batch_max_scalar)
+BATCH_BINARY_KERNEL(batch_min_avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_min_pd, batch_min_scalar)
+BATCH_BINARY_KERNEL(batch_max_avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_max_pd, batch_max_scalar)
+
+#undef BATCH_BINARY_KERNEL
+
+// negation flips the sign bit, so -0.0 and NaNs come out the same as the scalar path
+__attribute__((target("sse2"))) void batch_neg_sse2(double* out, const double* a, size_t n) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_xor_pd(_mm_loadu_pd(a + i), sign));
+    }
+    batch_neg_scalar(out + i, a + i, n - i);
+}
+
+__attribute__((target("avx2"))) void batch_neg_avx2(double* out, const double* a, size_t n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    }
+    batch_neg_scalar(out + i, a + i, n - i);
+}
+
+__attribute__((target("sse2"))) void batch_abs_sse2(double* out, const double* a, size_t n) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_andnot_pd(sign, _mm_loadu_pd(a + i)));
+    }
+    batch_abs_scalar(out + i, a + i, n - i);
+}
+
+__attribute__((target("avx2"))) void batch_abs_avx2(double* out, const double* a, size_t n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_andnot_pd(sign, _mm256_loadu_pd(a + i)));
+    }
+    batch_abs_scalar(out + i, a + i, n - i);
+}
+
+// sqrtpd is correctly rounded, like sqrt
+__attribute__((target("sse2"))) void batch_sqrt_sse2(double* out, const double* a, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(a + i)));
+    }
+    batch_sqrt_scalar(out + i, a + i, n - i);
+}
+
+__attribute__((target("avx2"))) void batch_sqrt_avx2(double* out, const double* a, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+    }
+    batch_sqrt_scalar(out + i, a + i, n - i);
+}
+
+static const BatchKernels batch_sse2_kernels = {
+        BATCH_SSE2, "sse2", batch_add_sse2, batch_sub_sse2, batch_mul_sse2, batch_div_sse2, batch_neg_sse2,
+        batch_min_sse2, batch_max_sse2, batch_sqrt_sse2, batch_abs_sse2
+};
+static const BatchKernels batch_avx2_kernels = {
+        BATCH_AVX2, "avx2", batch_add_avx2, batch_sub_avx2, batch_mul_avx2, batch_div_avx2, batch_neg_avx2,
+        batch_min_avx2, batch_max_avx2, batch_sqrt_avx2, batch_abs_avx2
+};
+
+#endif
+
+bool batch_isa_supported(BatchIsa isa) {
+    switch (isa) {
+        case BATCH_SCALAR:
+            return true;
+#if BATCH_X86
+        case BATCH_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case BATCH_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+// NULL if the cpu can't run the isa
+const BatchKernels* batch_kernels(BatchIsa isa) {
+    if (!batch_isa_supported(isa)) return NULL;
+    switch (isa) {
+#if BATCH_X86
+        case BATCH_SSE2: return &batch_sse2_kernels;
+        case BATCH_AVX2: return &batch_avx2_kernels;
+#endif
+        default: return &batch_scalar_kernels;
+    }
+}
+
+const BatchKernels* batch_best_kernels() {
+    if (batch_isa_supported(BATCH_AVX2)) return batch_kernels(BATCH_AVX2);
+    if (batch_isa_supported(BATCH_SSE2)) return batch_kernels(BATCH_SSE2);
+    return batch_kernels(BATCH_SCALAR);
+}
+
+// returns NULL (after printing the error) if the program can't be batched
+BatchProgram* batch_compile(InstructionArr* instructions) {
+    BcProgram* bytecode = bc_compile_inputs(instructions);
+    if (bytecode == NULL) return NULL;
+    for (int i = 0; i < bytecode->code->size; i++) {
+        if (bytecode->code->data[i].op == BC_PRINT) {
+            // rows are evaluated a block at a time, so there is no sensible order for the output
+            printf("ERROR %d: print isn't supported in batch evaluation\n", i);
+            bc_program_free(bytecode);
+            return NULL;
+        }
+    }
+    BatchProgram* program = malloc(sizeof(BatchProgram));
+    program->bytecode = bytecode;
+    program->kernels = batch_best_kernels();
+    return program;
+}
+
+// forces an instruction set, returns false if the cpu doesn't have it
+bool batch_program_set_isa(BatchProgram* program, BatchIsa isa) {
+    const BatchKernels* kernels = batch_kernels(isa);
+    if (kernels == NULL) return false;
+    program->kernels = kernels;
+    return true;
+}
+
+void batch_program_free(BatchProgram* program) {
+    bc_program_free(program->bytecode);
+    free(program);
+}
+
+int batch_input_count(BatchProgram* program) {
+    return program->bytecode->inputs->size;
+}
+
+const char* batch_input_name(BatchProgram* program, int index) {
+    return symbol_name(program->bytecode->inputs->data[index]);
+}
+
+// the scratch columns are capped at about 8MB, so programs with a big frame run with shorter blocks
+#define BATCH_MAX_BLOCK 1024
+#define BATCH_MIN_BLOCK 16
+#define BATCH_SCRATCH_BYTES (8 * 1024 * 1024)
+
+// evaluates the program for every row. inputs must cover every free identifier,
+// outputs are filled with the value each named variable has at the end of the program.
+bool batch_run(BatchProgram* program, size_t rows, const BatchColumn* inputs, int input_count,
+               BatchColumn* outputs, int output_count) {
+    BcProgram* bc = program->bytecode;
+    const BatchKernels* k = program->kernels;
+    uint32_t frame_size = bc->frame_size;
+    uint32_t const_base = frame_size;
+    uint32_t input_base = frame_size + bc->constants->size;
+    uint32_t reg_count = bc_register_count(bc);
+
+    // match inputs and outputs up front so the loop doesn't care about names
+    double** input_data = malloc((bc->inputs->size + 1) * sizeof(double*));
+    for (int i = 0; i < bc->inputs->size; i++) {
+        input_data[i] = NULL;
+        for (int j = 0; j < input_count; j++) {
+            if (symbol_find(inputs[j].name) == (int)bc->inputs->data[i]) {
+                input_data[i] = inputs[j].data;
+                break;
+            }
+        }
+        if (input_data[i] == NULL) {
+            printf("ERROR: no input column for '%s'\n", symbol_name(bc->inputs->data[i]));
+            free(input_data);
+            return false;
+        }
+    }
+    uint32_t* output_regs = malloc((output_count + 1) * sizeof(uint32_t));
+    for (int i = 0; i < output_count; i++) {
+        int symbol = symbol_find(outputs[i].name);
+        if (symbol < 0 || (uint32_t)symbol >= bc->symbol_count || bc->symbol_regs[symbol] < 0) {
+            printf("ERROR: '%s' is never assigned\n", outputs[i].name);
+            free(input_data);
+            free(output_regs);
+            return false;
+        }
+        output_regs[i] = bc->symbol_regs[symbol];
+    }
+
+    size_t block = BATCH_SCRATCH_BYTES / ((size_t)(frame_size + bc->constants->size + 1) * sizeof(double));
+    if (block > BATCH_MAX_BLOCK) block = BATCH_MAX_BLOCK;
+    if (block < BATCH_MIN_BLOCK) block = BATCH_MIN_BLOCK;
+    block &= ~(size_t)3;
+
+    // frame and constant registers get a block-sized column each, input registers point straight into the caller's columns
+    double* scratch = malloc(((size_t)frame_size + bc->constants->size + 1) * block * sizeof(double));
+    double** cols = malloc((reg_count + 1) * sizeof(double*));
+    for (uint32_t r = 0; r < input_base; r++) {
+        cols[r] = scratch + (size_t)r * block;
+    }
+    for (int c = 0; c < bc->constants->size; c++) {
+        for (size_t j = 0; j < block; j++) {
+            cols[const_base + c][j] = bc->constants->data[c];
+        }
+    }
+
+    const BcInstr* code = bc->code->data;
+    int code_size = bc->code->size;
+    for (size_t row = 0; row < rows; row += block) {
+        size_t n = rows - row < block ? rows - row : block;
+        for (int i = 0; i < bc->inputs->size; i++) {
+            cols[input_base + i] = input_data[i] + row;
+        }
+        for (int i = 0; i < code_size; i++) {
+            const BcInstr* instr = &code[i];
+            double* out = cols[instr->out];
+            switch ((BcOp)instr->op) {
+                case BC_ADD: k->add(out, cols[instr->a], cols[instr->b], n); break;
+                case BC_SUB: k->sub(out, cols[instr->a], cols[instr->b], n); break;
+                case BC_MUL: k->mul(out, cols[instr->a], cols[instr->b], n); break;
+                case BC_DIV: k->div(out, cols[instr->a], cols[instr->b], n); break;
+                case BC_NEG: k->neg(out, cols[instr->a], n); break;
+                case BC_MOVE: memmove(out, cols[instr->a], n * sizeof(double)); break;
+                case BC_PRINT: break; // rejected by batch_compile
+                case BC_POW: batch_pow(out, cols[instr->a], cols[instr->b], n); break;
+                case BC_MIN: k->min(out, cols[instr->a], cols[instr->b], n); break;
+                case BC_MAX: k->max(out, cols[instr->a], cols[instr->b], n); break;
+                case BC_SQRT: k->sqrt(out, cols[instr->a], n); break;
+                case BC_EXP: batch_exp(out, cols[instr->a], n); break;
+                case BC_LOG: batch_log(out, cols[instr->a], n); break;
+                case BC_ABS: k->abs(out, cols[instr->a], n); break;
+                case BC_SIN: batch_sin(out, cols[instr->a], n); break;
+                case BC_COS: batch_cos(out, cols[instr->a], n); break;
+                case BC_ERROR: break; // bc_compile_inputs turns the errors down
+            }
+        }
+        for (int i = 0; i < output_count; i++) {
+            memcpy(outputs[i].data + row, cols[output_regs[i]], n * sizeof(double));
+        }
+    }
+
+    free(cols);
+    free(scratch);
+    free(output_regs);
+    free(input_data);
+    return true;
+}
+
+#endif //_BATCH_H
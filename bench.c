@@ -0,0 +1,2851 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "batch.h"
+#include "optimize.h"
+#include "regalloc.h"
+#include "cache.h"
+#include "stream.h"
+#include "parallel.h"
+#include "dag.h"
+#include "image.h"
+#include "reactive.h"
+#include "server.h"
+#include "session.h"
+
+// identifiers can only contain letters, so encode the index in base 26
+void bench_name(char* out, uint32_t index) {
+    *out++ = 'v';
+    do {
+        *out++ = (char)('a' + index % 26);
+        index /= 26;
+    } while (index);
+    *out = '\0';
+}
+
+double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// prints run to /dev/null while they are timed
+int suite_mute() {
+    output_flush();
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    return saved;
+}
+
+void suite_unmute(int saved) {
+    output_flush();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+// defines `names` variables, then runs `reads` statements that each read three of them
+char* bench_symbol_script(uint32_t names, uint32_t reads) {
+    size_t cap = (size_t)(names + reads) * 64;
+    char* src = malloc(cap);
+    size_t len = 0;
+    char a[16], b[16], c[16];
+    for (uint32_t i = 0; i < names; i++) {
+        bench_name(a, i);
+        len += snprintf(src + len, cap - len, "%s = %u;", a, i);
+    }
+    uint32_t seed = 12345;
+    for (uint32_t i = 0; i < reads; i++) {
+        seed = seed * 1103515245u + 12345u;
+        bench_name(a, (seed >> 8) % names);
+        seed = seed * 1103515245u + 12345u;
+        bench_name(b, (seed >> 8) % names);
+        seed = seed * 1103515245u + 12345u;
+        bench_name(c, (seed >> 8) % names);
+        len += snprintf(src + len, cap - len, "t = %s * %s + %s;", a, b, c);
+    }
+    return src;
+}
+
+void bench_symbols() {
+    const uint32_t reads = 100000;
+    const int reps = 5;
+    printf("symbol lookup: %u read statements, best of %d\n", reads, reps);
+    printf("%10s %14s %14s\n", "names", "instructions", "ns/instr");
+    for (uint32_t names = 10; names <= 10000; names *= 10) {
+        char* src = bench_symbol_script(names, reads);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        double best = 1e30;
+        for (int r = 0; r < reps; r++) {
+            double start = bench_now();
+            run_instructions(instructions);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%10u %14d %14.2f\n", names, instructions->size, best * 1e9 / instructions->size);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+}
+
+void bench_bytecode() {
+    char* src = bench_symbol_script(1000, 200000);
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code(src, arena);
+    BcProgram* program = bc_compile(instructions);
+
+    size_t instr_bytes = instructions->size * sizeof(Instruction);
+    size_t bc_bytes = program->code->size * sizeof(BcInstr) + program->constants->size * sizeof(double)
+                      + program->args->size * sizeof(uint32_t);
+    printf("bytecode size: %d instructions\n", instructions->size);
+    printf("%12s %14s\n", "format", "bytes");
+    printf("%12s %14zu\n", "Instruction", instr_bytes);
+    printf("%12s %14zu\n", "BcInstr", bc_bytes);
+
+    bc_program_free(program);
+    free_instructions(instructions);
+    arena_free(arena);
+    free(src);
+}
+
+// A/B of the execution engines on the same program
+void bench_engines() {
+    const int reps = 5;
+    char* src = bench_symbol_script(1000, 200000);
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code(src, arena);
+    printf("engines: %d instructions, best of %d\n", instructions->size, reps);
+    printf("%12s %14s\n", "engine", "ns/instr");
+    for (int e = 0; e < (int)(sizeof(engine_names) / sizeof(engine_names[0])); e++) {
+        EngineProgram* program = engine_prepare(instructions, (VmEngine)e);
+        double best = 1e30;
+        for (int r = 0; r < reps; r++) {
+            double start = bench_now();
+            engine_run(program);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%12s %14.2f\n", engine_names[e], best * 1e9 / instructions->size);
+        engine_program_free(program);
+    }
+    free_instructions(instructions);
+    arena_free(arena);
+    free(src);
+}
+
+void bench_batch() {
+    const size_t rows = 1000000;
+    const int reps = 5;
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code("y = (a * b + c) / (a - d) * 3 - b; z = -y + a * 2 - c / 4", arena);
+    BatchProgram* program = batch_compile(instructions);
+    double* columns[6];
+    for (int c = 0; c < 6; c++) {
+        columns[c] = malloc(rows * sizeof(double));
+    }
+    for (size_t i = 0; i < rows; i++) {
+        columns[0][i] = (double)i * 0.5 + 1;
+        columns[1][i] = (double)(i % 7) - 3;
+        columns[2][i] = (double)(i % 1000) * 0.01;
+        columns[3][i] = (double)i * 0.25 - 7;
+    }
+    BatchColumn inputs[] = {{"a", columns[0]}, {"b", columns[1]}, {"c", columns[2]}, {"d", columns[3]}};
+    BatchColumn outputs[] = {{"y", columns[4]}, {"z", columns[5]}};
+    printf("batch: %zu rows, %d instructions, best of %d\n", rows, program->bytecode->code->size, reps);
+    printf("%12s %14s\n", "kernels", "ns/row");
+    for (int isa = BATCH_SCALAR; isa <= BATCH_AVX2; isa++) {
+        if (!batch_program_set_isa(program, (BatchIsa)isa)) continue;
+        double best = 1e30;
+        for (int r = 0; r < reps; r++) {
+            double start = bench_now();
+            batch_run(program, rows, inputs, 4, outputs, 2);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%12s %14.3f\n", program->kernels->name, best * 1e9 / rows);
+    }
+    for (int c = 0; c < 6; c++) {
+        free(columns[c]);
+    }
+    batch_program_free(program);
+    free_instructions(instructions);
+    arena_free(arena);
+}
+
+uint32_t bench_rand(uint32_t* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+void bench_random_expr(char* out, size_t cap, size_t* len, uint32_t* seed, uint32_t names, int depth) {
+    char name[16];
+    uint32_t pick = bench_rand(seed) % 8;
+    if (depth == 0 || pick < 2) {
+        if (bench_rand(seed) % 3 == 0) {
+            *len += snprintf(out + *len, cap - *len, "%u.%u", bench_rand(seed) % 100, bench_rand(seed) % 10);
+        } else {
+            bench_name(name, bench_rand(seed) % names);
+            *len += snprintf(out + *len, cap - *len, "%s", name);
+        }
+    } else if (pick == 2) {
+        *len += snprintf(out + *len, cap - *len, bench_rand(seed) % 4 ? "-(" : "+(");
+        bench_random_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, ")");
+    } else {
+        *len += snprintf(out + *len, cap - *len, "(");
+        bench_random_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, " %c ", "+-*/"[bench_rand(seed) % 4]);
+        bench_random_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, ")");
+    }
+}
+
+// constants first, then statements that assign an expression to a name, mostly. the others are the assignments
+// the passes treat specially: copies of a name, a constant again, and an assignment nested in another one, which
+// either renames what the inner one computed or copies the name the inner one copied.
+// without the constants every name starts out as a free identifier, for batch evaluation.
+char* bench_random_program(uint32_t seed, uint32_t names, uint32_t statements, bool constants) {
+    size_t cap = (size_t)(names + statements) * 4096;
+    char* src = malloc(cap);
+    size_t len = 0;
+    char name[16], other[16], inner[16];
+    for (uint32_t i = 0; i < names && constants; i++) {
+        bench_name(name, i);
+        len += snprintf(src + len, cap - len, "%s = %u;", name, bench_rand(&seed) % 50);
+    }
+    for (uint32_t i = 0; i < statements; i++) {
+        bench_name(name, bench_rand(&seed) % names);
+        bench_name(other, bench_rand(&seed) % names);
+        bench_name(inner, bench_rand(&seed) % names);
+        switch (bench_rand(&seed) % 10) {
+            case 0:
+                len += snprintf(src + len, cap - len, "%s = %s;", name, other);
+                break;
+            case 1:
+                len += snprintf(src + len, cap - len, "%s = %u;", name, bench_rand(&seed) % 50);
+                break;
+            case 2:
+                len += snprintf(src + len, cap - len, "%s = (%s = %s);", name, inner, other);
+                break;
+            case 3:
+                len += snprintf(src + len, cap - len, "%s = (%s = ", name, inner);
+                bench_random_expr(src, cap, &len, &seed, names, 3);
+                len += snprintf(src + len, cap - len, " + %s);", other);
+                break;
+            default:
+                len += snprintf(src + len, cap - len, "%s = (", name);
+                bench_random_expr(src, cap, &len, &seed, names, 5);
+                len += snprintf(src + len, cap - len, ") * 1;");
+                break;
+        }
+    }
+    return src;
+}
+
+// NaNs only have to agree on being NaN, the sign and payload depend on which operand order the compiler picked
+bool bench_same_double(double a, double b) {
+    return (a != a && b != b) || memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// differential check of the jit against run_instructions: every named variable must end up with the same value
+int check_jit() {
+    const int programs = 200;
+    int mismatches = 0, skipped = 0;
+    for (int p = 0; p < programs; p++) {
+        char* src = bench_random_program(p * 7919 + 1, 8, 40, true);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstrVM* vm = vm_create(instructions);
+        vm_execute(vm, instructions);
+        BcProgram* bytecode = bc_compile(instructions);
+        JitProgram* jit = bytecode ? jit_compile(bytecode) : NULL;
+        if (jit == NULL) {
+            skipped++;
+            if (bytecode) bc_program_free(bytecode);
+        } else {
+            double* regs = calloc(bc_register_count(bytecode) + 1, sizeof(double));
+            jit_run_frame(jit, regs);
+            for (uint32_t s = 0; s < bytecode->symbol_count && s < vm->symbol_count; s++) {
+                int expected = vm->symbol_slots[s];
+                int got = bytecode->symbol_regs[s];
+                if ((expected < 0) != (got < 0)
+                    || (expected >= 0 && !bench_same_double(vm->vars[expected], regs[got]))) {
+                    if (mismatches++ < 5) {
+                        printf("jit mismatch in program %d, '%s'\n", p, symbol_name(s));
+                    }
+                }
+            }
+            free(regs);
+            jit_program_free(jit);
+        }
+        vm_free(vm);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    printf("jit differential: %d programs, %d mismatches, %d skipped (no jit)\n", programs, mismatches, skipped);
+    return mismatches;
+}
+
+// differential check of optimize_instructions: the optimized program has to leave every named variable the same
+int check_optimizer() {
+    const int programs = 200;
+    int mismatches = 0;
+    OptStats total = {0};
+    for (int p = 0; p < programs; p++) {
+        char* src = bench_random_program(p * 104729 + 3, 8, 40, true);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstrVM* expected = vm_create(instructions);
+        vm_execute(expected, instructions);
+        OptStats stats;
+        optimize_instructions(instructions, &stats);
+        total.before += stats.before;
+        total.after += stats.after;
+        InstrVM* got = vm_create(instructions);
+        vm_execute(got, instructions);
+        for (uint32_t s = 0; s < expected->symbol_count && s < got->symbol_count; s++) {
+            int e = expected->symbol_slots[s], g = got->symbol_slots[s];
+            if ((e < 0) != (g < 0) || (e >= 0 && !bench_same_double(expected->vars[e], got->vars[g]))) {
+                if (mismatches++ < 5) {
+                    printf("optimizer mismatch in program %d, '%s'\n", p, symbol_name(s));
+                }
+            }
+        }
+        vm_free(expected);
+        vm_free(got);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    printf("optimizer differential: %d programs, %d mismatches, %d -> %d instructions\n",
+           programs, mismatches, total.before, total.after);
+
+    // closed programs fold down to constants, so run open ones through the batch engine as well
+    const size_t rows = 64;
+    int closed_mismatches = mismatches;
+    mismatches = 0;
+    total.before = total.after = 0;
+    double* columns[16];
+    BatchColumn inputs[8], expected[8], got[8];
+    char names[8][16];
+    for (int c = 0; c < 16; c++) {
+        columns[c] = malloc(rows * sizeof(double));
+    }
+    for (int n = 0; n < 8; n++) {
+        bench_name(names[n], n);
+        for (size_t row = 0; row < rows; row++) {
+            columns[n][row] = (double)row * 0.75 - (double)n * 3;
+        }
+        inputs[n] = (BatchColumn){names[n], columns[n]};
+    }
+    for (int p = 0; p < programs; p++) {
+        char* src = bench_random_program((uint32_t)p * 15485863u + 5, 8, 40, false);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        BatchProgram* before = batch_compile(instructions);
+        OptStats stats;
+        optimize_instructions(instructions, &stats);
+        total.before += stats.before;
+        total.after += stats.after;
+        BatchProgram* after = batch_compile(instructions);
+        int outputs = 0;
+        for (int n = 0; n < 8; n++) {
+            int symbol = symbol_find(names[n]);
+            if (symbol < 0 || before->bytecode->symbol_regs[symbol] < 0) continue;
+            expected[outputs] = (BatchColumn){names[n], columns[8 + outputs]};
+            got[outputs] = (BatchColumn){names[n], malloc(rows * sizeof(double))};
+            outputs++;
+        }
+        batch_run(before, rows, inputs, 8, expected, outputs);
+        batch_run(after, rows, inputs, 8, got, outputs);
+        for (int o = 0; o < outputs; o++) {
+            for (size_t row = 0; row < rows; row++) {
+                if (!bench_same_double(expected[o].data[row], got[o].data[row]) && mismatches++ < 5) {
+                    printf("optimizer mismatch in open program %d, '%s'\n", p, got[o].name);
+                }
+            }
+            free(got[o].data);
+        }
+        batch_program_free(before);
+        batch_program_free(after);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    for (int c = 0; c < 16; c++) {
+        free(columns[c]);
+    }
+    printf("optimizer differential (open): %d programs, %d mismatches, %d -> %d instructions\n",
+           programs, mismatches, total.before, total.after);
+    return closed_mismatches + mismatches;
+}
+
+// differential check of allocate_slots, on its own and after optimize_instructions
+int check_slots() {
+    const int programs = 200;
+    int mismatches = 0;
+    size_t frame_before = 0, frame_after = 0;
+    for (int p = 0; p < programs * 2; p++) {
+        char* src = bench_random_program((uint32_t)p * 7919u + 11, 8, 40, true);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        if (p >= programs) optimize_instructions(instructions, NULL);
+        InstrVM* expected = vm_create(instructions);
+        vm_execute(expected, instructions);
+        frame_before += expected->frame_size;
+        frame_after += allocate_slots(instructions);
+        InstrVM* got = vm_create(instructions);
+        vm_execute(got, instructions);
+        for (uint32_t s = 0; s < expected->symbol_count && s < got->symbol_count; s++) {
+            int e = expected->symbol_slots[s], g = got->symbol_slots[s];
+            if ((e < 0) != (g < 0) || (e >= 0 && !bench_same_double(expected->vars[e], got->vars[g]))) {
+                if (mismatches++ < 5) {
+                    printf("slot allocation mismatch in program %d, '%s'\n", p, symbol_name(s));
+                }
+            }
+        }
+        vm_free(expected);
+        vm_free(got);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    printf("slot allocation differential: %d programs, %d mismatches, frames %zu -> %zu slots\n",
+           programs * 2, mismatches, frame_before, frame_after);
+    return mismatches;
+}
+
+// differential check of the program cache: a cached program has to run like a fresh compilation,
+// including after it was evicted and compiled again
+int check_cache() {
+    const int programs = 200;
+    int mismatches = 0;
+    // small enough that the second round has to recompile most programs, it goes backwards so the
+    // programs compiled last are hits
+    ProgramCache* cache = program_cache_create(256 * 1024, false);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < programs; i++) {
+            int p = round ? programs - 1 - i : i;
+            char* src = bench_random_program((uint32_t)p * 2654435761u + 7, 8, 12, true);
+            Arena* arena = arena_create();
+            InstructionArr* instructions = gen_code(src, arena);
+            InstrVM* expected = vm_create(instructions);
+            vm_execute(expected, instructions);
+            InstructionArr* cached = program_cache_get(cache, src);
+            InstrVM* got = vm_create(cached);
+            vm_execute(got, cached);
+            for (uint32_t s = 0; s < expected->symbol_count && s < got->symbol_count; s++) {
+                int e = expected->symbol_slots[s], g = got->symbol_slots[s];
+                if ((e < 0) != (g < 0) || (e >= 0 && !bench_same_double(expected->vars[e], got->vars[g]))) {
+                    if (mismatches++ < 5) {
+                        printf("cache mismatch in program %d, '%s'\n", p, symbol_name(s));
+                    }
+                }
+            }
+            vm_free(expected);
+            vm_free(got);
+            free_instructions(instructions);
+            arena_free(arena);
+            free(src);
+        }
+    }
+    printf("cache differential: %d programs, %d mismatches, ", programs, mismatches);
+    print_cache_stats(cache);
+    program_cache_free(cache);
+    return mismatches;
+}
+
+// differential check of the streaming runner, fed in pieces of random size so statements get split between them
+int check_stream() {
+    const int programs = 200;
+    int mismatches = 0;
+    uint32_t max_frame = 0;
+    for (int p = 0; p < programs; p++) {
+        uint32_t seed = (uint32_t)p * 97u + 13;
+        char* src = bench_random_program(seed, 8, 40, true);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstrVM* expected = vm_create(instructions);
+        vm_execute(expected, instructions);
+        StreamRunner* runner = stream_create();
+        size_t len = strlen(src);
+        for (size_t at = 0; at < len;) {
+            size_t piece = 1 + bench_rand(&seed) % 200;
+            if (piece > len - at) piece = len - at;
+            stream_feed(runner, src + at, piece);
+            at += piece;
+        }
+        stream_finish(runner);
+        for (uint32_t s = 0; s < expected->symbol_count; s++) {
+            double got;
+            bool bound = stream_get_var(runner, symbol_name(s), &got);
+            int e = expected->symbol_slots[s];
+            if ((e >= 0) != bound || (bound && !bench_same_double(expected->vars[e], got))) {
+                if (mismatches++ < 5) {
+                    printf("stream mismatch in program %d, '%s'\n", p, symbol_name(s));
+                }
+            }
+        }
+        if (runner->stats.max_frame_size > max_frame) max_frame = runner->stats.max_frame_size;
+        stream_free(runner);
+        vm_free(expected);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    printf("stream differential: %d programs, %d mismatches, largest frame %u slots\n", programs, mismatches, max_frame);
+    return mismatches;
+}
+
+// a script much longer than one statement, whole vs streamed from a file
+void bench_stream() {
+    char* src = bench_symbol_script(1000, 500000);
+    size_t len = strlen(src);
+    FILE* file = tmpfile();
+    fwrite(src, 1, len, file);
+
+    double start = bench_now();
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code(src, arena);
+    InstrVM* vm = vm_create(instructions);
+    vm_execute(vm, instructions);
+    double whole = bench_now() - start;
+    uint32_t whole_frame = vm->frame_size;
+    size_t whole_bytes = instructions->capacity * sizeof(Instruction) + (size_t)whole_frame * sizeof(double);
+    vm_free(vm);
+    free_instructions(instructions);
+    arena_free(arena);
+
+    rewind(file);
+    start = bench_now();
+    StreamRunner* runner = stream_create();
+    stream_run(runner, file);
+    double streamed = bench_now() - start;
+    printf("stream: %.1f MB script, %llu statements\n", len / 1e6, (unsigned long long)runner->stats.statements);
+    printf("%12s %14s %14s %14s\n", "mode", "MB/s", "frame slots", "program bytes");
+    printf("%12s %14.1f %14u %14zu\n", "gen_code", len / 1e6 / whole, whole_frame, whole_bytes);
+    printf("%12s %14.1f %14u %14zu\n", "stream", len / 1e6 / streamed, runner->stats.max_frame_size,
+           (size_t)runner->stats.max_frame_size * sizeof(double) + STREAM_CHUNK_SIZE);
+    stream_free(runner);
+    fclose(file);
+    free(src);
+}
+
+// differential check of the lexer's scanners against the character classes, at every alignment
+int check_lexer() {
+    const int len = 4096;
+    char* text = malloc(len + 1);
+    const char alphabet[] = " \t\r\n0123456789.abcXYZ+-*/(),=;\x80\xff";
+    uint32_t seed = 4242;
+    int mismatches = 0;
+    for (int i = 0; i < len; i++) {
+        // runs of one class, so the scans cross block boundaries
+        int run = 1 + bench_rand(&seed) % 40;
+        char c = alphabet[bench_rand(&seed) % (sizeof(alphabet) - 1)];
+        for (; run > 0 && i < len; run--, i++) {
+            text[i] = bench_rand(&seed) % 4 ? c : alphabet[bench_rand(&seed) % (sizeof(alphabet) - 1)];
+        }
+        i--;
+    }
+    text[len] = '\0';
+    const int classes[] = {LC_SPACE, LC_DIGIT, LC_ALPHA};
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < len; i++) {
+            const char* expected = text + i;
+            while (lexer_classes[(uint8_t)*expected] & classes[c]) expected++;
+            if (lexer_scan(text + i, classes[c]) != expected && mismatches++ < 5) {
+                printf("lexer scan mismatch at %d for class %d\n", i, classes[c]);
+            }
+            uint32_t lines = 0;
+            for (const char* p = text + i; p < expected; p++) lines += *p == '\n';
+            if (lexer_count_newlines(text + i, expected) != lines && mismatches++ < 5) {
+                printf("lexer newline mismatch at %d\n", i);
+            }
+        }
+    }
+    printf("lexer differential: %d positions, %d mismatches\n", len * 3, mismatches);
+    free(text);
+    return mismatches;
+}
+
+// lexer-only throughput, tokens are counted so the loop can't be skipped
+void bench_lexer() {
+    const int reps = 5;
+    const uint32_t statements = 1000000;
+    char* dense = bench_symbol_script(1000, statements);
+    // the same kind of program with long names, numbers and indentation
+    size_t cap = (size_t)statements * 160;
+    char* spaced = malloc(cap);
+    size_t len = 0;
+    uint32_t seed = 7;
+    for (uint32_t i = 0; i < statements; i++) {
+        len += snprintf(spaced + len, cap - len, "\n        totalVelocityValue = previousVelocityValue * %u.%u\n"
+                                                "            + accelerationValue;",
+                        bench_rand(&seed) % 100000, bench_rand(&seed) % 100000);
+    }
+    // ';' is split off before lexing, so it isn't a token
+    for (char* p = dense; *p; p++) {
+        if (*p == ';') *p = ',';
+    }
+    for (char* p = spaced; *p; p++) {
+        if (*p == ';') *p = ',';
+    }
+    const char* inputs[] = {dense, spaced};
+    const char* names[] = {"dense", "spaced"};
+    printf("lexer: best of %d\n", reps);
+    printf("%12s %14s %14s\n", "input", "MB", "MB/s");
+    for (int in = 0; in < 2; in++) {
+        size_t bytes = strlen(inputs[in]);
+        double best = 1e30;
+        uint64_t tokens = 0;
+        for (int r = 0; r < reps; r++) {
+            Arena* arena = arena_create();
+            double start = bench_now();
+            Lexer* lexer = lexer_create(inputs[in], arena);
+            tokens = 0;
+            while (lexer_next_token(lexer).type != TT_EOF) tokens++;
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+            arena_free(arena);
+        }
+        printf("%12s %14.1f %14.1f\n", names[in], bytes / 1e6, bytes / 1e6 / best);
+        if (tokens == 0) printf("no tokens\n");
+    }
+    free(dense);
+    free(spaced);
+}
+
+// differential check of number_parse against strtod: short and long decimals, tiny and huge values, and the exact
+// halfway points between neighbouring doubles (and the decimals just above and below them)
+int check_numbers() {
+    const int count = 100000;
+    char* text = malloc(2048);
+    uint32_t seed = 31337;
+    int mismatches = 0;
+    for (int i = 0; i < count; i++) {
+        int kind = i % 5;
+        if (kind == 0) {
+            snprintf(text, 2048, "%u.%u", bench_rand(&seed), bench_rand(&seed) % 100000);
+        } else if (kind == 1) {
+            // more digits than fit in a uint64
+            int len = 0;
+            int digits = 20 + bench_rand(&seed) % 40;
+            int point = (int)(bench_rand(&seed) % digits);
+            for (int d = 0; d < digits; d++) {
+                text[len++] = (char)('0' + bench_rand(&seed) % 10);
+                if (d == point) text[len++] = '.';
+            }
+            text[len] = '\0';
+        } else if (kind == 2) {
+            // very small or very large
+            int zeros = (int)(bench_rand(&seed) % 340);
+            if (bench_rand(&seed) % 2) {
+                int len = snprintf(text, 2048, "0.");
+                for (int z = 0; z < zeros; z++) text[len++] = '0';
+                snprintf(text + len, 2048 - len, "%u%u", bench_rand(&seed), bench_rand(&seed));
+            } else {
+                int len = snprintf(text, 2048, "%u", bench_rand(&seed) | 1);
+                for (int z = 0; z < zeros; z++) text[len++] = (char)('0' + bench_rand(&seed) % 10);
+                text[len] = '\0';
+            }
+        } else {
+            // halfway between x and the next double, exactly, which long double can hold
+            uint64_t bits = ((uint64_t)bench_rand(&seed) << 32 | bench_rand(&seed)) % 0x7FEFFFFFFFFFFFFFULL;
+            double x, next;
+            memcpy(&x, &bits, sizeof(x));
+            bits++;
+            memcpy(&next, &bits, sizeof(next));
+            long double half = ((long double)x + (long double)next) / 2;
+            int len = snprintf(text, 2048, "%.1100Lf", half);
+            while (text[len - 1] == '0') text[--len] = '\0';
+            if (text[len - 1] == '.') text[len++] = '0';
+            text[len] = '\0';
+            if (kind == 4) {
+                // nudge the last digit, which moves the value just off the halfway point
+                char* last = text + len - 1;
+                *last = *last == '9' ? '8' : (char)(*last + 1);
+            }
+        }
+        double expected = strtod(text, NULL);
+        double got = number_parse(text, (uint32_t)strlen(text));
+        if (memcmp(&expected, &got, sizeof(double)) != 0 && mismatches++ < 5) {
+            printf("number mismatch for '%.80s': %.17g vs %.17g\n", text, expected, got);
+        }
+    }
+    printf("number differential: %d numbers, %d mismatches\n", count, mismatches);
+    free(text);
+    return mismatches;
+}
+
+// number-heavy data: parsing the numbers of a script, number_parse against copying each one out for strtod
+void bench_numbers() {
+    const int reps = 5;
+    const uint32_t count = 1000000;
+    size_t cap = (size_t)count * 32;
+    char* text = malloc(cap);
+    uint32_t* starts = malloc(count * sizeof(uint32_t));
+    uint32_t* lengths = malloc(count * sizeof(uint32_t));
+    size_t len = 0;
+    uint32_t seed = 5;
+    for (uint32_t i = 0; i < count; i++) {
+        starts[i] = (uint32_t)len;
+        if (i % 4 == 0) {
+            len += snprintf(text + len, cap - len, "%u", bench_rand(&seed) % 100000);
+        } else {
+            len += snprintf(text + len, cap - len, "%u.%06u", bench_rand(&seed) % 10000, bench_rand(&seed) % 1000000);
+        }
+        lengths[i] = (uint32_t)(len - starts[i]);
+        text[len++] = ',';
+    }
+    printf("numbers: %u numbers, best of %d\n", count, reps);
+    printf("%12s %14s\n", "parser", "ns/number");
+    for (int method = 0; method < 2; method++) {
+        double best = 1e30, sum = 0;
+        for (int r = 0; r < reps; r++) {
+            sum = 0;
+            double start = bench_now();
+            for (uint32_t i = 0; i < count; i++) {
+                if (method == 0) {
+                    sum += number_parse(text + starts[i], lengths[i]);
+                } else {
+                    char buf[64];
+                    memcpy(buf, text + starts[i], lengths[i]);
+                    buf[lengths[i]] = '\0';
+                    sum += strtod(buf, NULL);
+                }
+            }
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%12s %14.2f\n", method == 0 ? "number_parse" : "strtod", best * 1e9 / count);
+        if (sum == 0) printf("no numbers\n");
+    }
+    free(text);
+    free(starts);
+    free(lengths);
+}
+
+// repeated evaluation of a working set of expressions, compiling every time vs through the cache
+void bench_cache() {
+    const int distinct = 2000;
+    const int lookups = 200000;
+    char** sources = malloc(distinct * sizeof(char*));
+    for (int i = 0; i < distinct; i++) {
+        sources[i] = bench_random_program((uint32_t)i * 40503u + 17, 4, 2, false);
+    }
+    printf("cache: %d lookups over %d expressions\n", lookups, distinct);
+    printf("%12s %14s\n", "compile", "ns/lookup");
+
+    uint32_t seed = 99;
+    Arena* arena = arena_create();
+    double start = bench_now();
+    for (int i = 0; i < lookups; i++) {
+        InstructionArr* instructions = gen_code(sources[bench_rand(&seed) % distinct], arena);
+        allocate_slots(instructions);
+        free_instructions(instructions);
+        arena_reset(arena);
+    }
+    printf("%12s %14.2f\n", "gen_code", (bench_now() - start) * 1e9 / lookups);
+    arena_free(arena);
+
+    seed = 99;
+    ProgramCache* cache = program_cache_create(PROGRAM_CACHE_DEFAULT_BUDGET, false);
+    start = bench_now();
+    for (int i = 0; i < lookups; i++) {
+        program_cache_get(cache, sources[bench_rand(&seed) % distinct]);
+    }
+    printf("%12s %14.2f\n", "cached", (bench_now() - start) * 1e9 / lookups);
+    print_cache_stats(cache);
+    program_cache_free(cache);
+
+    for (int i = 0; i < distinct; i++) {
+        free(sources[i]);
+    }
+    free(sources);
+}
+
+// copy of src with every name's leading 'v' (see bench_name) replaced by prefix, so the names are new to the
+// symbol table. every 7th statement is followed by a print and some empty statements
+char* bench_prefix_names(const char* src, const char* prefix) {
+    size_t len = strlen(src);
+    size_t cap = len * (strlen(prefix) + 4) + 64;
+    char* out = malloc(cap);
+    size_t at = 0;
+    int statements = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == 'v' && (i == 0 || !is_alpha(src[i - 1]))) {
+            at += snprintf(out + at, cap - at, "%s", prefix);
+        } else if (src[i] == ';' && ++statements % 7 == 0) {
+            at += snprintf(out + at, cap - at, "; print(%sa, 2);;", prefix);
+        } else {
+            out[at++] = src[i];
+        }
+    }
+    out[at] = '\0';
+    return out;
+}
+
+bool bench_same_data(Data a, Data b, uint32_t a_base, uint32_t b_base, size_t a_prefix, size_t b_prefix) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+        case CONSTANT:
+            return bench_same_double(a.data.constant, b.data.constant);
+        case VARIABLE:
+            return a.data.variable == b.data.variable;
+        case IDENTIFIER: {
+            // names that were already interned (print) have the same index, new ones the same offset from the base
+            bool a_new = (uint32_t)a.data.ident.symbol >= a_base, b_new = (uint32_t)b.data.ident.symbol >= b_base;
+            if (a_new != b_new) return false;
+            if (!a_new) return a.data.ident.symbol == b.data.ident.symbol;
+            return a.data.ident.symbol - a_base == b.data.ident.symbol - b_base &&
+                   a.data.ident.name == symbol_name(a.data.ident.symbol) &&
+                   strcmp(a.data.ident.name + a_prefix, b.data.ident.name + b_prefix) == 0;
+        }
+        case ARGLIST:
+            if (a.data.arglist.len != b.data.arglist.len) return false;
+            for (int i = 0; i < a.data.arglist.len; i++) {
+                if (!bench_same_data(a.data.arglist.args[i], b.data.arglist.args[i], a_base, b_base, a_prefix, b_prefix)) {
+                    return false;
+                }
+            }
+            return true;
+        case FUNCTION:
+            return a.data.function == b.data.function;
+    }
+    return false;
+}
+
+int check_parallel() {
+    const int programs = 40;
+    int mismatches = 0;
+    ThreadPool* pool = pool_create(4);
+    // print is the one name that isn't new, it has to be known before either compiler sees it
+    symbol_intern("print");
+    for (int p = 0; p < programs; p++) {
+        char* src = bench_random_program((uint32_t)p * 131u + 7, 8, 300 + p * 37, p % 2 == 0);
+        char parallel_prefix[16], serial_prefix[16];
+        bench_name(parallel_prefix, (uint32_t)p * 2 + 1000);
+        bench_name(serial_prefix, (uint32_t)p * 2 + 1001);
+        parallel_prefix[0] = 'p';
+        serial_prefix[0] = 's';
+        char* parallel_src = bench_prefix_names(src, parallel_prefix);
+        char* serial_src = bench_prefix_names(src, serial_prefix);
+
+        Arena* parallel_arena = arena_create();
+        uint32_t parallel_base = symbol_count();
+        InstructionArr* parallel = gen_code_parallel(parallel_src, parallel_arena, pool);
+        Arena* serial_arena = arena_create();
+        uint32_t serial_base = symbol_count();
+        InstructionArr* serial = gen_code(serial_src, serial_arena);
+
+        bool same = parallel->size == serial->size;
+        for (int i = 0; same && i < serial->size; i++) {
+            Instruction a = parallel->data[i], b = serial->data[i];
+            same = a.out == b.out && a.type == b.type;
+            if (!same) break;
+            size_t ap = strlen(parallel_prefix), bp = strlen(serial_prefix);
+            switch (a.type) {
+                case BINARY:
+                    same = a.data.binary.op == b.data.binary.op &&
+                           bench_same_data(a.data.binary.left, b.data.binary.left, parallel_base, serial_base, ap, bp) &&
+                           bench_same_data(a.data.binary.right, b.data.binary.right, parallel_base, serial_base, ap, bp);
+                    break;
+                case UNARY:
+                    same = a.data.unary.op == b.data.unary.op &&
+                           bench_same_data(a.data.unary.operand, b.data.unary.operand, parallel_base, serial_base, ap, bp);
+                    break;
+                case SET:
+                    same = bench_same_data(a.data.set, b.data.set, parallel_base, serial_base, ap, bp);
+                    break;
+            }
+        }
+        if (!same && mismatches++ < 5) {
+            printf("parallel compile mismatch in program %d\n", p);
+        }
+        free_instructions(parallel);
+        free_instructions(serial);
+        arena_free(parallel_arena);
+        arena_free(serial_arena);
+        free(parallel_src);
+        free(serial_src);
+        free(src);
+    }
+    // a syntax error in any chunk is reported, like gen_code_checked reports it
+    for (int broken = 0; broken < 2; broken++) {
+        char* src = bench_random_program(4242, 8, 2000, true);
+        if (broken) memcpy(strstr(src + strlen(src) / 2, " = ") + 2, ")", 1);
+        Arena* arena = arena_create();
+        bool failed;
+        int saved = suite_mute();
+        InstructionArr* instructions = gen_code_parallel_checked(src, arena, pool, &failed);
+        suite_unmute(saved);
+        if (failed != (broken == 1) && mismatches++ < 5) {
+            printf("parallel compile %s a syntax error\n", broken ? "missed" : "made up");
+        }
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    pool_free(pool);
+    printf("parallel compile differential: %d programs, %d mismatches\n", programs, mismatches);
+    return mismatches;
+}
+
+void bench_parallel() {
+    char* src = bench_random_program(99, 1000, 200000, true);
+    size_t len = strlen(src);
+    uint32_t cpus = pool_cpu_count();
+    printf("parallel compile: %.1f MB script, %u cpus\n", len / 1e6, cpus);
+    printf("%12s %14s %14s\n", "threads", "MB/s", "speedup");
+    double serial = 0;
+    // 1, 2, 4, ... and then every cpu
+    for (uint32_t threads = 1;; threads = threads * 2 < cpus ? threads * 2 : cpus) {
+        ThreadPool* pool = pool_create(threads);
+        double best = 1e30;
+        for (int r = 0; r < 3; r++) {
+            Arena* arena = arena_create();
+            double start = bench_now();
+            InstructionArr* instructions = gen_code_parallel(src, arena, pool);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+            free_instructions(instructions);
+            arena_free(arena);
+        }
+        pool_free(pool);
+        if (threads == 1) serial = best;
+        printf("%12u %14.1f %13.2fx\n", threads, len / 1e6 / best, serial / best);
+        if (threads == cpus) break;
+    }
+    free(src);
+}
+
+// `chains` groups of four names, every statement assigns one name of a random group from the others in it, so the
+// groups never depend on each other. every print_every-th statement prints a name of its group
+char* bench_chain_program(uint32_t seed, uint32_t chains, uint32_t statements, uint32_t print_every) {
+    size_t cap = (size_t)(chains * 4 + statements) * 4096;
+    char* src = malloc(cap);
+    char expr[4096];
+    char prefix[16];
+    size_t len = 0;
+    for (uint32_t c = 0; c < chains; c++) {
+        bench_name(prefix, c);
+        for (int j = 0; j < 4; j++) {
+            len += snprintf(src + len, cap - len, "%s%c = %u;", prefix, 'a' + j, bench_rand(&seed) % 50);
+        }
+    }
+    for (uint32_t i = 0; i < statements; i++) {
+        bench_name(prefix, bench_rand(&seed) % chains);
+        size_t expr_len = 0;
+        bench_random_expr(expr, sizeof(expr), &expr_len, &seed, 4, 4);
+        len += snprintf(src + len, cap - len, "%s%c = (", prefix, 'a' + bench_rand(&seed) % 4);
+        // the expression's names are va to vd, moved into the group
+        for (size_t e = 0; e < expr_len; e++) {
+            if (expr[e] == 'v') {
+                len += snprintf(src + len, cap - len, "%s", prefix);
+            } else {
+                src[len++] = expr[e];
+            }
+        }
+        len += snprintf(src + len, cap - len, ") * 1;");
+        if (print_every && i % print_every == 0) {
+            len += snprintf(src + len, cap - len, "print(%sa);", prefix);
+        }
+    }
+    src[len] = '\0';
+    return src;
+}
+
+// stdout going to a temporary file until bench_capture_end
+typedef struct BenchCapture {
+    int fd;
+    int saved;
+} BenchCapture;
+
+BenchCapture bench_capture_begin() {
+    char path[] = "/tmp/expr_asm_bench_XXXXXX";
+    BenchCapture capture = { mkstemp(path), -1 };
+    unlink(path);
+    fflush(stdout);
+    capture.saved = dup(STDOUT_FILENO);
+    dup2(capture.fd, STDOUT_FILENO);
+    return capture;
+}
+
+// what was written since bench_capture_begin, '\0'-terminated, and its size if size isn't NULL
+char* bench_capture_end(BenchCapture capture, size_t* size) {
+    output_flush();
+    fflush(stdout);
+    dup2(capture.saved, STDOUT_FILENO);
+    close(capture.saved);
+    off_t end = lseek(capture.fd, 0, SEEK_END);
+    char* out = malloc((size_t)end + 1);
+    pread(capture.fd, out, (size_t)end, 0);
+    out[end] = '\0';
+    close(capture.fd);
+    if (size) *size = (size_t)end;
+    return out;
+}
+
+// runs the program with stdout going to a temporary file, and returns what it printed
+char* bench_captured_run(InstructionArr* instructions, DagProgram* dag, ThreadPool* pool, InstrVM** vm) {
+    BenchCapture capture = bench_capture_begin();
+    *vm = vm_create(instructions);
+    if (dag) {
+        dag_execute(dag, *vm, pool);
+    } else {
+        vm_execute(*vm, instructions);
+    }
+    return bench_capture_end(capture, NULL);
+}
+
+// differential check of dependency graph execution against vm_execute: same variables and the same output in the
+// same order, with the slots as compiled and after allocate_slots has made them reused
+int check_dag() {
+    const int programs = 40;
+    int mismatches = 0;
+    uint64_t blocks = 0, critical = 0, total = 0;
+    ThreadPool* pool = pool_create(4);
+    for (int p = 0; p < programs; p++) {
+        // one chain through the whole program, or many independent ones with prints between them
+        char* src = p % 2 ? bench_random_program((uint32_t)p * 389u + 5, 8, 200 + p * 20, true)
+                          : bench_chain_program((uint32_t)p * 389u + 5, 1 + p * 3, 200 + p * 40, p % 4 ? 0 : 25);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        if (p % 4 >= 2) allocate_slots(instructions);
+        DagProgram* dag = dag_prepare(instructions);
+        blocks += dag->block_count;
+        critical += dag->critical_path;
+        total += (uint64_t)instructions->size;
+
+        InstrVM* expected;
+        InstrVM* got;
+        char* expected_out = bench_captured_run(instructions, NULL, NULL, &expected);
+        char* got_out = bench_captured_run(instructions, dag, pool, &got);
+        bool same = strcmp(expected_out, got_out) == 0;
+        for (uint32_t s = 0; same && s < expected->symbol_count && s < got->symbol_count; s++) {
+            int e = expected->symbol_slots[s], g = got->symbol_slots[s];
+            same = (e < 0) == (g < 0) && (e < 0 || bench_same_double(expected->vars[e], got->vars[g]));
+        }
+        if (!same && mismatches++ < 5) {
+            printf("dag mismatch in program %d\n", p);
+        }
+        free(expected_out);
+        free(got_out);
+        vm_free(expected);
+        vm_free(got);
+        dag_program_free(dag);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    pool_free(pool);
+    printf("dag differential: %d programs, %d mismatches, %llu blocks, critical path %.1f%% of the instructions\n",
+           programs, mismatches, (unsigned long long)blocks, total ? critical * 100.0 / total : 0);
+    return mismatches;
+}
+
+// where running the dependency graph on the pool starts to beat the serial vm, against what the cost model says
+void bench_dag() {
+    ThreadPool* pool = pool_global();
+    printf("dag execution: %u threads, best of 5\n", pool->thread_count);
+    printf("%12s %10s %10s %14s %14s %10s %8s\n", "stmts/chains", "blocks", "critical", "serial us", "dag us",
+           "speedup", "model");
+    for (uint32_t statements = 100; statements <= 100000; statements *= 10) {
+        for (uint32_t chains = 1; chains <= 64; chains *= 64) {
+            char* src = bench_chain_program(statements + chains, chains, statements, 0);
+            Arena* arena = arena_create();
+            InstructionArr* instructions = gen_code(src, arena);
+            DagProgram* dag = dag_prepare(instructions);
+            InstrVM* vm = vm_create(instructions);
+            double serial = 1e30, parallel = 1e30;
+            for (int r = 0; r < 5; r++) {
+                double start = bench_now();
+                vm_execute(vm, instructions);
+                double elapsed = bench_now() - start;
+                if (elapsed < serial) serial = elapsed;
+                start = bench_now();
+                dag_execute(dag, vm, pool);
+                elapsed = bench_now() - start;
+                if (elapsed < parallel) parallel = elapsed;
+            }
+            char label[32];
+            snprintf(label, sizeof(label), "%u/%u", statements, chains);
+            printf("%12s %10u %9.1f%% %14.1f %14.1f %9.2fx %8s\n", label, dag->block_count,
+                   dag->critical_path * 100.0 / (instructions->size ? instructions->size : 1), serial * 1e6,
+                   parallel * 1e6, serial / parallel, dag_worth_it(dag, pool->thread_count) ? "dag" : "serial");
+            vm_free(vm);
+            dag_program_free(dag);
+            free_instructions(instructions);
+            arena_free(arena);
+            free(src);
+        }
+    }
+}
+
+// phase suite: every workload is timed through each phase of the pipeline separately.
+// lex only runs the lexer, parse includes the lexing it pulls, gen_code is the whole compilation.
+
+typedef struct SuiteWorkload {
+    const char* name;
+    char* src;
+} SuiteWorkload;
+
+char* suite_buffer(size_t cap) {
+    char* src = malloc(cap);
+    src[0] = '\0';
+    return src;
+}
+
+// (((...(a + 1) * 2 ...) nested `depth` deep, `statements` times
+char* suite_deep(uint32_t statements, uint32_t depth) {
+    size_t cap = (size_t)statements * (depth * 8 + 32);
+    char* src = suite_buffer(cap);
+    size_t len = snprintf(src, cap, "a = 1;");
+    for (uint32_t i = 0; i < statements; i++) {
+        len += snprintf(src + len, cap - len, "b = ");
+        for (uint32_t d = 0; d < depth; d++) src[len++] = '(';
+        len += snprintf(src + len, cap - len, "a");
+        for (uint32_t d = 0; d < depth; d++) {
+            len += snprintf(src + len, cap - len, " %c %u)", "+*-/"[d % 4], d % 7 + 1);
+        }
+        src[len++] = ';';
+    }
+    src[len] = '\0';
+    return src;
+}
+
+// a + b + c + ... with `width` terms
+char* suite_wide(uint32_t statements, uint32_t width) {
+    size_t cap = (size_t)statements * width * 8 + 1024;
+    char* src = suite_buffer(cap);
+    size_t len = 0;
+    char name[16];
+    for (uint32_t n = 0; n < 26; n++) {
+        bench_name(name, n);
+        len += snprintf(src + len, cap - len, "%s = %u;", name, n);
+    }
+    for (uint32_t i = 0; i < statements; i++) {
+        len += snprintf(src + len, cap - len, "s = a");
+        for (uint32_t w = 1; w < width; w++) {
+            bench_name(name, w % 26);
+            len += snprintf(src + len, cap - len, " + %s", name);
+        }
+        src[len++] = ';';
+    }
+    src[len] = '\0';
+    return src;
+}
+
+// `names` distinct identifiers, each assigned and then read
+char* suite_identifiers(uint32_t names) {
+    size_t cap = (size_t)names * 48;
+    char* src = suite_buffer(cap);
+    size_t len = 0;
+    char a[16], b[16];
+    for (uint32_t i = 0; i < names; i++) {
+        bench_name(a, i);
+        bench_name(b, i / 2);
+        len += snprintf(src + len, cap - len, "%s = %s * 2 + %u;", a, i ? b : "1", i);
+    }
+    return src;
+}
+
+// `calls` print calls with four arguments each
+char* suite_prints(uint32_t calls) {
+    size_t cap = (size_t)calls * 48 + 64;
+    char* src = suite_buffer(cap);
+    size_t len = snprintf(src, cap, "x = 1.5; y = 2;");
+    for (uint32_t i = 0; i < calls; i++) {
+        len += snprintf(src + len, cap - len, "print(x, y * %u, x - y, %u.25);", i % 100, i % 10);
+    }
+    return src;
+}
+
+// counts what the arena asks for, so the peak memory of a compilation is known
+typedef struct SuiteCounter {
+    size_t live;
+    size_t peak;
+} SuiteCounter;
+
+void* suite_counting_alloc(size_t size, void* user) {
+    SuiteCounter* counter = user;
+    size_t* block = malloc(size + sizeof(size_t) * 2);
+    block[0] = size;
+    counter->live += size;
+    if (counter->live > counter->peak) counter->peak = counter->live;
+    return block + 2;
+}
+
+void suite_counting_free(void* ptr, void* user) {
+    SuiteCounter* counter = user;
+    size_t* block = (size_t*)ptr - 2;
+    counter->live -= block[0];
+    free(block);
+}
+
+Arena* suite_arena(SuiteCounter* counter) {
+    const ArenaAllocator allocator = {
+            .alloc = suite_counting_alloc,
+            .free = suite_counting_free,
+            .user = counter
+    };
+    return arena_create_with(allocator, ARENA_DEFAULT_BLOCK_SIZE);
+}
+
+void suite_report(bool csv, const char* workload, const char* phase, size_t bytes, int instructions, double best,
+                  size_t peak) {
+    double mb_per_s = bytes / 1e6 / best;
+    double ns_per_instr = instructions ? best * 1e9 / instructions : 0;
+    if (csv) {
+        printf("%s,%s,%zu,%d,%.9f,%.3f,%.3f,%zu\n", workload, phase, bytes, instructions, best, mb_per_s,
+               ns_per_instr, peak);
+    } else {
+        printf("%12s %10s %12.1f %12.2f %14zu\n", workload, phase, mb_per_s, ns_per_instr, peak);
+    }
+}
+
+void bench_suite(bool csv) {
+    const int reps = 5;
+    SuiteWorkload workloads[] = {
+            {"deep", suite_deep(2000, 200)},
+            {"wide", suite_wide(500, 1000)},
+            {"statements", bench_symbol_script(100, 200000)},
+            {"identifiers", suite_identifiers(50000)},
+            {"prints", suite_prints(50000)},
+    };
+    if (csv) {
+        printf("workload,phase,bytes,instructions,best_s,mb_per_s,ns_per_instr,peak_bytes\n");
+    } else {
+        printf("suite: best of %d, MB/s of source, peak is the compilation arena or the vm frame\n", reps);
+        printf("%12s %10s %12s %12s %14s\n", "workload", "phase", "MB/s", "ns/instr", "peak bytes");
+    }
+    for (int w = 0; w < (int)(sizeof(workloads) / sizeof(workloads[0])); w++) {
+        const char* name = workloads[w].name;
+        size_t bytes = strlen(workloads[w].src);
+        // statements split the way gen_code splits them
+        char* statements = malloc(bytes + 1);
+        memcpy(statements, workloads[w].src, bytes + 1);
+        int statement_count = 0;
+        for (char* p = statements; *p; p++) {
+            if (*p == ';') {
+                *p = '\0';
+                statement_count++;
+            }
+        }
+        // the scripts end with a ';', there's nothing after it to parse
+        if (workloads[w].src[bytes - 1] != ';') statement_count++;
+
+        double best = 1e30;
+        SuiteCounter counter = {0, 0};
+        for (int r = 0; r < reps; r++) {
+            Arena* arena = suite_arena(&counter);
+            double start = bench_now();
+            const char* p = statements;
+            uint64_t tokens = 0;
+            for (int i = 0; i < statement_count; i++) {
+                Lexer* lexer = lexer_create(p, arena);
+                while (lexer_next_token(lexer).type != TT_EOF) tokens++;
+                p += strlen(p) + 1;
+            }
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+            arena_free(arena);
+            if (tokens == 0) printf("no tokens\n");
+        }
+        suite_report(csv, name, "lex", bytes, 0, best, counter.peak);
+
+        best = 1e30;
+        counter.peak = 0;
+        for (int r = 0; r < reps; r++) {
+            Arena* arena = suite_arena(&counter);
+            double start = bench_now();
+            const char* p = statements;
+            for (int i = 0; i < statement_count; i++) {
+                Parser* parser = parser_create(p, arena);
+                parser_parse_expr(parser, PREC_MIN);
+                p += strlen(p) + 1;
+            }
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+            arena_free(arena);
+        }
+        suite_report(csv, name, "parse", bytes, 0, best, counter.peak);
+
+        best = 1e30;
+        counter.peak = 0;
+        int instruction_count = 0;
+        size_t instruction_bytes = 0;
+        for (int r = 0; r < reps; r++) {
+            Arena* arena = suite_arena(&counter);
+            double start = bench_now();
+            InstructionArr* instructions = gen_code(workloads[w].src, arena);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+            instruction_count = instructions->size;
+            instruction_bytes = instructions->capacity * sizeof(Instruction);
+            free_instructions(instructions);
+            arena_free(arena);
+        }
+        suite_report(csv, name, "gen_code", bytes, instruction_count, best, counter.peak + instruction_bytes);
+
+        best = 1e30;
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(workloads[w].src, arena);
+        InstrVM* vm = NULL;
+        for (int r = 0; r < reps; r++) {
+            int saved = suite_mute();
+            double start = bench_now();
+            run_instructions(instructions);
+            double elapsed = bench_now() - start;
+            suite_unmute(saved);
+            if (elapsed < best) best = elapsed;
+        }
+        vm = vm_create(instructions);
+        size_t frame_bytes = (size_t)vm->frame_size * sizeof(double) + vm->symbol_count * sizeof(int);
+        vm_free(vm);
+        suite_report(csv, name, "run", bytes, instructions->size, best, frame_bytes);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(statements);
+        free(workloads[w].src);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    if (csv) {
+        printf("process,max_rss,0,0,0,0,0,%ld\n", usage.ru_maxrss * 1024L);
+    } else {
+        printf("process max rss: %ld KB\n", usage.ru_maxrss);
+    }
+}
+
+// differential check of eliminate_dead_code: keeping names, every named variable has to end up the same,
+// and keeping only what's printed, the output has to be the same
+int check_dce() {
+    const int programs = 100;
+    int mismatches = 0, removed_names = 0, removed_prints = 0, total = 0;
+    for (int p = 0; p < programs; p++) {
+        char* plain = bench_random_program((uint32_t)p * 6007u + 17, 8, 60, true);
+        // prints of va every 7th statement, with names prefixed by v they're the same names
+        char* src = bench_prefix_names(plain, "v");
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        total += instructions->size;
+        InstrVM* expected;
+        char* expected_out = bench_captured_run(instructions, NULL, NULL, &expected);
+
+        InstructionArr* named = newInstructionArr();
+        appendInstructionArr(named, instructions->data, instructions->size);
+        removed_names += eliminate_dead_code(named, true);
+        InstrVM* got;
+        char* got_out = bench_captured_run(named, NULL, NULL, &got);
+        bool same = strcmp(expected_out, got_out) == 0;
+        for (uint32_t s = 0; same && s < expected->symbol_count && s < got->symbol_count; s++) {
+            int e = expected->symbol_slots[s], g = got->symbol_slots[s];
+            same = (e < 0) == (g < 0) && (e < 0 || bench_same_double(expected->vars[e], got->vars[g]));
+        }
+        free(got_out);
+        vm_free(got);
+        delInstructionArr(named);
+
+        removed_prints += eliminate_dead_code(instructions, false);
+        got_out = bench_captured_run(instructions, NULL, NULL, &got);
+        same = same && strcmp(expected_out, got_out) == 0;
+        if (!same && mismatches++ < 5) {
+            printf("dead code mismatch in program %d\n", p);
+        }
+        free(got_out);
+        vm_free(got);
+        free(expected_out);
+        vm_free(expected);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+        free(plain);
+    }
+    printf("dead code differential: %d programs, %d mismatches, removed %.1f%% keeping names, %.1f%% keeping prints\n",
+           programs, mismatches, removed_names * 100.0 / total, removed_prints * 100.0 / total);
+    return mismatches;
+}
+
+// generated scripts where only some of the statements feed a print, run with and without the dead code
+void bench_dce() {
+    printf("dead code elimination: vm time, best of 5, prints muted\n");
+    printf("%12s %14s %14s %14s %14s %10s\n", "names", "instructions", "after", "before us", "after us", "speedup");
+    // a print every 7th statement of va, which only some statements end up feeding
+    for (uint32_t names = 4; names <= 256; names *= 4) {
+        char* plain = bench_random_program(names, names, 20000, true);
+        char* src = bench_prefix_names(plain, "v");
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstructionArr* pruned = newInstructionArr();
+        appendInstructionArr(pruned, instructions->data, instructions->size);
+        eliminate_dead_code(pruned, false);
+        double before = 1e30, after = 1e30;
+        int saved = suite_mute();
+        for (int r = 0; r < 5; r++) {
+            double start = bench_now();
+            run_instructions(instructions);
+            double elapsed = bench_now() - start;
+            if (elapsed < before) before = elapsed;
+            start = bench_now();
+            run_instructions(pruned);
+            elapsed = bench_now() - start;
+            if (elapsed < after) after = elapsed;
+        }
+        suite_unmute(saved);
+        char label[32];
+        snprintf(label, sizeof(label), "%u names", names);
+        printf("%12s %14d %14d %14.1f %14.1f %9.2fx\n", label, instructions->size, pruned->size, before * 1e6,
+               after * 1e6, before / after);
+        delInstructionArr(pruned);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+        free(plain);
+    }
+}
+
+// differential check of program images: a program saved and mapped back has to leave every named variable like
+// vm_execute does, and a damaged image has to be refused
+int check_image() {
+    const int programs = 100;
+    int mismatches = 0, accepted_damaged = 0;
+    char path[] = "/tmp/expr_asm_image_XXXXXX";
+    close(mkstemp(path));
+    for (int p = 0; p < programs; p++) {
+        char* src = bench_random_program((uint32_t)p * 7717u + 3, 8, 40, true);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstrVM* expected = vm_create(instructions);
+        vm_execute(expected, instructions);
+        if (!image_compile(src, path, p % 2 == 1)) {
+            mismatches++;
+        } else {
+            ProgramImage* image = image_load(path);
+            double* regs = calloc(bc_register_count(&image->program) + 1, sizeof(double));
+            bc_run_frame(&image->program, regs);
+            for (uint32_t s = 0; s < image_symbol_count(image); s++) {
+                int e = symbol_find(image_symbol_name(image, s));
+                int got = image->program.symbol_regs[s];
+                int want = e >= 0 && (uint32_t)e < expected->symbol_count ? expected->symbol_slots[e] : -1;
+                if ((want < 0) != (got < 0) || (want >= 0 && !bench_same_double(expected->vars[want], regs[got]))) {
+                    if (mismatches++ < 5) {
+                        printf("image mismatch in program %d, '%s'\n", p, image_symbol_name(image, s));
+                    }
+                }
+            }
+            free(regs);
+            image_free(image);
+
+            // cut short, and with a register out of range
+            FILE* f = fopen(path, "r+b");
+            fseek(f, 0, SEEK_END);
+            long size = ftell(f);
+            int fd = fileno(f);
+            if (p % 2 == 0) {
+                ftruncate(fd, size - 3);
+            } else {
+                uint32_t bad = 0x7fffffffu;
+                pwrite(fd, &bad, sizeof(bad), (off_t)(image_align(sizeof(ImageHeader)) + offsetof(BcInstr, a)));
+            }
+            fclose(f);
+            int saved = suite_mute();
+            image = image_load(path);
+            suite_unmute(saved);
+            if (image) {
+                accepted_damaged++;
+                image_free(image);
+            }
+        }
+        vm_free(expected);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    // a newline after the last ';' compiles, a syntax error anywhere leaves no image behind
+    unlink(path);
+    if (!image_compile("a = 2; print(a * 3);\n", path, false)) mismatches++;
+    unlink(path);
+    const char* broken[] = {"a = 2; b = (a + ; print(b);", "a = 2; print(a,,a);\n", "a = 1 +"};
+    int saved = suite_mute();
+    for (int i = 0; i < 3; i++) {
+        if (image_compile(broken[i], path, i == 1) || access(path, F_OK) == 0) accepted_damaged++;
+    }
+    suite_unmute(saved);
+    unlink(path);
+    printf("image differential: %d programs, %d mismatches, %d damaged images accepted\n", programs, mismatches,
+           accepted_damaged);
+    return mismatches + accepted_damaged;
+}
+
+// what a short-lived process pays before it can run a script: compiling it from source vs mapping its image
+void bench_image() {
+    char path[] = "/tmp/expr_asm_image_XXXXXX";
+    close(mkstemp(path));
+    printf("program images: startup to a runnable program, best of 5\n");
+    printf("%12s %12s %14s %14s %10s\n", "statements", "image KB", "compile us", "load us", "speedup");
+    for (uint32_t statements = 10; statements <= 100000; statements *= 10) {
+        char* src = bench_random_program(statements, 64, statements, true);
+        image_compile(src, path, false);
+        double compile = 1e30, load = 1e30;
+        size_t bytes = 0;
+        for (int r = 0; r < 5; r++) {
+            double start = bench_now();
+            Arena* arena = arena_create();
+            InstructionArr* instructions = gen_code(src, arena);
+            allocate_slots(instructions);
+            BcProgram* program = bc_compile(instructions);
+            double elapsed = bench_now() - start;
+            if (elapsed < compile) compile = elapsed;
+            bc_program_free(program);
+            free_instructions(instructions);
+            arena_free(arena);
+
+            start = bench_now();
+            ProgramImage* image = image_load(path);
+            elapsed = bench_now() - start;
+            if (elapsed < load) load = elapsed;
+            bytes = image->size;
+            image_free(image);
+        }
+        printf("%12u %12.1f %14.1f %14.1f %9.1fx\n", statements, bytes / 1024.0, compile * 1e6, load * 1e6,
+               compile / load);
+        free(src);
+    }
+    unlink(path);
+}
+
+// bench_random_expr with calls of the math builtins mixed in
+void bench_math_expr(char* out, size_t cap, size_t* len, uint32_t* seed, uint32_t names, int depth) {
+    static const char* unary[] = {"sqrt", "exp", "log", "abs", "sin", "cos"};
+    static const char* binary[] = {"pow", "min", "max"};
+    uint32_t pick = bench_rand(seed) % 10;
+    if (depth == 0 || pick < 2) {
+        bench_random_expr(out, cap, len, seed, names, 0);
+    } else if (pick < 5) {
+        *len += snprintf(out + *len, cap - *len, "%s(", unary[bench_rand(seed) % 6]);
+        bench_math_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, ")");
+    } else if (pick < 7) {
+        *len += snprintf(out + *len, cap - *len, "%s(", binary[bench_rand(seed) % 3]);
+        bench_math_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, ", ");
+        bench_math_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, ")");
+    } else {
+        *len += snprintf(out + *len, cap - *len, "(");
+        bench_math_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, " %c ", "+-*/"[bench_rand(seed) % 4]);
+        bench_math_expr(out, cap, len, seed, names, depth - 1);
+        *len += snprintf(out + *len, cap - *len, ")");
+    }
+}
+
+// bench_random_program over bench_math_expr
+char* bench_math_program(uint32_t seed, uint32_t names, uint32_t statements, bool constants) {
+    size_t cap = (size_t)(names + statements) * 4096;
+    char* src = malloc(cap);
+    size_t len = 0;
+    char name[16];
+    for (uint32_t i = 0; i < names && constants; i++) {
+        bench_name(name, i);
+        len += snprintf(src + len, cap - len, "%s = %u;", name, bench_rand(&seed) % 50);
+    }
+    for (uint32_t i = 0; i < statements; i++) {
+        bench_name(name, bench_rand(&seed) % names);
+        len += snprintf(src + len, cap - len, "%s = ", name);
+        bench_math_expr(src, cap, &len, &seed, names, 4);
+        len += snprintf(src + len, cap - len, ";");
+    }
+    return src;
+}
+
+// names whose register in a bytecode frame doesn't hold what the vm left in them
+int bench_frame_mismatches(InstrVM* vm, BcProgram* bytecode, double* regs) {
+    int mismatches = 0;
+    for (uint32_t s = 0; s < bytecode->symbol_count && s < vm->symbol_count; s++) {
+        int expected = vm->symbol_slots[s], got = bytecode->symbol_regs[s];
+        if ((expected < 0) != (got < 0) || (expected >= 0 && !bench_same_double(vm->vars[expected], regs[got]))) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// differential check of the math builtins: bytecode, threaded code, the jit and the optimizer against the vm,
+// then open programs through every batch isa against the scalar kernels
+int check_builtins() {
+    const int programs = 200;
+    int mismatches = 0, folded = 0;
+    for (int p = 0; p < programs; p++) {
+        char* src = bench_math_program((uint32_t)p * 7717u + 11, 8, 30, true);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstrVM* vm = vm_create(instructions);
+        vm_execute(vm, instructions);
+
+        BcProgram* bytecode = bc_compile(instructions);
+        double* regs = calloc(bc_register_count(bytecode) + 1, sizeof(double));
+        bc_run_frame(bytecode, regs);
+        int bad = bench_frame_mismatches(vm, bytecode, regs);
+        free(regs);
+        bc_program_free(bytecode);
+
+        ThreadedProgram* threaded = threaded_compile(bc_compile(instructions));
+        regs = calloc(bc_register_count(threaded->bytecode) + 1, sizeof(double));
+        if (threaded->bytecode->constants->size > 0) {
+            memcpy(regs + threaded->bytecode->frame_size, threaded->bytecode->constants->data,
+                   threaded->bytecode->constants->size * sizeof(double));
+        }
+        threaded_exec(threaded->code, regs, threaded->bytecode->args->data, NULL);
+        bad += bench_frame_mismatches(vm, threaded->bytecode, regs);
+        free(regs);
+        threaded_program_free(threaded);
+
+        bytecode = bc_compile(instructions);
+        JitProgram* jit = jit_compile(bytecode);
+        if (jit == NULL) {
+            bc_program_free(bytecode);
+        } else {
+            regs = calloc(bc_register_count(bytecode) + 1, sizeof(double));
+            jit_run_frame(jit, regs);
+            bad += bench_frame_mismatches(vm, bytecode, regs);
+            free(regs);
+            jit_program_free(jit);
+        }
+
+        OptStats stats;
+        optimize_instructions(instructions, &stats);
+        folded += stats.before - stats.after;
+        InstrVM* optimized = vm_create(instructions);
+        vm_execute(optimized, instructions);
+        for (uint32_t s = 0; s < vm->symbol_count && s < optimized->symbol_count; s++) {
+            int e = vm->symbol_slots[s], g = optimized->symbol_slots[s];
+            if ((e < 0) != (g < 0) || (e >= 0 && !bench_same_double(vm->vars[e], optimized->vars[g]))) bad++;
+        }
+        if (bad > 0 && mismatches++ < 5) {
+            printf("builtin mismatch in program %d\n", p);
+        }
+        vm_free(optimized);
+        vm_free(vm);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    printf("builtin differential: %d programs, %d mismatches, %d instructions optimized away\n", programs,
+           mismatches, folded);
+
+    const size_t rows = 67;
+    int isa_mismatches = 0;
+    double* columns[16];
+    BatchColumn inputs[8];
+    char names[8][16];
+    for (int c = 0; c < 16; c++) {
+        columns[c] = malloc(rows * sizeof(double));
+    }
+    for (int n = 0; n < 8; n++) {
+        bench_name(names[n], n);
+        for (size_t row = 0; row < rows; row++) {
+            // signed zeros and NaNs too, where min, max and abs have to agree with the scalar code
+            columns[n][row] = row % 11 == 0 ? (row % 2 ? -0.0 : NAN) : (double)row * 0.75 - (double)n * 3;
+        }
+        inputs[n] = (BatchColumn){names[n], columns[n]};
+    }
+    for (int p = 0; p < programs; p++) {
+        char* src = bench_math_program((uint32_t)p * 2654435761u + 3, 8, 20, false);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        BatchProgram* program = batch_compile(instructions);
+        BatchColumn expected[8], got[8];
+        int outputs = 0;
+        for (int n = 0; n < 8; n++) {
+            int symbol = symbol_find(names[n]);
+            if (symbol < 0 || program->bytecode->symbol_regs[symbol] < 0) continue;
+            expected[outputs] = (BatchColumn){names[n], columns[8 + outputs]};
+            got[outputs] = (BatchColumn){names[n], malloc(rows * sizeof(double))};
+            outputs++;
+        }
+        batch_program_set_isa(program, BATCH_SCALAR);
+        batch_run(program, rows, inputs, 8, expected, outputs);
+        for (int isa = BATCH_SSE2; isa <= BATCH_AVX2; isa++) {
+            if (!batch_program_set_isa(program, (BatchIsa)isa)) continue;
+            batch_run(program, rows, inputs, 8, got, outputs);
+            for (int o = 0; o < outputs; o++) {
+                for (size_t row = 0; row < rows; row++) {
+                    if (!bench_same_double(expected[o].data[row], got[o].data[row]) && isa_mismatches++ < 5) {
+                        printf("builtin mismatch in %s kernels, program %d, '%s'\n", program->kernels->name, p,
+                               got[o].name);
+                    }
+                }
+            }
+        }
+        for (int o = 0; o < outputs; o++) {
+            free(got[o].data);
+        }
+        batch_program_free(program);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    for (int c = 0; c < 16; c++) {
+        free(columns[c]);
+    }
+    printf("builtin differential (batch): %d programs, %d mismatches\n", programs, isa_mismatches);
+    return mismatches + isa_mismatches;
+}
+
+// a formula built from the math builtins, on every engine and through the batch kernels
+void bench_builtins() {
+    const int reps = 5;
+    const char* formula = "y = sqrt(a * a + b * b); z = max(min(a, b), abs(c)) - sqrt(abs(d)); "
+                          "w = pow(abs(a), 0.5) + exp(-abs(b)) * cos(c) + log(abs(d) + 1) * sin(a)";
+    size_t cap = 200000 * 16 + 4096;
+    char* src = malloc(cap);
+    size_t len = snprintf(src, cap, "a = 1.5; b = -2; c = 0.25; d = 7;");
+    for (int i = 0; i < 20000; i++) {
+        len += snprintf(src + len, cap - len, "%s; a = a + 0.001;", formula);
+    }
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code(src, arena);
+    printf("builtins: %d instructions, best of %d\n", instructions->size, reps);
+    printf("%12s %14s\n", "engine", "ns/instr");
+    for (int e = 0; e < (int)(sizeof(engine_names) / sizeof(engine_names[0])); e++) {
+        EngineProgram* program = engine_prepare(instructions, (VmEngine)e);
+        double best = 1e30;
+        for (int r = 0; r < reps; r++) {
+            double start = bench_now();
+            engine_run(program);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%12s %14.2f\n", engine_names[e], best * 1e9 / instructions->size);
+        engine_program_free(program);
+    }
+    free_instructions(instructions);
+    arena_free(arena);
+    free(src);
+
+    const size_t rows = 1000000;
+    arena = arena_create();
+    instructions = gen_code(formula, arena);
+    BatchProgram* program = batch_compile(instructions);
+    double* columns[7];
+    for (int c = 0; c < 7; c++) {
+        columns[c] = malloc(rows * sizeof(double));
+    }
+    for (size_t i = 0; i < rows; i++) {
+        columns[0][i] = (double)i * 0.5 + 1;
+        columns[1][i] = (double)(i % 7) - 3;
+        columns[2][i] = (double)(i % 1000) * 0.01;
+        columns[3][i] = (double)i * 0.25 - 7;
+    }
+    BatchColumn inputs[] = {{"a", columns[0]}, {"b", columns[1]}, {"c", columns[2]}, {"d", columns[3]}};
+    BatchColumn outputs[] = {{"y", columns[4]}, {"z", columns[5]}, {"w", columns[6]}};
+    printf("builtins batch: %zu rows, %d instructions, best of %d\n", rows, program->bytecode->code->size, reps);
+    printf("%12s %14s %14s\n", "kernels", "ns/row", "y, z ns/row");
+    // y and z only use the builtins with vector instructions, w goes through libm
+    InstructionArr* vector_only = gen_code("y = sqrt(a * a + b * b); z = max(min(a, b), abs(c)) - sqrt(abs(d))", arena);
+    BatchProgram* vector_program = batch_compile(vector_only);
+    for (int isa = BATCH_SCALAR; isa <= BATCH_AVX2; isa++) {
+        if (!batch_program_set_isa(program, (BatchIsa)isa)) continue;
+        batch_program_set_isa(vector_program, (BatchIsa)isa);
+        double best = 1e30, vector_best = 1e30;
+        for (int r = 0; r < reps; r++) {
+            double start = bench_now();
+            batch_run(program, rows, inputs, 4, outputs, 3);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+            start = bench_now();
+            batch_run(vector_program, rows, inputs, 4, outputs, 2);
+            elapsed = bench_now() - start;
+            if (elapsed < vector_best) vector_best = elapsed;
+        }
+        printf("%12s %14.3f %14.3f\n", program->kernels->name, best * 1e9 / rows, vector_best * 1e9 / rows);
+    }
+    for (int c = 0; c < 7; c++) {
+        free(columns[c]);
+    }
+    batch_program_free(vector_program);
+    batch_program_free(program);
+    free_instructions(vector_only);
+    free_instructions(instructions);
+    arena_free(arena);
+}
+
+// doubles of every kind print has to format: any bit pattern, exact binary fractions (which is where %f has ties),
+// and the sort of values scripts compute
+double bench_output_value(uint32_t* seed, int i) {
+    uint64_t bits = (uint64_t)bench_rand(seed) << 40 ^ (uint64_t)bench_rand(seed) << 20 ^ bench_rand(seed);
+    switch (i % 4) {
+        case 0: {
+            double v;
+            memcpy(&v, &bits, sizeof(v));
+            return v;
+        }
+        case 1: return (double)(int64_t)(bits % 2000001 - 1000000) / (double)(1u << (bits >> 40) % 31);
+        case 2: return (double)(bits % 100000) * 0.01 - 300;
+        default: return ((double)(bits % 1000000007) / 1000000007.0 - 0.5) * pow(10, (double)((int)(bits >> 50) % 40 - 20));
+    }
+}
+
+// significant digits of a number as text: everything but the sign, the point, the exponent and the zeros around
+int bench_significant_digits(const char* text) {
+    const char* first = NULL;
+    const char* last = NULL;
+    for (const char* p = text; *p && *p != 'e'; p++) {
+        if (*p >= '1' && *p <= '9') {
+            if (first == NULL) first = p;
+            last = p;
+        }
+    }
+    if (first == NULL) return 1;
+    int digits = 0;
+    for (const char* p = first; p <= last; p++) {
+        if (*p != '.') digits++;
+    }
+    return digits;
+}
+
+// the sign of a nan depends on the order an engine evaluated the operands in, so outputs are compared without it
+void bench_unsign_nans(char* text) {
+    char* out = text;
+    for (char* p = text; *p; p++) {
+        if (!(p[0] == '-' && strncmp(p + 1, "nan", 3) == 0)) *out++ = *p;
+    }
+    *out = '\0';
+}
+
+// differential check of the output formats: fixed against printf's %f, shortest against the fewest digits %.*e
+// needs to read back, and the same prints through every engine in every format
+int check_output() {
+    const int values = 400000;
+    int fixed_mismatches = 0, shortest_mismatches = 0;
+    uint32_t seed = 12345;
+    char expected[OUTPUT_MAX_VALUE], got[OUTPUT_MAX_VALUE];
+    const double edges[] = {0.0, -0.0, 0.0078125, -0.0078125, 2.5e-7, 5e-7, 0.0000005, 1e-300, 4.9e-324, 1e22, 1e23,
+                            9007199254740993.0, 18446744073709549568.0, 18446744073709551616.0, 1.7976931348623157e308,
+                            INFINITY, -INFINITY, NAN, -NAN, 0.1, 0.3, 2.0 / 3.0, 123456.0000005, 999999.9999995};
+    int edge_count = (int)(sizeof(edges) / sizeof(edges[0]));
+    for (int i = 0; i < values + edge_count; i++) {
+        double v = i < edge_count ? edges[i] : bench_output_value(&seed, i);
+        snprintf(expected, sizeof(expected), "%f", v);
+        got[output_format_fixed(got, v)] = '\0';
+        if (strcmp(expected, got) != 0 && fixed_mismatches++ < 5) {
+            printf("fixed output mismatch: %s instead of %s\n", got, expected);
+        }
+        got[output_format_shortest(got, v)] = '\0';
+        bool same;
+        if (v != v || isinf(v)) {
+            snprintf(expected, sizeof(expected), "%g", v);
+            same = strcmp(expected, got) == 0;
+        } else {
+            int precision = 1;
+            for (; precision < 17; precision++) {
+                snprintf(expected, sizeof(expected), "%.*e", precision - 1, v);
+                if (strtod(expected, NULL) == v) break;
+            }
+            double back = strtod(got, NULL);
+            same = memcmp(&back, &v, sizeof(v)) == 0 && bench_significant_digits(got) == precision;
+        }
+        if (!same && shortest_mismatches++ < 5) {
+            printf("shortest output mismatch: %s for %.17g\n", got, v);
+        }
+    }
+    printf("output differential: %d values, %d fixed mismatches, %d shortest mismatches\n", values + edge_count,
+           fixed_mismatches, shortest_mismatches);
+
+    // every engine prints the same values: its binary output, formatted here, is the vm's text in both formats
+    const int programs = 40;
+    int mismatches = 0;
+    for (int p = 0; p < programs; p++) {
+        char* plain = bench_random_program((uint32_t)p * 3001u + 9, 8, 100, true);
+        char* src = bench_prefix_names(plain, "v");
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        char* text[2];
+        for (int format = OUTPUT_FIXED; format <= OUTPUT_SHORTEST; format++) {
+            output_set_format((OutputFormat)format);
+            InstrVM* vm;
+            text[format] = bench_captured_run(instructions, NULL, NULL, &vm);
+            vm_free(vm);
+        }
+        output_set_format(OUTPUT_BINARY);
+        for (int e = 0; e < (int)(sizeof(engine_names) / sizeof(engine_names[0])); e++) {
+            EngineProgram* program = engine_prepare(instructions, (VmEngine)e);
+            BenchCapture capture = bench_capture_begin();
+            engine_run(program);
+            size_t size;
+            char* binary = bench_capture_end(capture, &size);
+            engine_program_free(program);
+            for (int format = OUTPUT_FIXED; format <= OUTPUT_SHORTEST; format++) {
+                size_t cap = size * 48 + 1, len = 0, at = 0;
+                char* decoded = malloc(cap);
+                while (at + sizeof(uint32_t) <= size) {
+                    uint32_t count;
+                    memcpy(&count, binary + at, sizeof(count));
+                    at += sizeof(count);
+                    for (uint32_t j = 0; j < count && at + sizeof(double) <= size; j++, at += sizeof(double)) {
+                        double v;
+                        memcpy(&v, binary + at, sizeof(v));
+                        len += format == OUTPUT_FIXED ? output_format_fixed(decoded + len, v)
+                                                      : output_format_shortest(decoded + len, v);
+                        decoded[len++] = ' ';
+                    }
+                    decoded[len++] = '\n';
+                }
+                decoded[len] = '\0';
+                bench_unsign_nans(decoded);
+                bench_unsign_nans(text[format]);
+                if ((at != size || strcmp(decoded, text[format]) != 0) && mismatches++ < 5) {
+                    printf("output mismatch in program %d, %s engine, %s format\n", p, engine_names[e],
+                           output_format_names[format]);
+                }
+                free(decoded);
+            }
+            free(binary);
+        }
+        output_set_format(OUTPUT_FIXED);
+        free(text[0]);
+        free(text[1]);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+        free(plain);
+    }
+    printf("output engine differential: %d programs, %d mismatches\n", programs, mismatches);
+    return fixed_mismatches + shortest_mismatches + mismatches;
+}
+
+// formatting alone, ns per value, and a print-heavy script on the bytecode engine in every format, output muted
+void bench_output() {
+    const int values = 1000000, reps = 5;
+    double* numbers = malloc(values * sizeof(double));
+    uint32_t seed = 777;
+    for (int i = 0; i < values; i++) {
+        // no arbitrary bit patterns, values a script prints
+        numbers[i] = bench_output_value(&seed, i % 3 + 1);
+    }
+    char text[OUTPUT_MAX_VALUE];
+    size_t sink = 0;
+    printf("output formatting: %d values, best of %d\n", values, reps);
+    printf("%12s %14s\n", "format", "ns/value");
+    const char* names[] = {"printf %f", "fixed", "printf %.17g", "shortest"};
+    for (int f = 0; f < 4; f++) {
+        double best = 1e30;
+        for (int r = 0; r < reps; r++) {
+            double start = bench_now();
+            for (int i = 0; i < values; i++) {
+                switch (f) {
+                    case 0: sink += (size_t)snprintf(text, sizeof(text), "%f", numbers[i]); break;
+                    case 1: sink += (size_t)output_format_fixed(text, numbers[i]); break;
+                    case 2: sink += (size_t)snprintf(text, sizeof(text), "%.17g", numbers[i]); break;
+                    default: sink += (size_t)output_format_shortest(text, numbers[i]); break;
+                }
+            }
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%12s %14.1f\n", names[f], best * 1e9 / values);
+    }
+    free(numbers);
+
+    char* src = suite_prints(100000);
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code(src, arena);
+    EngineProgram* program = engine_prepare(instructions, ENGINE_BYTECODE);
+    printf("print output: 100000 prints of 4 values on the bytecode engine, best of %d, muted\n", reps);
+    printf("%12s %14s\n", "format", "ns/value");
+    // the stdio loop print used to run, over the same values
+    double best = 1e30;
+    int saved = suite_mute();
+    for (int r = 0; r < reps; r++) {
+        double start = bench_now();
+        for (int i = 0; i < 100000; i++) {
+            printf("%f ", 1.5);
+            printf("%f ", 2.0 * (i % 100));
+            printf("%f ", -0.5);
+            printf("%f ", (i % 10) + 0.25);
+            printf("\n");
+        }
+        fflush(stdout);
+        double elapsed = bench_now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    suite_unmute(saved);
+    printf("%12s %14.1f\n", "printf", best * 1e9 / 400000);
+    for (int format = OUTPUT_FIXED; format <= OUTPUT_BINARY; format++) {
+        output_set_format((OutputFormat)format);
+        best = 1e30;
+        saved = suite_mute();
+        for (int r = 0; r < reps; r++) {
+            double start = bench_now();
+            engine_run(program);
+            double elapsed = bench_now() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        suite_unmute(saved);
+        printf("%12s %14.1f\n", output_format_names[format], best * 1e9 / 400000);
+    }
+    output_set_format(OUTPUT_FIXED);
+    if (sink == 0) printf("\n");
+    engine_program_free(program);
+    free_instructions(instructions);
+    arena_free(arena);
+    free(src);
+}
+
+// differential check of sessions: a program fed to session_eval a few statements at a time, or with its inputs
+// bound by session_set, leaves the same variables and prints the same as the whole program on one vm
+int check_session() {
+    const int programs = 100;
+    int mismatches = 0;
+    uint64_t evals = 0;
+    for (int p = 0; p < programs; p++) {
+        uint32_t seed = (uint32_t)p * 7919u + 21;
+        bool inputs = p % 2 == 1;
+        char* plain = bench_random_program(seed, 8, 60, !inputs);
+        char* body = bench_prefix_names(plain, "v");
+        // the inputs as assignments in front of the program, for the vm
+        size_t cap = strlen(body) + 256, len = 0;
+        char* src = malloc(cap);
+        char name[16];
+        for (uint32_t n = 0; n < 8 && inputs; n++) {
+            bench_name(name, n);
+            len += snprintf(src + len, cap - len, "%s = %u.5;", name, n * 3);
+        }
+        snprintf(src + len, cap - len, "%s", body);
+
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstrVM* expected;
+        char* expected_out = bench_captured_run(instructions, NULL, NULL, &expected);
+
+        Session* session = session_create();
+        BenchCapture capture = bench_capture_begin();
+        for (uint32_t n = 0; n < 8 && inputs; n++) {
+            bench_name(name, n);
+            session_set(session, name, n * 3 + 0.5);
+        }
+        // a few statements per call, the last one of a call sometimes without its ';'
+        for (const char* at = body; *at;) {
+            const char* end = at;
+            for (uint32_t statements = 1 + bench_rand(&seed) % 3; statements > 0 && *end; statements--) {
+                const char* semicolon = strchr(end, ';');
+                end = semicolon ? semicolon + 1 : end + strlen(end);
+            }
+            size_t piece = (size_t)(end - at);
+            if (bench_rand(&seed) % 2 && piece > 0 && at[piece - 1] == ';') piece--;
+            session_eval(session, at, piece);
+            at = end;
+        }
+        char* got_out = bench_capture_end(capture, NULL);
+        evals += session->evals;
+
+        bool same = strcmp(expected_out, got_out) == 0;
+        for (uint32_t s = 0; same && s < expected->symbol_count; s++) {
+            double got;
+            bool bound = session_get(session, symbol_name(s), &got);
+            int e = expected->symbol_slots[s];
+            same = (e >= 0) == bound && (!bound || bench_same_double(expected->vars[e], got));
+        }
+        if (!same && mismatches++ < 5) {
+            printf("session mismatch in program %d\n", p);
+        }
+        session_free(session);
+        free(expected_out);
+        free(got_out);
+        vm_free(expected);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+        free(body);
+        free(plain);
+    }
+    printf("session differential: %d programs, %d mismatches, %llu evals\n", programs, mismatches,
+           (unsigned long long)evals);
+    return mismatches;
+}
+
+// an embedding program adding a statement at a time: recompiling and rerunning everything so far every time,
+// which is all there was before sessions, against session_eval of the new statement
+void bench_session() {
+    printf("sessions: a statement at a time, total time\n");
+    printf("%12s %14s %14s %10s\n", "statements", "rerun ms", "session ms", "speedup");
+    for (uint32_t statements = 100; statements <= 10000; statements *= 10) {
+        char* src = bench_random_program(statements, 16, statements, true);
+        size_t len = strlen(src);
+        double rerun = 0;
+        // quadratic, so only the smaller sizes
+        if (statements <= 1000) {
+            double start = bench_now();
+            for (size_t at = 0; at < len; at++) {
+                if (src[at] != ';') continue;
+                Arena* arena = arena_create();
+                char* prefix = arena_strndup(arena, src, at + 1);
+                InstructionArr* instructions = gen_code(prefix, arena);
+                run_instructions(instructions);
+                free_instructions(instructions);
+                arena_free(arena);
+            }
+            rerun = bench_now() - start;
+        }
+        double start = bench_now();
+        Session* session = session_create();
+        for (const char* at = src; *at;) {
+            const char* semicolon = strchr(at, ';');
+            const char* end = semicolon ? semicolon + 1 : at + strlen(at);
+            session_eval(session, at, (size_t)(end - at));
+            at = end;
+        }
+        session_free(session);
+        double incremental = bench_now() - start;
+        if (rerun > 0) {
+            printf("%12u %14.2f %14.2f %9.1fx\n", statements, rerun * 1e3, incremental * 1e3, rerun / incremental);
+        } else {
+            printf("%12u %14s %14.2f %10s\n", statements, "-", incremental * 1e3, "-");
+        }
+        free(src);
+    }
+}
+
+// the program of check_reactive with its inputs assigned first, the odd ones through a negation
+char* bench_reactive_source(const char* body, const double* values, uint32_t count, bool negate) {
+    size_t cap = strlen(body) + count * 64 + 1;
+    char* src = malloc(cap);
+    size_t len = 0;
+    char name[16];
+    for (uint32_t n = 0; n < count; n++) {
+        bench_name(name, n);
+        if (negate && n % 2) {
+            len += snprintf(src + len, cap - len, "%s = -(%.17g);", name, -values[n]);
+        } else {
+            len += snprintf(src + len, cap - len, "%s = %.17g;", name, values[n]);
+        }
+    }
+    snprintf(src + len, cap - len, "%s", body);
+    return src;
+}
+
+// differential check of reactive programs: after every reactive_set_input, the names have the values a fresh run
+// of the script with that input edited gives
+int check_reactive() {
+    const int programs = 80;
+    const uint32_t names = 8;
+    int mismatches = 0;
+    uint64_t run = 0, full = 0;
+    for (int p = 0; p < programs; p++) {
+        uint32_t seed = (uint32_t)p * 104729u + 5;
+        char* plain = bench_random_program(seed, names, 80, false);
+        char* body = bench_prefix_names(plain, "v");
+        double values[8];
+        for (uint32_t n = 0; n < names; n++) {
+            values[n] = (double)(bench_rand(&seed) % 200) / 4 - 25;
+        }
+        char* src = bench_reactive_source(body, values, names, true);
+        BenchCapture capture = bench_capture_begin();
+        ReactiveProgram* program = reactive_create(src);
+        for (int round = 0; program && round < 6; round++) {
+            uint32_t n = bench_rand(&seed) % names;
+            // every third round sets the value it already has, which re-runs nothing after the input
+            if (round % 3 != 2) values[n] = (double)(bench_rand(&seed) % 200) / 4 - 25;
+            char name[16];
+            bench_name(name, n);
+            reactive_set_input(program, name, values[n]);
+            run += program->last_run;
+            full += program->instructions->size;
+
+            char* edited = bench_reactive_source(body, values, names, false);
+            Arena* arena = arena_create();
+            InstructionArr* instructions = gen_code(edited, arena);
+            InstrVM* expected = vm_create(instructions);
+            vm_execute(expected, instructions);
+            bool same = round % 3 != 2 || program->last_run == 1;
+            for (uint32_t s = 0; same && s < expected->symbol_count; s++) {
+                double got;
+                bool bound = reactive_get(program, symbol_name(s), &got);
+                int e = expected->symbol_slots[s];
+                same = (e >= 0) == bound && (!bound || bench_same_double(expected->vars[e], got));
+            }
+            if (!same) mismatches++;
+            vm_free(expected);
+            free_instructions(instructions);
+            arena_free(arena);
+            free(edited);
+        }
+        if (program == NULL) mismatches++;
+        else reactive_free(program);
+        free(bench_capture_end(capture, NULL));
+        free(src);
+        free(body);
+        free(plain);
+    }
+
+    // a script file as an editor saves it, with a newline after the last ';', prints no error for it
+    char path[] = "/tmp/expr_asm_reactive_XXXXXX";
+    int fd = mkstemp(path);
+    const char* script = "a = 1; x = a; y = x * 3; print(y);\n";
+    write(fd, script, strlen(script));
+    close(fd);
+    const char* input = "a";
+    double value = 4;
+    const char* expected = "3.000000 \n12.000000 \n";
+    BenchCapture capture = bench_capture_begin();
+    bool ok = reactive_run_file(path, &input, &value, 1);
+    char* out = bench_capture_end(capture, NULL);
+    if (!ok || strstr(out, "ERROR") || strncmp(out, expected, strlen(expected)) != 0) {
+        printf("reactive mismatch on a script ending in a newline: %s", out);
+        mismatches++;
+    }
+    free(out);
+    unlink(path);
+    printf("reactive differential: %d programs, %d mismatches, re-ran %llu of %llu instructions\n", programs,
+           mismatches, (unsigned long long)run, (unsigned long long)full);
+    return mismatches;
+}
+
+// a live model whose inputs each feed their own group of statements, and a random program where everything
+// feeds everything: one reactive_set_input against running the whole program again, compiled or not
+void bench_reactive() {
+    printf("reactive: one input changed\n");
+    printf("%-10s %12s %14s %14s %14s %12s\n", "program", "instructions", "compile+run us", "run us",
+           "set_input us", "re-ran");
+    for (int kind = 0; kind < 2; kind++) {
+        char* src = kind == 0 ? bench_chain_program(11, 64, 20000, 0) : bench_random_program(11, 16, 2000, true);
+        char input[16];
+        bench_name(input, 0);
+        if (kind == 0) strcat(input, "a");
+        int saved = suite_mute();
+        double start = bench_now();
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        run_instructions(instructions);
+        double compile_run = bench_now() - start;
+        start = bench_now();
+        run_instructions(instructions);
+        double full = bench_now() - start;
+        ReactiveProgram* program = reactive_create(src);
+        const int updates = 200;
+        uint64_t run = 0;
+        start = bench_now();
+        for (int u = 0; u < updates; u++) {
+            reactive_set_input(program, input, u % 7 + 1);
+            run += program->last_run;
+        }
+        double update = (bench_now() - start) / updates;
+        suite_unmute(saved);
+        printf("%-10s %12d %14.1f %14.1f %14.2f %11.2f%%\n", kind == 0 ? "chains" : "random", instructions->size,
+               compile_run * 1e6, full * 1e6, update * 1e6, 100.0 * run / updates / instructions->size);
+        reactive_free(program);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+}
+
+void* bench_server_main(void* arg) {
+    server_run(arg);
+    return NULL;
+}
+
+// a server on its own thread, at a socket path of its own
+Server* bench_server_start(pthread_t* thread, char* path, size_t cap, uint32_t workers) {
+    snprintf(path, cap, "/tmp/expr_asm_bench_%d.sock", (int)getpid());
+    Server* server = server_create(path, workers, false);
+    if (server) pthread_create(thread, NULL, bench_server_main, server);
+    return server;
+}
+
+void bench_server_finish(Server* server, pthread_t thread) {
+    server_stop(server);
+    pthread_join(thread, NULL);
+    server_free(server);
+}
+
+// differential check of the server: random programs with every name an input, evaluated over the socket, against
+// the same program after assignments of the inputs on the vm. then the requests it has to turn down
+int check_server() {
+    char path[64];
+    pthread_t thread;
+    Server* server = bench_server_start(&thread, path, sizeof(path), 2);
+    if (server == NULL) {
+        printf("server differential: no socket\n");
+        return 1;
+    }
+    int fd = server_connect(path);
+    const int programs = 60;
+    const uint32_t names = 8;
+    int mismatches = 0;
+    ServerReply reply = {0};
+    char name_text[8][16];
+    const char* name_list[8];
+    for (uint32_t n = 0; n < names; n++) {
+        bench_name(name_text[n], n);
+        name_list[n] = name_text[n];
+    }
+    for (int p = 0; p < programs; p++) {
+        uint32_t seed = (uint32_t)p * 6151u + 9;
+        char* body = bench_random_program(seed, names, 40, false);
+        // each program twice, the second time from the cache, with other inputs
+        for (int round = 0; round < 2; round++) {
+            double values[8];
+            for (uint32_t n = 0; n < names; n++) {
+                values[n] = (double)(bench_rand(&seed) % 400) / 8;
+            }
+            size_t size;
+            char* frame = server_encode(body, name_list, values, names, name_list, names, &size);
+            bool same = server_exchange(fd, frame, size, &reply) && reply.status == SERVER_OK &&
+                        reply.value_count == names;
+            free(frame);
+
+            char* src = bench_reactive_source(body, values, names, false);
+            Arena* arena = arena_create();
+            InstructionArr* instructions = gen_code(src, arena);
+            InstrVM* expected = vm_create(instructions);
+            vm_execute(expected, instructions);
+            for (uint32_t n = 0; same && n < names; n++) {
+                int slot = expected->symbol_slots[symbol_find(name_list[n])];
+                same = bench_same_double(expected->vars[slot], reply.values[n]);
+            }
+            if (!same && mismatches++ < 5) printf("server mismatch in program %d\n", p);
+            vm_free(expected);
+            free_instructions(instructions);
+            arena_free(arena);
+            free(src);
+        }
+        free(body);
+    }
+
+    // a print is turned down and the connection goes on, a frame that isn't one ends it
+    int refused = 0;
+    size_t size;
+    char* frame = server_encode("print(1)", NULL, NULL, 0, NULL, 0, &size);
+    if (server_exchange(fd, frame, size, &reply) && reply.status == SERVER_REJECTED) refused++;
+    free(frame);
+    frame = server_encode("x = 2", NULL, NULL, 0, name_list, 1, &size);
+    if (server_exchange(fd, frame, size, &reply) && reply.status == SERVER_OK && reply.values[0] != reply.values[0]) {
+        refused++;
+    }
+    free(frame);
+    ServerRequestHeader bad = { .magic = 0 };
+    if (server_exchange(fd, (const char*)&bad, sizeof(bad), &reply) && reply.status == SERVER_BAD_REQUEST &&
+        !server_read_all(fd, &bad, 1)) {
+        refused++;
+    }
+    close(fd);
+    // counts that add up past 32 bits are turned down, and the worker still answers the next client
+    ServerRequestHeader huge = { .magic = SERVER_MAGIC, .kind = SERVER_EVAL, .input_count = 1,
+                                 .output_count = 0xFFFFFFFFu, .names_size = 2, .source_size = 1 };
+    fd = server_connect(path);
+    if (server_exchange(fd, (const char*)&huge, sizeof(huge), &reply) && reply.status == SERVER_BAD_REQUEST &&
+        !server_read_all(fd, &huge, 1)) {
+        refused++;
+    }
+    close(fd);
+    fd = server_connect(path);
+    frame = server_encode("x = 2", NULL, NULL, 0, name_list, 0, &size);
+    if (!server_exchange(fd, frame, size, &reply) || reply.status != SERVER_OK) refused--;
+    free(frame);
+    close(fd);
+    server_reply_free(&reply);
+    // the workers can't all count into the stats
+    stats_enable(true);
+    char stats_path[80];
+    snprintf(stats_path, sizeof(stats_path), "%s.stats", path);
+    int saved = suite_mute();
+    Server* counted = server_create(stats_path, 1, false);
+    suite_unmute(saved);
+    stats_enable(false);
+    if (counted == NULL) refused++;
+    else server_free(counted);
+
+    // the same requests from several connections at once
+    char* body = bench_random_program(1, names, 40, false);
+    double values[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    frame = server_encode(body, name_list, values, names, name_list, names, &size);
+    ServerLoadResult load = server_load(path, frame, size, 4, 500);
+    free(frame);
+    free(body);
+    // turned-down requests are failures, not latency samples
+    frame = server_encode("print(1)", NULL, NULL, 0, NULL, 0, &size);
+    ServerLoadResult turned_down = server_load(path, frame, size, 2, 50);
+    if (turned_down.failures != 100 || turned_down.answered != 0 || turned_down.max != 0) mismatches++;
+    free(frame);
+    bench_server_finish(server, thread);
+
+    // a client that stops halfway through a request holds the only worker until the request times out, then the
+    // next client is answered. stopping doesn't wait for the timeout of a client stuck halfway
+    int stalled = 0;
+    server = bench_server_start(&thread, path, sizeof(path), 1);
+    int staller = server_connect(path);
+    send(staller, &bad, 3, MSG_NOSIGNAL);
+    usleep(50000);
+    fd = server_connect(path);
+    const char* out = "x";
+    frame = server_encode("x = 2 * 3", NULL, NULL, 0, &out, 1, &size);
+    double start = bench_now();
+    ServerReply answer = {0};
+    if (server_exchange(fd, frame, size, &answer) && answer.status == SERVER_OK && answer.values[0] == 6 &&
+        bench_now() - start < SERVER_REQUEST_TIMEOUT_MS * 3 / 1000.0) {
+        stalled++;
+    }
+    server_reply_free(&answer);
+    free(frame);
+    int second = server_connect(path);
+    send(second, &bad, 3, MSG_NOSIGNAL);
+    usleep(50000);
+    start = bench_now();
+    bench_server_finish(server, thread);
+    if (bench_now() - start < SERVER_REQUEST_TIMEOUT_MS / 2 / 1000.0) stalled++;
+    close(second);
+    close(fd);
+    close(staller);
+    printf("server differential: %d programs, %d mismatches, %d of 5 refusals, %llu of %llu concurrent requests "
+           "failed, %d of 2 stalls survived\n", programs, mismatches, refused, (unsigned long long)load.failures,
+           (unsigned long long)load.requests, stalled);
+    return mismatches + 5 - refused + (int)load.failures + 2 - stalled;
+}
+
+// what a request costs: a process per request that compiles and runs, compiling and running in-process, and
+// the server with the program resident, from one and from several connections at once
+void bench_server() {
+    char* body = bench_random_program(3, 8, 40, false);
+    char name_text[8][16];
+    const char* name_list[8];
+    double values[8];
+    for (uint32_t n = 0; n < 8; n++) {
+        bench_name(name_text[n], n);
+        name_list[n] = name_text[n];
+        values[n] = n + 1;
+    }
+    char* src = bench_reactive_source(body, values, 8, false);
+    printf("server: one request, a program of %zu bytes\n", strlen(body));
+
+    const int forks = 200;
+    // so the children don't have anything of ours to write out
+    fflush(stdout);
+    double start = bench_now();
+    for (int r = 0; r < forks; r++) {
+        pid_t child = fork();
+        if (child == 0) {
+            Arena* arena = arena_create();
+            InstructionArr* instructions = gen_code(src, arena);
+            InstrVM* vm = vm_create(instructions);
+            vm_execute(vm, instructions);
+            _exit(0);
+        }
+        waitpid(child, NULL, 0);
+    }
+    printf("  %-28s %10.1f us per request\n", "fork, compile and run", (bench_now() - start) / forks * 1e6);
+
+    const int compiles = 5000;
+    start = bench_now();
+    for (int r = 0; r < compiles; r++) {
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        InstrVM* vm = vm_create(instructions);
+        vm_execute(vm, instructions);
+        vm_free(vm);
+        free_instructions(instructions);
+        arena_free(arena);
+    }
+    printf("  %-28s %10.1f us per request\n", "compile and run in-process", (bench_now() - start) / compiles * 1e6);
+
+    char path[64];
+    pthread_t thread;
+    Server* server = bench_server_start(&thread, path, sizeof(path), 0);
+    if (server) {
+        size_t size;
+        char* frame = server_encode(body, name_list, values, 8, name_list, 8, &size);
+        for (uint32_t clients = 1; clients <= 16; clients *= 4) {
+            ServerLoadResult load = server_load(path, frame, size, clients, 20000 / clients);
+            char label[64];
+            snprintf(label, sizeof(label), "server, %u connection%s", clients, clients > 1 ? "s" : "");
+            printf("  %-28s %10.1f us per request, p50 %.1f us, p99 %.1f us, %llu failed\n", label,
+                   load.answered ? load.seconds / load.answered * 1e6 : 0, load.p50 / 1e3, load.p99 / 1e3,
+                   (unsigned long long)load.failures);
+        }
+        free(frame);
+        bench_server_finish(server, thread);
+    }
+    free(src);
+    free(body);
+}
+
+// machine-generated statements far deeper than any written by hand: a tower of parentheses, sums nested to the
+// right, negations, and a call with that many arguments. each is depth nodes deep or wide
+char* bench_deep_source(int kind, uint32_t depth) {
+    size_t cap = (size_t)depth * 6 + 64, len = 0;
+    char* src = malloc(cap);
+    len += (size_t)snprintf(src, cap, kind == 3 ? "x = 1; print(" : "x = ");
+    for (uint32_t i = 0; i < depth; i++) {
+        const char* open[] = {"(", "1 + (", "- ", i + 1 < depth ? "x, " : "x"};
+        for (const char* c = open[kind]; *c; c++) src[len++] = *c;
+    }
+    if (kind < 3) src[len++] = '1';
+    for (uint32_t i = 0; i < depth && kind < 2; i++) src[len++] = ')';
+    if (kind == 3) src[len++] = ')';
+    src[len++] = ';';
+    src[len] = '\0';
+    return src;
+}
+
+const char* bench_deep_names[] = {"parens", "right sums", "negations", "arguments"};
+
+// a million levels of nesting and a million arguments compile and run to the right value, and statements with syntax
+// errors compile to nothing instead of taking the compiler down
+int check_deep() {
+    const uint32_t depth = 1000000;
+    int mismatches = 0;
+    for (int kind = 0; kind < 4; kind++) {
+        char* src = bench_deep_source(kind, depth);
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        int saved = suite_mute();
+        InstrVM* vm = vm_create(instructions);
+        bool ok = vm_execute(vm, instructions);
+        output_flush();
+        suite_unmute(saved);
+        Instruction last = instructions->data[instructions->size - 1];
+        double x = 0;
+        int symbol = symbol_find("x");
+        if (symbol >= 0 && vm->symbol_slots[symbol] >= 0) x = vm->vars[vm->symbol_slots[symbol]];
+        double expected[] = {1, depth + 1.0, depth % 2 ? -1 : 1, 1};
+        bool same = ok && x == expected[kind];
+        if (kind == 3) {
+            same = same && last.type == BINARY && last.data.binary.op == CALL &&
+                   last.data.binary.right.data.arglist.len == (int)depth;
+        }
+        if (!same && mismatches++ < 5) {
+            printf("deep mismatch in %s\n", bench_deep_names[kind]);
+        }
+        vm_free(vm);
+        free_instructions(instructions);
+        arena_free(arena);
+        free(src);
+    }
+    const char* broken[] = {")", "x = ", "x = (1", "x = 1 +", "x = -", "print(1,,2)", "f(", "x = ((((1 + ))))"};
+    int count = (int)(sizeof(broken) / sizeof(broken[0]));
+    // the errors they print go nowhere
+    int compiled[sizeof(broken) / sizeof(broken[0])];
+    int saved = suite_mute();
+    for (int i = 0; i < count; i++) {
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(broken[i], arena);
+        compiled[i] = instructions->size;
+        free_instructions(instructions);
+        arena_free(arena);
+    }
+    suite_unmute(saved);
+    for (int i = 0; i < count; i++) {
+        if (compiled[i] != 0 && mismatches++ < 5) {
+            printf("deep: '%s' compiled to %d instructions\n", broken[i], compiled[i]);
+        }
+    }
+    printf("deep nesting: %u levels, %d statements with syntax errors, %d mismatches\n", depth, count, mismatches);
+    return mismatches;
+}
+
+// compiling deep statements, parse and lowering together, per node. the recursive parser and lowering ran out of an
+// 8 MB stack at 30000 nested sums and somewhere below a million arguments
+void bench_deep() {
+    const int reps = 3;
+    printf("deep nesting: gen_code, best of %d\n", reps);
+    printf("%12s %10s %12s %12s\n", "shape", "depth", "ms", "ns/node");
+    for (int kind = 0; kind < 4; kind++) {
+        for (uint32_t depth = 1000; depth <= 1000000; depth *= 10) {
+            char* src = bench_deep_source(kind, depth);
+            double best = 1e30;
+            for (int r = 0; r < reps; r++) {
+                Arena* arena = arena_create();
+                double start = bench_now();
+                InstructionArr* instructions = gen_code(src, arena);
+                double elapsed = bench_now() - start;
+                if (elapsed < best) best = elapsed;
+                free_instructions(instructions);
+                arena_free(arena);
+            }
+            printf("%12s %10u %12.2f %12.1f\n", bench_deep_names[kind], depth, best * 1e3, best * 1e9 / depth);
+            free(src);
+        }
+    }
+}
+
+// hand-written programs for the assignments the passes special-case: a copy of a name, which has to stay a copy
+// when either name is assigned again, a constant assigned over a computed value, and assignments nested in another
+// one. %d is the first value of a, which check_assignments also changes through a reactive program
+const char* bench_assignment_programs[] = {
+        "a = %d; b = a; a = 5; c = b + a; print(a, b, c);",
+        "a = %d; b = (c = a + 1); a = 7; c = 2; print(a, b, c);",
+        "a = %d; b = (c = a); c = c * 10; d = b; b = 0; print(a, b, c, d);",
+        "a = %d; a = a; b = a; a = 1; b = b + a; print(a, b);",
+        "a = %d; q = (r = (s = a + 2) * 3); s = q; r = 0; print(a, q, r, s);",
+        "a = %d; b = a; a = 9; c = a * 2; b = (d = b); print(b, d);",
+        "a = %d; t = a; t = 2; u = t; t = (v = (w = u)); w = 3; print(a, t, u, v, w);",
+        "a = %d; b = a * 2; c = b; b = c + 1; c = (b = c) + b; print(a, b, c);",
+};
+
+// what src prints on the engine, after the optimizer and slot allocation if asked
+char* bench_engine_output(const char* src, VmEngine engine, bool optimize, bool slots) {
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code(src, arena);
+    if (optimize) {
+        OptStats stats;
+        optimize_instructions(instructions, &stats);
+    }
+    if (slots) allocate_slots(instructions);
+    EngineProgram* program = engine_prepare(instructions, engine);
+    BenchCapture capture = bench_capture_begin();
+    if (program) engine_run(program);
+    char* out = bench_capture_end(capture, NULL);
+    if (program) engine_program_free(program);
+    free_instructions(instructions);
+    arena_free(arena);
+    return out;
+}
+
+// the assignment programs through every engine and pass against the vm: the same output, and the same names after
+// a reactive program has had a changed
+int check_assignments() {
+    const int programs = (int)(sizeof(bench_assignment_programs) / sizeof(bench_assignment_programs[0]));
+    const char* passes[] = {"engines", "dead code", "stream", "session", "parallel compile", "image", "reactive"};
+    int mismatches = 0, compared = 0;
+    char path[] = "/tmp/expr_asm_image_XXXXXX";
+    close(mkstemp(path));
+    ThreadPool* pool = pool_create(4);
+    symbol_intern("print");
+    for (int p = 0; p < programs; p++) {
+        char src[256], changed[256];
+        snprintf(src, sizeof(src), bench_assignment_programs[p], 3);
+        snprintf(changed, sizeof(changed), bench_assignment_programs[p], 10);
+        char* expected = bench_engine_output(src, ENGINE_SWITCH, false, false);
+        char* got[7] = {0};
+
+        // every engine, as compiled, optimized, with slots reused and both, has to print the same
+        for (int variant = 1; variant < 20; variant++) {
+            char* out = bench_engine_output(src, (VmEngine)(variant % 5), variant / 5 % 2, variant / 10);
+            if (strcmp(out, expected) != 0 && got[0] == NULL) got[0] = strdup(out);
+            free(out);
+            compared++;
+        }
+
+        Arena* arena = arena_create();
+        InstructionArr* instructions = gen_code(src, arena);
+        eliminate_dead_code(instructions, false);
+        InstrVM* vm;
+        got[1] = bench_captured_run(instructions, NULL, NULL, &vm);
+        vm_free(vm);
+        free_instructions(instructions);
+
+        BenchCapture capture = bench_capture_begin();
+        StreamRunner* runner = stream_create();
+        stream_feed(runner, src, strlen(src));
+        stream_finish(runner);
+        stream_free(runner);
+        got[2] = bench_capture_end(capture, NULL);
+
+        capture = bench_capture_begin();
+        Session* session = session_create();
+        for (const char* at = src; *at;) {
+            const char* end = strchr(at, ';');
+            end = end ? end + 1 : at + strlen(at);
+            session_eval(session, at, (size_t)(end - at));
+            at = end;
+        }
+        session_free(session);
+        got[3] = bench_capture_end(capture, NULL);
+
+        // repeated until it's long enough to be split between threads
+        size_t len = strlen(src), repeats = PARALLEL_MIN_STATEMENTS;
+        char* repeated = malloc(len * repeats + 1);
+        for (size_t r = 0; r < repeats; r++) memcpy(repeated + r * len, src, len);
+        repeated[len * repeats] = '\0';
+        instructions = gen_code(repeated, arena);
+        char* serial_out = bench_captured_run(instructions, NULL, NULL, &vm);
+        vm_free(vm);
+        free_instructions(instructions);
+        instructions = gen_code_parallel(repeated, arena, pool);
+        char* parallel_out = bench_captured_run(instructions, NULL, NULL, &vm);
+        vm_free(vm);
+        free_instructions(instructions);
+        got[4] = strcmp(serial_out, parallel_out) == 0 ? strdup(expected) : strdup(parallel_out);
+        free(serial_out);
+        free(parallel_out);
+        free(repeated);
+        arena_free(arena);
+
+        for (int optimize = 0; optimize < 2; optimize++) {
+            capture = bench_capture_begin();
+            if (image_compile(src, path, optimize)) {
+                ProgramImage* image = image_load(path);
+                if (image) image_run(image);
+                if (image) image_free(image);
+            }
+            char* out = bench_capture_end(capture, NULL);
+            if (got[5] == NULL || strcmp(out, expected) != 0) {
+                free(got[5]);
+                got[5] = out;
+            } else {
+                free(out);
+            }
+        }
+
+        // the first run prints what the vm printed, then a = 10 leaves the names where the changed program does
+        capture = bench_capture_begin();
+        ReactiveProgram* reactive = reactive_create(src);
+        got[6] = bench_capture_end(capture, NULL);
+        arena = arena_create();
+        instructions = gen_code(changed, arena);
+        capture = bench_capture_begin();
+        InstrVM* want = vm_create(instructions);
+        vm_execute(want, instructions);
+        if (reactive) reactive_set_input(reactive, "a", 10);
+        free(bench_capture_end(capture, NULL));
+        bool same = reactive != NULL;
+        for (uint32_t s = 0; same && s < want->symbol_count; s++) {
+            double value;
+            int e = want->symbol_slots[s];
+            bool bound = reactive_get(reactive, symbol_name(s), &value);
+            same = (e >= 0) == bound && (!bound || bench_same_double(want->vars[e], value));
+        }
+        if (!same) {
+            free(got[6]);
+            got[6] = strdup("");
+        }
+        if (reactive) reactive_free(reactive);
+        vm_free(want);
+        free_instructions(instructions);
+        arena_free(arena);
+
+        for (int pass = 0; pass < 7; pass++) {
+            if (got[pass] && strcmp(got[pass], expected) != 0 && mismatches++ < 5) {
+                printf("assignment mismatch in %s on '%s'\n", passes[pass], src);
+            }
+            free(got[pass]);
+        }
+        compared += 6;
+        free(expected);
+    }
+    pool_free(pool);
+    unlink(path);
+    printf("assignment differential: %d programs, %d comparisons, %d mismatches\n", programs, compared, mismatches);
+    return mismatches;
+}
+
+// programs the vm prints an error for while running: an unknown name reads 0, an unknown call or one with the
+// wrong number of arguments gives 0, and copying an unknown name stops the program. every engine has to print
+// the same errors in the same places
+const char* bench_error_programs[] = {
+        "print(q); x = 1; print(x);",
+        "y = foo(1); print(y); z = 2; print(z);",
+        "print(1, q, 2); a = q + r; print(a);",
+        "w = sqrt(1, 2); print(w + 1);",
+        "print(1); x = q; print(2);",
+        "a = 3; b = -q * a; print(b, exp(q)); c = bar(a, b) + a; print(c);",
+        "a = 1; b = a + 2; c = b * q; d = max(c, 4, 5); print(a, b, c, d);",
+};
+
+int check_errors() {
+    const int programs = (int)(sizeof(bench_error_programs) / sizeof(bench_error_programs[0]));
+    int mismatches = 0;
+    for (int p = 0; p < programs; p++) {
+        const char* src = bench_error_programs[p];
+        // the line of an error is the instruction's index, which the optimizer changes
+        char* expected[2] = {
+                bench_engine_output(src, ENGINE_SWITCH, false, false),
+                bench_engine_output(src, ENGINE_SWITCH, true, false),
+        };
+        for (int variant = 1; variant < 20; variant++) {
+            VmEngine engine = (VmEngine)(variant % 5);
+            bool optimize = variant / 5 % 2;
+            if (engine == ENGINE_SWITCH && optimize && variant < 10) continue;
+            char* out = bench_engine_output(src, engine, optimize, variant / 10);
+            if (strcmp(out, expected[optimize]) != 0 && mismatches++ < 5) {
+                printf("error mismatch on %s%s%s for '%s':\n%s-- expected --\n%s", engine_names[engine],
+                       optimize ? ", optimized" : "", variant / 10 ? ", slots" : "", src, out, expected[optimize]);
+            }
+            free(out);
+        }
+        free(expected[0]);
+        free(expected[1]);
+    }
+    printf("error differential: %d programs, %d mismatches\n", programs, mismatches);
+    return mismatches;
+}
+
+int main(int argc, char** argv) {
+    bool suite_only = false, csv = false, check_only = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--suite") == 0) {
+            suite_only = true;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check_only = true;
+        } else {
+            printf("usage: %s [--suite] [--csv] [--check]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (suite_only || csv) {
+        // csv is only the suite, so the output can be tracked as is
+        bench_suite(csv);
+        return 0;
+    }
+    // every check returns its mismatches, any of them fails the run
+    int mismatches = 0;
+    mismatches += check_jit();
+    mismatches += check_optimizer();
+    mismatches += check_slots();
+    mismatches += check_cache();
+    mismatches += check_stream();
+    mismatches += check_lexer();
+    mismatches += check_numbers();
+    mismatches += check_parallel();
+    mismatches += check_dag();
+    mismatches += check_image();
+    mismatches += check_dce();
+    mismatches += check_builtins();
+    mismatches += check_output();
+    mismatches += check_session();
+    mismatches += check_reactive();
+    mismatches += check_server();
+    mismatches += check_deep();
+    mismatches += check_assignments();
+    mismatches += check_errors();
+    if (mismatches > 0) {
+        printf("%d mismatches, the benchmarks were not run\n", mismatches);
+        return 1;
+    }
+    if (check_only) return 0;
+    bench_symbols();
+    bench_bytecode();
+    bench_engines();
+    bench_batch();
+    bench_cache();
+    bench_stream();
+    bench_lexer();
+    bench_numbers();
+    bench_parallel();
+    bench_dag();
+    bench_image();
+    bench_dce();
+    bench_builtins();
+    bench_output();
+    bench_session();
+    bench_reactive();
+    bench_server();
+    bench_deep();
+    bench_suite(false);
+    return 0;
+}
@@ -0,0 +1,469 @@
+#pragma once
+#ifndef _BYTECODE_H
+#define _BYTECODE_H
+
+#include "asm.h"
+#include "output.h"
+
+// compact encoding of an InstructionArr.
+// an Instruction is 64 bytes (two tagged Data operands), a BcInstr is 16.
+// every operand is a plain register index: registers [0, frame_size) are the % variables,
+// and the constant pool is loaded right after them, so the loop never looks at an operand type.
+// identifiers are bound to registers while emitting (the program is straight-line, so every binding is known),
+// which means `x = %3` costs nothing at runtime and no symbol lookup survives into the bytecode.
+
+typedef enum BcOp {
+    BC_ADD, BC_SUB, BC_MUL, BC_DIV, // out = a op b
+    BC_NEG, // out = -a
+    BC_MOVE, // out = a
+    BC_PRINT, // prints args[a .. a + b), out = 0
+    BC_POW, BC_MIN, BC_MAX, // out = f(a, b), like math_binary
+    BC_SQRT, BC_EXP, BC_LOG, BC_ABS, BC_SIN, BC_COS, // out = f(a), like math_unary
+    BC_ERROR, // prints error out (a BcError) about symbol or builtin a at line b, writes nothing
+} BcOp;
+
+#define BC_LAST_OP BC_ERROR
+
+// the run-time errors of the switch vm. the name read or the call then gives 0, like it does there
+typedef enum BcError {
+    BC_ERROR_IDENTIFIER, // a is the symbol
+    BC_ERROR_FUNCTION, // a is the symbol
+    BC_ERROR_ARITY, // a is the builtin
+    BC_ERROR_COPY, // a is the symbol, nothing after it is emitted since the vm stops there
+} BcError;
+
+// prints the error of a BC_ERROR, exactly as vm_step does
+void bc_report_error(uint32_t error, uint32_t a, uint32_t line) {
+    output_before_error();
+    switch ((BcError)error) {
+        case BC_ERROR_IDENTIFIER:
+            printf("ERROR %u: unknown identifier '%s'\n", line, symbol_name((int)a));
+            break;
+        case BC_ERROR_FUNCTION:
+            printf("ERROR %u: unknown function '%s'\n", line, symbol_name((int)a));
+            break;
+        case BC_ERROR_ARITY:
+            printf("ERROR %u: '%s' takes %d argument(s)\n", line, builtins[a].name, builtin_arity((int)a));
+            break;
+        case BC_ERROR_COPY:
+            printf("ERROR %u: unknown copy identifier '%s'\n", line, symbol_name((int)a));
+            break;
+    }
+}
+
+// ops that read b as a register
+static inline bool bc_is_binary(uint8_t op) {
+    return op <= BC_DIV || (op >= BC_POW && op <= BC_MAX);
+}
+
+typedef struct BcInstr {
+    uint8_t op;
+    uint8_t pad[3];
+    uint32_t out;
+    uint32_t a;
+    uint32_t b;
+} BcInstr;
+
+dynarr(BcInstrArr, BcInstr);
+typedef struct BcInstrArr BcInstrArr;
+dynarr(DoubleArr, double);
+typedef struct DoubleArr DoubleArr;
+dynarr(RegArr, uint32_t);
+typedef struct RegArr RegArr;
+
+typedef struct BcProgram {
+    BcInstrArr* code;
+    DoubleArr* constants; // deduplicated, loaded at registers [frame_size, frame_size + constants->size)
+    RegArr* args; // flattened print arglists
+    RegArr* inputs; // symbols of the free identifiers (see bc_compile_inputs), their registers follow the constants
+    int* symbol_regs; // register every symbol is bound to once the program has run, -1 if unbound
+    uint32_t symbol_count;
+    uint32_t frame_size;
+} BcProgram;
+
+typedef struct BcEmitter {
+    BcProgram* program;
+    int* symbol_regs; // symbol -> register it is bound to, -1 if unbound
+    uint32_t* const_buckets; // constant pool index + 1, 0 means empty
+    uint32_t const_bucket_count;
+    uint32_t frame_size;
+    bool free_inputs; // bind identifiers that are read before they are assigned to input registers
+    bool halted; // a BC_ERROR_COPY was emitted, the program ends there
+    int line;
+} BcEmitter;
+
+uint32_t bc_hash_double(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+void bc_grow_constants(BcEmitter* em) {
+    uint32_t count = em->const_bucket_count ? em->const_bucket_count * 2 : 64;
+    free(em->const_buckets);
+    em->const_buckets = calloc(count, sizeof(uint32_t));
+    em->const_bucket_count = count;
+    DoubleArr* pool = em->program->constants;
+    for (int i = 0; i < pool->size; i++) {
+        uint32_t b = bc_hash_double(pool->data[i]) & (count - 1);
+        while (em->const_buckets[b]) b = (b + 1) & (count - 1);
+        em->const_buckets[b] = i + 1;
+    }
+}
+
+// returns the pool index of the constant, adding it if needed
+uint32_t bc_constant(BcEmitter* em, double d) {
+    DoubleArr* pool = em->program->constants;
+    if ((uint32_t)(pool->size + 1) * 2 > em->const_bucket_count) {
+        bc_grow_constants(em);
+    }
+    uint32_t b = bc_hash_double(d) & (em->const_bucket_count - 1);
+    while (em->const_buckets[b]) {
+        // compare bits, so -0.0 and 0.0 stay distinct
+        if (memcmp(&pool->data[em->const_buckets[b] - 1], &d, sizeof(d)) == 0) {
+            return em->const_buckets[b] - 1;
+        }
+        b = (b + 1) & (em->const_bucket_count - 1);
+    }
+    pushDoubleArr(pool, d);
+    em->const_buckets[b] = pool->size;
+    return pool->size - 1;
+}
+
+// constants and inputs are encoded as their index with a flag bit set, and relocated once the frame size is known
+#define BC_CONST_FLAG 0x80000000u
+#define BC_INPUT_FLAG 0x40000000u
+
+void bc_track(BcEmitter* em, uint32_t reg) {
+    if (reg + 1 > em->frame_size) {
+        em->frame_size = reg + 1;
+    }
+}
+
+// no register is tracked, out holds the error
+void bc_emit_error(BcEmitter* em, BcError error, uint32_t a) {
+    BcInstr instr = { .op = BC_ERROR, .out = error, .a = a, .b = (uint32_t)em->line };
+    pushBcInstrArr(em->program->code, instr);
+}
+
+bool bc_operand(BcEmitter* em, Data d, uint32_t* reg) {
+    switch (d.type) {
+        case CONSTANT:
+            *reg = BC_CONST_FLAG | bc_constant(em, d.data.constant);
+            return true;
+        case VARIABLE:
+            *reg = d.data.variable;
+            bc_track(em, *reg);
+            return true;
+        case IDENTIFIER:
+            if (em->symbol_regs[d.data.ident.symbol] < 0 && em->free_inputs) {
+                em->symbol_regs[d.data.ident.symbol] = (int)(BC_INPUT_FLAG | em->program->inputs->size);
+                pushRegArr(em->program->inputs, d.data.ident.symbol);
+            }
+            if (em->symbol_regs[d.data.ident.symbol] < 0) {
+                bc_emit_error(em, BC_ERROR_IDENTIFIER, (uint32_t)d.data.ident.symbol);
+                *reg = BC_CONST_FLAG | bc_constant(em, 0);
+                return true;
+            }
+            *reg = em->symbol_regs[d.data.ident.symbol];
+            return true;
+        default:
+            printf("ERROR %d: unknown data type\n", em->line);
+            return false;
+    }
+}
+
+void bc_emit(BcEmitter* em, BcOp op, uint32_t out, uint32_t a, uint32_t b) {
+    BcInstr instr = { .op = op, .out = out, .a = a, .b = b };
+    pushBcInstrArr(em->program->code, instr);
+    bc_track(em, out);
+}
+
+bool bc_assign(BcEmitter* em, Instruction* instr) {
+    Data left = instr->data.binary.left;
+    Data right = instr->data.binary.right;
+    if (left.type != IDENTIFIER) {
+        printf("ERROR %d: left side of assignment must be an identifier\n", em->line);
+        return false;
+    }
+    uint32_t src;
+    switch (right.type) {
+        case VARIABLE:
+            // just a rename
+            em->symbol_regs[left.data.ident.symbol] = right.data.variable;
+            return true;
+        case IDENTIFIER:
+            if (em->symbol_regs[right.data.ident.symbol] < 0 && !em->free_inputs) {
+                bc_emit_error(em, BC_ERROR_COPY, (uint32_t)right.data.ident.symbol);
+                em->halted = true;
+                return true;
+            }
+            // fall through
+        case CONSTANT:
+            if (!bc_operand(em, right, &src)) return false;
+            bc_emit(em, BC_MOVE, instr->out, src, 0);
+            em->symbol_regs[left.data.ident.symbol] = instr->out;
+            return true;
+        default:
+            printf("ERROR %d: right side of assignment must be a constant, variable, or identifier\n", em->line);
+            return false;
+    }
+}
+
+bool bc_call(BcEmitter* em, Instruction* instr) {
+    Data left = instr->data.binary.left;
+    Data right = instr->data.binary.right;
+    if (left.type != IDENTIFIER && left.type != FUNCTION) {
+        printf("ERROR %d: call must be an identifier\n", em->line);
+        return false;
+    }
+    if (left.type == IDENTIFIER || left.data.function != BUILTIN_PRINT) {
+        // a program with free inputs runs once per set of inputs, so an error in it turns it down
+        if (em->free_inputs) {
+            if (left.type == IDENTIFIER) {
+                printf("ERROR %d: unknown function '%s'\n", em->line, left.data.ident.name);
+            } else {
+                printf("ERROR %d: '%s' takes %d argument(s)\n", em->line, builtins[left.data.function].name,
+                       builtin_arity(left.data.function));
+            }
+            return false;
+        }
+        // the arguments aren't looked at, and the call gives 0
+        if (left.type == IDENTIFIER) {
+            bc_emit_error(em, BC_ERROR_FUNCTION, (uint32_t)left.data.ident.symbol);
+        } else {
+            bc_emit_error(em, BC_ERROR_ARITY, (uint32_t)left.data.function);
+        }
+        bc_emit(em, BC_MOVE, instr->out, BC_CONST_FLAG | bc_constant(em, 0), 0);
+        return true;
+    }
+    if (right.type != ARGLIST) {
+        printf("ERROR %d: print must have an argument list\n", em->line);
+        return false;
+    }
+    RegArr* args = em->program->args;
+    uint32_t start = args->size;
+    for (int i = 0; i < right.data.arglist.len; i++) {
+        uint32_t reg;
+        if (!bc_operand(em, right.data.arglist.args[i], &reg)) return false;
+        pushRegArr(args, reg);
+    }
+    bc_emit(em, BC_PRINT, instr->out, start, right.data.arglist.len);
+    return true;
+}
+
+void bc_program_free(BcProgram* program) {
+    delBcInstrArr(program->code);
+    delDoubleArr(program->constants);
+    delRegArr(program->args);
+    delRegArr(program->inputs);
+    free(program->symbol_regs);
+    free(program);
+}
+
+uint32_t bc_relocate(BcProgram* program, uint32_t reg) {
+    if (reg & BC_CONST_FLAG) return program->frame_size + (reg & ~BC_CONST_FLAG);
+    if (reg & BC_INPUT_FLAG) return program->frame_size + program->constants->size + (reg & ~BC_INPUT_FLAG);
+    return reg;
+}
+
+// returns NULL (after printing the error) if the program can't run. the errors the switch vm prints while running
+// become BC_ERROR ops, so they come out where they would have there and the program goes on the same way
+BcProgram* bc_compile_opts(InstructionArr* instructions, bool free_inputs) {
+    BcProgram* program = malloc(sizeof(BcProgram));
+    program->code = newBcInstrArr();
+    program->constants = newDoubleArr();
+    program->args = newRegArr();
+    program->inputs = newRegArr();
+    program->frame_size = 0;
+    // at most one bytecode instruction per instruction
+    reserveBcInstrArr(program->code, instructions->size);
+
+    uint32_t symbol_total = symbol_count();
+    program->symbol_count = symbol_total;
+    program->symbol_regs = malloc((symbol_total ? symbol_total : 1) * sizeof(int));
+    BcEmitter em = {
+            .program = program,
+            .symbol_regs = program->symbol_regs,
+            .const_buckets = NULL,
+            .const_bucket_count = 0,
+            .frame_size = 0,
+            .free_inputs = free_inputs,
+            .halted = false,
+            .line = 0
+    };
+    for (uint32_t i = 0; i < symbol_total; i++) {
+        em.symbol_regs[i] = -1;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < instructions->size && ok && !em.halted; i++) {
+        Instruction* instr = &instructions->data[i];
+        em.line = i;
+        uint32_t a, b;
+        switch (instr->type) {
+            case BINARY:
+                switch (instr->data.binary.op) {
+                    case ADD:
+                    case SUB:
+                    case MUL:
+                    case DIV:
+                        ok = bc_operand(&em, instr->data.binary.left, &a) && bc_operand(&em, instr->data.binary.right, &b);
+                        if (ok) {
+                            // ADD..DIV and BC_ADD..BC_DIV are in the same order
+                            bc_emit(&em, (BcOp)(BC_ADD + (instr->data.binary.op - ADD)), instr->out, a, b);
+                        }
+                        break;
+                    case POW:
+                    case MINIMUM:
+                    case MAXIMUM:
+                        ok = bc_operand(&em, instr->data.binary.left, &a) && bc_operand(&em, instr->data.binary.right, &b);
+                        if (ok) {
+                            bc_emit(&em, (BcOp)(BC_POW + (instr->data.binary.op - POW)), instr->out, a, b);
+                        }
+                        break;
+                    case ASSIGN:
+                        ok = bc_assign(&em, instr);
+                        break;
+                    case CALL:
+                        ok = bc_call(&em, instr);
+                        break;
+                }
+                break;
+            case UNARY:
+                ok = bc_operand(&em, instr->data.unary.operand, &a);
+                if (ok) {
+                    // SQRT..COS and BC_SQRT..BC_COS are in the same order
+                    UnaryOp op = instr->data.unary.op;
+                    bc_emit(&em, op == NEG ? BC_NEG : (BcOp)(BC_SQRT + (op - SQRT)), instr->out, a, 0);
+                }
+                break;
+            case SET:
+                ok = bc_operand(&em, instr->data.set, &a);
+                if (ok) {
+                    bc_emit(&em, BC_MOVE, instr->out, a, 0);
+                }
+                break;
+        }
+    }
+    free(em.const_buckets);
+    if (!ok) {
+        bc_program_free(program);
+        return NULL;
+    }
+
+    // every register index is known now, move the constants and inputs behind the frame
+    program->frame_size = em.frame_size;
+    for (int i = 0; i < program->code->size; i++) {
+        BcInstr* instr = &program->code->data[i];
+        if (instr->op == BC_ERROR) continue;
+        if (instr->op != BC_PRINT) instr->a = bc_relocate(program, instr->a);
+        if (bc_is_binary(instr->op)) instr->b = bc_relocate(program, instr->b);
+    }
+    for (int i = 0; i < program->args->size; i++) {
+        program->args->data[i] = bc_relocate(program, program->args->data[i]);
+    }
+    for (uint32_t i = 0; i < symbol_total; i++) {
+        if (program->symbol_regs[i] >= 0) {
+            program->symbol_regs[i] = (int)bc_relocate(program, (uint32_t)program->symbol_regs[i]);
+        }
+    }
+    return program;
+}
+
+BcProgram* bc_compile(InstructionArr* instructions) {
+    return bc_compile_opts(instructions, false);
+}
+
+// like bc_compile, but identifiers that are read before being assigned become inputs instead of errors
+BcProgram* bc_compile_inputs(InstructionArr* instructions) {
+    return bc_compile_opts(instructions, true);
+}
+
+// number of registers a program needs: frame, constants, then inputs
+uint32_t bc_register_count(BcProgram* program) {
+    return program->frame_size + program->constants->size + program->inputs->size;
+}
+
+// runs the program in a frame of bc_register_count registers, the constants are loaded into it first
+void bc_run_frame(BcProgram* program, double* regs) {
+    // an empty array has no buffer yet
+    if (program->constants->size > 0) {
+        memcpy(regs + program->frame_size, program->constants->data, program->constants->size * sizeof(double));
+    }
+    const BcInstr* code = program->code->data;
+    const uint32_t* args = program->args->data;
+    for (int i = 0, n = program->code->size; i < n; i++) {
+        const BcInstr* instr = &code[i];
+        switch ((BcOp)instr->op) {
+            case BC_ADD: regs[instr->out] = regs[instr->a] + regs[instr->b]; break;
+            case BC_SUB: regs[instr->out] = regs[instr->a] - regs[instr->b]; break;
+            case BC_MUL: regs[instr->out] = regs[instr->a] * regs[instr->b]; break;
+            case BC_DIV: regs[instr->out] = regs[instr->a] / regs[instr->b]; break;
+            case BC_NEG: regs[instr->out] = -regs[instr->a]; break;
+            case BC_MOVE: regs[instr->out] = regs[instr->a]; break;
+            case BC_PRINT:
+                output_registers(regs, args + instr->a, instr->b);
+                regs[instr->out] = 0;
+                break;
+            case BC_POW: regs[instr->out] = pow(regs[instr->a], regs[instr->b]); break;
+            case BC_MIN: regs[instr->out] = math_binary(MINIMUM, regs[instr->a], regs[instr->b]); break;
+            case BC_MAX: regs[instr->out] = math_binary(MAXIMUM, regs[instr->a], regs[instr->b]); break;
+            case BC_SQRT: regs[instr->out] = sqrt(regs[instr->a]); break;
+            case BC_EXP: regs[instr->out] = exp(regs[instr->a]); break;
+            case BC_LOG: regs[instr->out] = log(regs[instr->a]); break;
+            case BC_ABS: regs[instr->out] = fabs(regs[instr->a]); break;
+            case BC_SIN: regs[instr->out] = sin(regs[instr->a]); break;
+            case BC_COS: regs[instr->out] = cos(regs[instr->a]); break;
+            case BC_ERROR: bc_report_error(instr->out, instr->a, instr->b); break;
+        }
+    }
+}
+
+void run_bytecode(BcProgram* program) {
+    double* regs = malloc((bc_register_count(program) + 1) * sizeof(double));
+    bc_run_frame(program, regs);
+    free(regs);
+    output_flush();
+}
+
+void print_bytecode(BcProgram* program) {
+    static const char* names[] = {
+            [BC_ADD] = "add", [BC_SUB] = "sub", [BC_MUL] = "mul", [BC_DIV] = "div",
+            [BC_NEG] = "neg", [BC_MOVE] = "move", [BC_PRINT] = "print",
+            [BC_POW] = "pow", [BC_MIN] = "min", [BC_MAX] = "max",
+            [BC_SQRT] = "sqrt", [BC_EXP] = "exp", [BC_LOG] = "log", [BC_ABS] = "abs", [BC_SIN] = "sin", [BC_COS] = "cos",
+            [BC_ERROR] = "error"
+    };
+    for (int i = 0; i < program->constants->size; i++) {
+        printf("k%d = %f\n", i, program->constants->data[i]);
+    }
+    for (int i = 0; i < program->code->size; i++) {
+        BcInstr instr = program->code->data[i];
+        if (instr.op == BC_ERROR) {
+            printf("%-5s %u, %u at %u\n", names[instr.op], instr.out, instr.a, instr.b);
+            continue;
+        }
+        printf("%-5s r%u", names[instr.op], instr.out);
+        switch ((BcOp)instr.op) {
+            case BC_PRINT:
+                for (uint32_t j = 0; j < instr.b; j++) {
+                    printf(", r%u", program->args->data[instr.a + j]);
+                }
+                printf("\n");
+                break;
+            default:
+                if (bc_is_binary(instr.op)) {
+                    printf(", r%u, r%u\n", instr.a, instr.b);
+                } else {
+                    printf(", r%u\n", instr.a);
+                }
+                break;
+        }
+    }
+}
+
+#endif //_BYTECODE_H
@@ -0,0 +1,277 @@
+#pragma once
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "asm.h"
+#include "optimize.h"
+#include "regalloc.h"
+
+// compiled-program cache keyed by source text, so an expression that comes back skips lexing, parsing and codegen.
+// sources are normalized first (whitespace only matters between two characters of the same token), then looked up
+// in a hash table. the least recently used programs are evicted once the cache holds more than its byte budget.
+// a cached program is copied out of the compilation arena into one allocation: the instructions, then every arglist.
+// identifier names point into the symbol table, which is process-wide, so they stay valid as well.
+// the programs are shared, so they must not be modified, and a program is only valid until the next
+// program_cache_get or program_cache_clear on the same cache, which may evict it. program_cache_acquire pins the
+// program instead, so it can run while other lookups go on, until program_cache_release.
+
+#define PROGRAM_CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+typedef struct CacheEntry {
+    struct CacheEntry* hash_next;
+    // lru list, the head is the most recently used
+    struct CacheEntry* lru_prev;
+    struct CacheEntry* lru_next;
+    uint32_t hash;
+    size_t bytes;
+    uint32_t pins; // acquired and not released yet, never evicted while above 0
+    uint32_t frame_size;
+    uint32_t calls; // prints and other calls, which have side effects
+    InstructionArr program; // points into the same allocation
+    char* key;
+} CacheEntry;
+
+typedef struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint32_t entries;
+    size_t bytes;
+} CacheStats;
+
+typedef struct ProgramCache {
+    CacheEntry** buckets;
+    uint32_t bucket_count;
+    CacheEntry* lru_head;
+    CacheEntry* lru_tail;
+    size_t budget;
+    bool optimize; // run optimize_instructions on a miss, allocate_slots always runs
+    Arena* scratch; // compilations happen here, reset after every miss
+    char* key_buffer;
+    size_t key_capacity;
+    CacheStats stats;
+} ProgramCache;
+
+ProgramCache* program_cache_create(size_t budget, bool optimize) {
+    ProgramCache* cache = malloc(sizeof(ProgramCache));
+    cache->bucket_count = 256;
+    cache->buckets = calloc(cache->bucket_count, sizeof(CacheEntry*));
+    cache->lru_head = NULL;
+    cache->lru_tail = NULL;
+    cache->budget = budget;
+    cache->optimize = optimize;
+    cache->scratch = arena_create();
+    cache->key_buffer = NULL;
+    cache->key_capacity = 0;
+    memset(&cache->stats, 0, sizeof(CacheStats));
+    return cache;
+}
+
+bool cache_word_char(char c) {
+    return is_alpha(c) || is_digit(c) || c == '.';
+}
+
+// writes the normalized source into the cache's key buffer and returns its length
+size_t cache_normalize(ProgramCache* cache, const char* src) {
+    size_t len = strlen(src);
+    if (len + 1 > cache->key_capacity) {
+        cache->key_capacity = len + 1;
+        cache->key_buffer = realloc(cache->key_buffer, cache->key_capacity);
+    }
+    size_t out = 0;
+    bool space = false;
+    for (size_t i = 0; i < len; i++) {
+        char c = src[i];
+        if (is_whitespace(c)) {
+            space = true;
+            continue;
+        }
+        // "a b" and "1 2" are two tokens, "a + b" and "a+b" are the same program
+        if (space && out > 0 && cache_word_char(cache->key_buffer[out - 1]) && cache_word_char(c)) {
+            cache->key_buffer[out++] = ' ';
+        }
+        space = false;
+        cache->key_buffer[out++] = c;
+    }
+    cache->key_buffer[out] = '\0';
+    return out;
+}
+
+void cache_lru_unlink(ProgramCache* cache, CacheEntry* entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else cache->lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->lru_tail = entry->lru_prev;
+}
+
+void cache_lru_push(ProgramCache* cache, CacheEntry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = entry;
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL) cache->lru_tail = entry;
+}
+
+void cache_remove(ProgramCache* cache, CacheEntry* entry) {
+    CacheEntry** link = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    cache_lru_unlink(cache, entry);
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->bytes;
+    free(entry);
+}
+
+void cache_grow(ProgramCache* cache) {
+    uint32_t count = cache->bucket_count * 2;
+    CacheEntry** buckets = calloc(count, sizeof(CacheEntry*));
+    for (uint32_t b = 0; b < cache->bucket_count; b++) {
+        CacheEntry* entry = cache->buckets[b];
+        while (entry) {
+            CacheEntry* next = entry->hash_next;
+            entry->hash_next = buckets[entry->hash & (count - 1)];
+            buckets[entry->hash & (count - 1)] = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = count;
+}
+
+// copies a finished program out of the scratch arena into a single allocation
+CacheEntry* cache_entry_create(InstructionArr* instructions, const char* key, size_t key_len, uint32_t hash) {
+    size_t arg_count = 0;
+    uint32_t calls = 0;
+    for (int i = 0; i < instructions->size; i++) {
+        Instruction* instr = &instructions->data[i];
+        if (instr->type == BINARY && instr->data.binary.right.type == ARGLIST) {
+            arg_count += instr->data.binary.right.data.arglist.len;
+        }
+        if (instr->type == BINARY && instr->data.binary.op == CALL) calls++;
+    }
+    size_t bytes = sizeof(CacheEntry) + instructions->size * sizeof(Instruction) + arg_count * sizeof(Data) + key_len + 1;
+    CacheEntry* entry = malloc(bytes);
+    Instruction* code = (Instruction*)(entry + 1);
+    Data* args = (Data*)(code + instructions->size);
+    if (instructions->size > 0) {
+        memcpy(code, instructions->data, instructions->size * sizeof(Instruction));
+    }
+    for (int i = 0; i < instructions->size; i++) {
+        Data* right = &code[i].data.binary.right;
+        if (code[i].type == BINARY && right->type == ARGLIST) {
+            memcpy(args, right->data.arglist.args, right->data.arglist.len * sizeof(Data));
+            right->data.arglist.args = args;
+            args += right->data.arglist.len;
+        }
+    }
+    entry->key = (char*)args;
+    memcpy(entry->key, key, key_len + 1);
+    memset(&entry->program, 0, sizeof(InstructionArr));
+    entry->program.data = code;
+    entry->program.size = instructions->size;
+    entry->program.capacity = instructions->size;
+    entry->hash = hash;
+    entry->bytes = bytes;
+    entry->pins = 0;
+    entry->frame_size = instructions_frame_size(instructions);
+    entry->calls = calls;
+    entry->hash_next = NULL;
+    return entry;
+}
+
+// the entry of the compiled program for src, compiling it on a miss
+CacheEntry* program_cache_entry(ProgramCache* cache, const char* src) {
+    size_t key_len = cache_normalize(cache, src);
+    const char* key = cache->key_buffer;
+    uint32_t hash = symbol_hash(key);
+    for (CacheEntry* entry = cache->buckets[hash & (cache->bucket_count - 1)]; entry; entry = entry->hash_next) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            cache->stats.hits++;
+            cache_lru_unlink(cache, entry);
+            cache_lru_push(cache, entry);
+            return entry;
+        }
+    }
+
+    cache->stats.misses++;
+    InstructionArr* instructions = gen_code(key, cache->scratch);
+    if (cache->optimize) {
+        optimize_instructions(instructions, NULL);
+    }
+    allocate_slots(instructions);
+    CacheEntry* entry = cache_entry_create(instructions, key, key_len, hash);
+    free_instructions(instructions);
+    arena_reset(cache->scratch);
+
+    if (cache->stats.entries + 1 > cache->bucket_count) {
+        cache_grow(cache);
+    }
+    CacheEntry** bucket = &cache->buckets[hash & (cache->bucket_count - 1)];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    cache_lru_push(cache, entry);
+    cache->stats.entries++;
+    cache->stats.bytes += entry->bytes;
+    // the new program is always kept, even if it's over the budget on its own, and so are pinned ones
+    CacheEntry* victim = cache->lru_tail;
+    while (cache->stats.bytes > cache->budget && victim != entry) {
+        CacheEntry* prev = victim->lru_prev;
+        if (victim->pins == 0) {
+            cache_remove(cache, victim);
+            cache->stats.evictions++;
+        }
+        victim = prev;
+    }
+    return entry;
+}
+
+// returns the compiled program for src, compiling it on a miss
+InstructionArr* program_cache_get(ProgramCache* cache, const char* src) {
+    return &program_cache_entry(cache, src)->program;
+}
+
+// like program_cache_get, but the program stays valid until it's released
+CacheEntry* program_cache_acquire(ProgramCache* cache, const char* src) {
+    CacheEntry* entry = program_cache_entry(cache, src);
+    entry->pins++;
+    return entry;
+}
+
+void program_cache_release(ProgramCache* cache, CacheEntry* entry) {
+    (void)cache;
+    entry->pins--;
+}
+
+void program_cache_clear(ProgramCache* cache) {
+    while (cache->lru_tail) {
+        cache_remove(cache, cache->lru_tail);
+    }
+}
+
+void program_cache_free(ProgramCache* cache) {
+    program_cache_clear(cache);
+    free(cache->buckets);
+    free(cache->key_buffer);
+    arena_free(cache->scratch);
+    free(cache);
+}
+
+void print_cache_stats(ProgramCache* cache) {
+    CacheStats* stats = &cache->stats;
+    printf("cache: %llu hits, %llu misses, %llu evictions, %u programs in %zu bytes\n",
+           (unsigned long long)stats->hits, (unsigned long long)stats->misses,
+           (unsigned long long)stats->evictions, stats->entries, stats->bytes);
+}
+
+// process-wide cache, created on first use
+static ProgramCache* global_program_cache = NULL;
+
+ProgramCache* program_cache_global() {
+    if (global_program_cache == NULL) {
+        global_program_cache = program_cache_create(PROGRAM_CACHE_DEFAULT_BUDGET, false);
+    }
+    return global_program_cache;
+}
+
+#endif //_CACHE_H
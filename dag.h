@@ -0,0 +1,486 @@
+#pragma once
+#ifndef _DAG_H
+#define _DAG_H
+
+#include <sched.h>
+
+#include "vm.h"
+#include "pool.h"
+
+// runs a program on every core by the data dependencies between its instructions instead of their order.
+// instructions that touch the same slot or name, directly or through others, form a chain. every function call
+// joins the chain of the one before it, so prints come out in program order. chains are cut into blocks of
+// DAG_BLOCK_SIZE instructions, in program order, and chains shorter than that are packed into shared blocks.
+// a block depends on an earlier block of its chain if it
+// - reads a slot or a name the other one writes (a name is written by binding it)
+// - writes a slot or a name the other one reads or writes, for programs whose slots were reused by allocate_slots
+// a name is read through the slot it's bound to, and bindings follow program order, so they're followed statically
+// like in regalloc.h. blocks become ready when their last dependency finishes and go onto the deque of the worker
+// that finished it. workers take their own newest block first, which keeps a chain on one core, and steal the
+// oldest block of another worker when they run out.
+// if an instruction fails, no new blocks are started, but blocks that don't depend on it may already have run.
+// the analysis starts from no names bound, so a vm that already has bindings works only if the program doesn't
+// write the slots they point to, which holds for programs compiled after it with a var_offset.
+
+#define DAG_BLOCK_SIZE 512
+// cost model, in nanoseconds: waking the pool, scheduling a block, and running an instruction on the switch vm
+#define DAG_START_NS 20000
+#define DAG_BLOCK_NS 300
+#define DAG_INSTRUCTION_NS 20
+
+typedef struct DagBlock {
+    uint32_t first; // into DagProgram.order
+    uint32_t count;
+    uint32_t dependencies;
+    uint32_t first_successor; // into DagProgram.successors
+    uint32_t successor_count;
+} DagBlock;
+
+typedef struct DagProgram {
+    InstructionArr* instructions;
+    // the instructions grouped by block, in program order within one, so a block runs straight through memory.
+    // order has their indices in the program, for the error messages
+    Instruction* code;
+    uint32_t* order;
+    DagBlock* blocks;
+    uint32_t block_count;
+    uint32_t* successors;
+    uint64_t critical_path; // instructions on the longest chain of dependent blocks
+} DagProgram;
+
+// blocks that read something since it was last written, chained per slot or name
+typedef struct DagReader {
+    uint32_t block;
+    int next;
+} DagReader;
+
+typedef struct DagBuilder {
+    // the first pass only joins chains: key -> last instruction that touched it, and a union-find over instructions
+    bool joining;
+    int instruction;
+    int* last_touch;
+    int* chain;
+    uint32_t block;
+    // slot or name -> last block that wrote it and the readers since then, names come after the slots
+    int* last_write;
+    int* readers;
+    DagReader* reader_pool;
+    int reader_count;
+    int reader_capacity;
+    int* bound_slot; // symbol -> slot it's bound to at this point in the program, -1 if unbound
+    uint32_t* seen; // block -> last block that added it as a dependency, plus one
+    uint32_t* edges; // (from, to) pairs
+    uint32_t edge_count;
+    uint32_t edge_capacity;
+    uint32_t* dependency_count;
+} DagBuilder;
+
+int dag_chain(DagBuilder* b, int i) {
+    while (b->chain[i] != i) {
+        b->chain[i] = b->chain[b->chain[i]];
+        i = b->chain[i];
+    }
+    return i;
+}
+
+void dag_join(DagBuilder* b, int other) {
+    if (other < 0) return;
+    int x = dag_chain(b, b->instruction), y = dag_chain(b, other);
+    // the earlier instruction stays the root
+    if (x < y) b->chain[y] = x;
+    else b->chain[x] = y;
+}
+
+void dag_depend(DagBuilder* b, int on) {
+    if (on < 0 || (uint32_t)on == b->block || b->seen[on] == b->block + 1) return;
+    b->seen[on] = b->block + 1;
+    if (b->edge_count == b->edge_capacity) {
+        b->edge_capacity *= 2;
+        b->edges = realloc(b->edges, b->edge_capacity * 2 * sizeof(uint32_t));
+    }
+    b->edges[b->edge_count * 2] = (uint32_t)on;
+    b->edges[b->edge_count * 2 + 1] = b->block;
+    b->edge_count++;
+    b->dependency_count[b->block]++;
+}
+
+void dag_read(DagBuilder* b, int key) {
+    if (b->joining) {
+        dag_join(b, b->last_touch[key]);
+        b->last_touch[key] = b->instruction;
+        return;
+    }
+    dag_depend(b, b->last_write[key]);
+    // a block only needs to be listed once per write
+    int head = b->readers[key];
+    if (head >= 0 && b->reader_pool[head].block == b->block) return;
+    if (b->reader_count == b->reader_capacity) {
+        b->reader_capacity *= 2;
+        b->reader_pool = realloc(b->reader_pool, b->reader_capacity * sizeof(DagReader));
+    }
+    b->reader_pool[b->reader_count].block = b->block;
+    b->reader_pool[b->reader_count].next = head;
+    b->readers[key] = b->reader_count++;
+}
+
+void dag_write(DagBuilder* b, int key) {
+    if (b->joining) {
+        dag_read(b, key);
+        return;
+    }
+    dag_depend(b, b->last_write[key]);
+    for (int r = b->readers[key]; r >= 0; r = b->reader_pool[r].next) {
+        dag_depend(b, (int)b->reader_pool[r].block);
+    }
+    b->readers[key] = -1;
+    b->last_write[key] = (int)b->block;
+}
+
+void dag_read_data(DagBuilder* b, Data d, uint32_t frame_size) {
+    if (d.type == VARIABLE && d.data.variable >= 0) {
+        dag_read(b, d.data.variable);
+    } else if (d.type == IDENTIFIER) {
+        dag_read(b, (int)frame_size + d.data.ident.symbol);
+        if (b->bound_slot[d.data.ident.symbol] >= 0) dag_read(b, b->bound_slot[d.data.ident.symbol]);
+    } else if (d.type == ARGLIST) {
+        for (int i = 0; i < d.data.arglist.len; i++) {
+            dag_read_data(b, d.data.arglist.args[i], frame_size);
+        }
+    }
+}
+
+// one pass over the program, either joining chains or collecting the dependencies between blocks
+void dag_scan(DagBuilder* b, InstructionArr* instructions, uint32_t* block_of, uint32_t frame_size) {
+    uint32_t symbol_total = symbol_count();
+    for (uint32_t k = 0; k < frame_size + symbol_total; k++) {
+        b->last_touch[k] = -1;
+        b->last_write[k] = -1;
+        b->readers[k] = -1;
+    }
+    for (uint32_t s = 0; s < symbol_total; s++) {
+        b->bound_slot[s] = -1;
+    }
+    int last_call = -1;
+    for (int i = 0; i < instructions->size; i++) {
+        b->instruction = i;
+        if (!b->joining) b->block = block_of[i];
+        Instruction* instr = &instructions->data[i];
+        switch (instr->type) {
+            case BINARY:
+                if (instr->data.binary.op == CALL) {
+                    if (b->joining) dag_join(b, last_call);
+                    last_call = i;
+                } else if (instr->data.binary.op != ASSIGN) {
+                    dag_read_data(b, instr->data.binary.left, frame_size);
+                }
+                dag_read_data(b, instr->data.binary.right, frame_size);
+                break;
+            case UNARY:
+                dag_read_data(b, instr->data.unary.operand, frame_size);
+                break;
+            case SET:
+                dag_read_data(b, instr->data.set, frame_size);
+                break;
+        }
+        bool assign = instr->type == BINARY && instr->data.binary.op == ASSIGN;
+        // renaming a slot doesn't write it
+        if (instr->out >= 0 && !(assign && instr->data.binary.right.type == VARIABLE)) {
+            dag_write(b, instr->out);
+        }
+        if (assign && instr->data.binary.left.type == IDENTIFIER) {
+            int symbol = instr->data.binary.left.data.ident.symbol;
+            dag_write(b, (int)frame_size + symbol);
+            Data right = instr->data.binary.right;
+            b->bound_slot[symbol] = right.type == VARIABLE ? right.data.variable : instr->out;
+        }
+    }
+}
+
+DagProgram* dag_prepare(InstructionArr* instructions) {
+    int n = instructions->size;
+    uint32_t frame_size = instructions_frame_size(instructions);
+    uint32_t keys = frame_size + symbol_count();
+    DagBuilder b = {
+            .joining = true,
+            .last_touch = malloc((keys + 1) * sizeof(int)),
+            .chain = malloc((n + 1) * sizeof(int)),
+            .last_write = malloc((keys + 1) * sizeof(int)),
+            .readers = malloc((keys + 1) * sizeof(int)),
+            .reader_pool = malloc(1024 * sizeof(DagReader)),
+            .reader_count = 0,
+            .reader_capacity = 1024,
+            .bound_slot = malloc((symbol_count() + 1) * sizeof(int)),
+            .edges = malloc(1024 * 2 * sizeof(uint32_t)),
+            .edge_count = 0,
+            .edge_capacity = 1024,
+    };
+    for (int i = 0; i < n; i++) {
+        b.chain[i] = i;
+    }
+    dag_scan(&b, instructions, NULL, frame_size);
+
+    // chain lengths, then blocks: a long chain gets blocks of its own, short ones share the current shared block.
+    // a chain's blocks are numbered in program order, so every dependency goes to a lower block
+    uint32_t* length = calloc(n + 1, sizeof(uint32_t));
+    int* chain_block = malloc((n + 1) * sizeof(int));
+    uint32_t* block_size = malloc((n + 1) * sizeof(uint32_t));
+    uint32_t* block_of = malloc((n + 1) * sizeof(uint32_t));
+    for (int i = 0; i < n; i++) {
+        length[dag_chain(&b, i)]++;
+        chain_block[i] = -1;
+    }
+    uint32_t block_count = 0;
+    int shared = -1;
+    uint32_t shared_reserved = 0;
+    for (int i = 0; i < n; i++) {
+        int root = dag_chain(&b, i);
+        if (length[root] >= DAG_BLOCK_SIZE) {
+            if (chain_block[root] < 0 || block_size[chain_block[root]] == DAG_BLOCK_SIZE) {
+                block_size[block_count] = 0;
+                chain_block[root] = (int)block_count++;
+            }
+        } else if (chain_block[root] < 0) {
+            if (shared < 0 || shared_reserved + length[root] > DAG_BLOCK_SIZE) {
+                block_size[block_count] = 0;
+                shared = (int)block_count++;
+                shared_reserved = 0;
+            }
+            shared_reserved += length[root];
+            chain_block[root] = shared;
+        }
+        block_of[i] = (uint32_t)chain_block[root];
+        block_size[block_of[i]]++;
+    }
+
+    DagProgram* program = malloc(sizeof(DagProgram));
+    program->instructions = instructions;
+    program->block_count = block_count;
+    program->blocks = calloc(block_count + 1, sizeof(DagBlock));
+    program->code = malloc((n + 1) * sizeof(Instruction));
+    program->order = malloc((n + 1) * sizeof(uint32_t));
+    uint32_t offset = 0;
+    for (uint32_t k = 0; k < block_count; k++) {
+        program->blocks[k].first = offset;
+        offset += block_size[k];
+    }
+    for (int i = 0; i < n; i++) {
+        DagBlock* block = &program->blocks[block_of[i]];
+        program->code[block->first + block->count] = instructions->data[i];
+        program->order[block->first + block->count++] = (uint32_t)i;
+    }
+
+    b.joining = false;
+    b.seen = calloc(block_count + 1, sizeof(uint32_t));
+    b.dependency_count = calloc(block_count + 1, sizeof(uint32_t));
+    dag_scan(&b, instructions, block_of, frame_size);
+
+    // successors, grouped per block
+    program->successors = malloc((b.edge_count + 1) * sizeof(uint32_t));
+    uint32_t* fill = calloc(block_count + 1, sizeof(uint32_t));
+    for (uint32_t e = 0; e < b.edge_count; e++) {
+        program->blocks[b.edges[e * 2]].successor_count++;
+    }
+    offset = 0;
+    for (uint32_t k = 0; k < block_count; k++) {
+        program->blocks[k].dependencies = b.dependency_count[k];
+        program->blocks[k].first_successor = offset;
+        offset += program->blocks[k].successor_count;
+    }
+    for (uint32_t e = 0; e < b.edge_count; e++) {
+        DagBlock* from = &program->blocks[b.edges[e * 2]];
+        program->successors[from->first_successor + fill[b.edges[e * 2]]++] = b.edges[e * 2 + 1];
+    }
+
+    // block numbers are a topological order
+    uint64_t* longest = calloc(block_count + 1, sizeof(uint64_t));
+    program->critical_path = 0;
+    for (uint32_t k = 0; k < block_count; k++) {
+        DagBlock* block = &program->blocks[k];
+        longest[k] += block->count;
+        if (longest[k] > program->critical_path) program->critical_path = longest[k];
+        for (uint32_t s = 0; s < block->successor_count; s++) {
+            uint32_t next = program->successors[block->first_successor + s];
+            if (longest[k] > longest[next]) longest[next] = longest[k];
+        }
+    }
+
+    free(longest);
+    free(fill);
+    free(length);
+    free(chain_block);
+    free(block_size);
+    free(block_of);
+    free(b.last_touch);
+    free(b.chain);
+    free(b.last_write);
+    free(b.readers);
+    free(b.reader_pool);
+    free(b.bound_slot);
+    free(b.seen);
+    free(b.edges);
+    free(b.dependency_count);
+    return program;
+}
+
+void dag_program_free(DagProgram* program) {
+    free(program->code);
+    free(program->order);
+    free(program->blocks);
+    free(program->successors);
+    free(program);
+}
+
+// whether running on threads is expected to beat vm_execute, from the size of the program and its critical path
+bool dag_worth_it(DagProgram* program, uint32_t threads) {
+    if (threads <= 1 || program->block_count <= 1) return false;
+    uint64_t total = (uint64_t)program->instructions->size;
+    uint64_t per_thread = total / threads;
+    uint64_t span = program->critical_path > per_thread ? program->critical_path : per_thread;
+    uint64_t serial_ns = total * DAG_INSTRUCTION_NS;
+    uint64_t parallel_ns = DAG_START_NS + (uint64_t)program->block_count * DAG_BLOCK_NS + span * DAG_INSTRUCTION_NS;
+    return parallel_ns < serial_ns;
+}
+
+// a worker's ready blocks. the owner pushes and pops at the bottom, thieves take from the top
+typedef struct DagDeque {
+    atomic_flag lock;
+    uint32_t* items;
+    uint32_t top;
+    uint32_t bottom;
+} DagDeque;
+
+typedef struct DagRun {
+    DagProgram* program;
+    InstrVM* vm;
+    DagDeque* deques;
+    uint32_t worker_count;
+    atomic_uint* pending; // block -> dependencies that haven't finished
+    atomic_uint remaining;
+    atomic_bool failed;
+} DagRun;
+
+void dag_deque_lock(DagDeque* deque) {
+    while (atomic_flag_test_and_set_explicit(&deque->lock, memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+void dag_deque_unlock(DagDeque* deque) {
+    atomic_flag_clear_explicit(&deque->lock, memory_order_release);
+}
+
+void dag_push(DagDeque* deque, uint32_t block) {
+    dag_deque_lock(deque);
+    deque->items[deque->bottom++] = block;
+    dag_deque_unlock(deque);
+}
+
+bool dag_pop(DagDeque* deque, uint32_t* block) {
+    bool found = false;
+    dag_deque_lock(deque);
+    if (deque->bottom > deque->top) {
+        *block = deque->items[--deque->bottom];
+        found = true;
+    }
+    dag_deque_unlock(deque);
+    return found;
+}
+
+bool dag_steal(DagDeque* deque, uint32_t* block) {
+    bool found = false;
+    dag_deque_lock(deque);
+    if (deque->bottom > deque->top) {
+        *block = deque->items[deque->top++];
+        found = true;
+    }
+    dag_deque_unlock(deque);
+    return found;
+}
+
+void dag_worker(void* ctx, uint32_t index, uint32_t thread) {
+    (void)thread;
+    DagRun* run = ctx;
+    DagProgram* program = run->program;
+    DagDeque* own = &run->deques[index];
+    while (atomic_load_explicit(&run->remaining, memory_order_acquire) > 0 &&
+           !atomic_load_explicit(&run->failed, memory_order_relaxed)) {
+        uint32_t k;
+        bool found = dag_pop(own, &k);
+        for (uint32_t v = 1; !found && v < run->worker_count; v++) {
+            found = dag_steal(&run->deques[(index + v) % run->worker_count], &k);
+        }
+        if (!found) {
+            sched_yield();
+            continue;
+        }
+        DagBlock* block = &program->blocks[k];
+        for (uint32_t at = block->first; at < block->first + block->count; at++) {
+            if (!vm_step(run->vm, program->code[at], (int)program->order[at])) {
+                atomic_store(&run->failed, true);
+                break;
+            }
+        }
+        for (uint32_t s = 0; s < block->successor_count; s++) {
+            uint32_t next = program->successors[block->first_successor + s];
+            if (atomic_fetch_sub_explicit(&run->pending[next], 1, memory_order_acq_rel) == 1) {
+                dag_push(own, next);
+            }
+        }
+        atomic_fetch_sub_explicit(&run->remaining, 1, memory_order_acq_rel);
+    }
+}
+
+// runs the program on the pool whatever the cost model says, false if an instruction failed.
+// vm must have been prepared for the instructions
+bool dag_execute(DagProgram* program, InstrVM* vm, ThreadPool* pool) {
+    DagRun run = {
+            .program = program,
+            .vm = vm,
+            .deques = malloc(pool->thread_count * sizeof(DagDeque)),
+            .worker_count = pool->thread_count,
+            .pending = malloc((program->block_count + 1) * sizeof(atomic_uint)),
+    };
+    atomic_init(&run.remaining, program->block_count);
+    atomic_init(&run.failed, false);
+    for (uint32_t w = 0; w < run.worker_count; w++) {
+        atomic_flag_clear(&run.deques[w].lock);
+        run.deques[w].items = malloc((program->block_count + 1) * sizeof(uint32_t));
+        run.deques[w].top = 0;
+        run.deques[w].bottom = 0;
+    }
+    for (uint32_t k = 0; k < program->block_count; k++) {
+        atomic_init(&run.pending[k], program->blocks[k].dependencies);
+    }
+    // blocks without dependencies are dealt out round robin, last first, so every worker pops its earliest one first
+    uint32_t dealt = 0;
+    for (uint32_t k = program->block_count; k-- > 0;) {
+        if (program->blocks[k].dependencies == 0) {
+            DagDeque* deque = &run.deques[dealt++ % run.worker_count];
+            deque->items[deque->bottom++] = k;
+        }
+    }
+
+    print_output.parallel = pool->thread_count > 1;
+    pool_run(pool, run.worker_count, dag_worker, &run);
+    print_output.parallel = false;
+
+    bool ok = !atomic_load(&run.failed);
+    for (uint32_t w = 0; w < run.worker_count; w++) {
+        free(run.deques[w].items);
+    }
+    free(run.deques);
+    free(run.pending);
+    return ok;
+}
+
+// vm_execute, on the pool when the cost model says it pays off. with stats on it's always vm_execute,
+// so every instruction is profiled
+bool dag_run(DagProgram* program, InstrVM* vm, ThreadPool* pool) {
+    if (pool == NULL) pool = pool_global();
+    if (stats_enabled || !dag_worth_it(program, pool->thread_count)) {
+        return vm_execute(vm, program->instructions);
+    }
+    return dag_execute(program, vm, pool);
+}
+
+#endif //_DAG_H
@@ -6,90 +6,118 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
 
 #define fail(msg) printf("ERROR (line %d in '%s'): %s\n", __LINE__, __FILE__, msg);
 
+// growable array of `type`: the struct is just the buffer, its size and its capacity (16 bytes), and every operation
+// is a static inline function named after the array, like push##name, so calls are direct and can be inlined.
+// a new array owns no buffer until the first element comes in.
+// index checks in get, set, pop and remove are only compiled in with DYNARR_CHECKS.
+
+#define DYNARR_MIN_CAPACITY 10
+
+#ifdef DYNARR_CHECKS
+#define DYNARR_CHECK(cond, msg) if (!(cond)) { fail(msg); }
+#else
+#define DYNARR_CHECK(cond, msg)
+#endif
+
 #define dynarr(name, type)                                                                                                                           \
     struct name {                                                                                                                                    \
         type* data;                                                                                                                                  \
         int size;                                                                                                                                    \
         int capacity;                                                                                                                                \
-        void (*push)(struct name*, type);                                                                                                            \
-        type (*pop)(struct name*);                                                                                                                   \
-        type (*get)(struct name*, int);                                                                                                              \
-        void (*set)(struct name*, int, type);                                                                                                        \
-        void (*clear)(struct name*);                                                                                                                 \
-        void (*del)(struct name*);                                                                                                                   \
-        type (*remove)(struct name*, int);                                                                                                           \
-        struct name* (*copy)(struct name*);                                                                                                          \
     };                                                                                                                                               \
-    void push##name(struct name* t, type i) {                                                                                                 \
-        if (t->size == t->capacity) {                                                                                                                \
-            t->capacity *= 2;                                                                                                                        \
-            t->data = (type*)realloc(t->data, t->capacity * sizeof(type));                                                                           \
-            if (t->data == NULL) {                                                                                                                   \
-                fail("Out of memory!");                                                                                                              \
-            }                                                                                                                                        \
+    /* grows to at least `needed`, doubling so that pushes stay amortized O(1). false, and t unchanged, when out of memory */                        \
+    static bool grow##name(struct name* t, int needed) {                                                                                             \
+        int capacity = t->capacity ? t->capacity * 2 : DYNARR_MIN_CAPACITY;                                                                          \
+        if (capacity < needed) capacity = needed;                                                                                                    \
+        type* data = (type*)realloc(t->data, (size_t)capacity * sizeof(type));                                                                       \
+        if (data == NULL) {                                                                                                                          \
+            fail("Out of memory!");                                                                                                                  \
+            return false;                                                                                                                            \
         }                                                                                                                                            \
-        t->data[t->size] = i;                                                                                                                        \
-        t->size++;                                                                                                                                   \
-    }                                                                                                                                              \
-    type pop##name(struct name* t) {                                                                                                          \
-        if (t->size == 0) {                                                                                                                          \
-            fail("Cannot pop from an empty vector!");                                                                                                \
-        }                                                                                                                                            \
-        t->size--;                                                                                                                                   \
-        return t->data[t->size];                                                                                                                     \
-    }                                                                                                                                              \
-    type get##name(struct name* t, int i) {                                                                                                   \
-        if (i < 0 || i >= t->size) {                                                                                                                 \
-            fail("Index out of bounds!");                                                                                                            \
+        if (stats_enabled) exec_stats.heap_allocs++;                                                                                                 \
+        t->data = data;                                                                                                                              \
+        t->capacity = capacity;                                                                                                                      \
+        return true;                                                                                                                                 \
+    }                                                                                                                                                \
+    /* makes room for `capacity` elements in total, without the doubling */                                                                          \
+    static inline bool reserve##name(struct name* t, int capacity) {                                                                                 \
+        if (capacity <= t->capacity) return true;                                                                                                    \
+        type* data = (type*)realloc(t->data, (size_t)capacity * sizeof(type));                                                                       \
+        if (data == NULL) {                                                                                                                          \
+            fail("Out of memory!");                                                                                                                  \
+            return false;                                                                                                                            \
         }                                                                                                                                            \
+        if (stats_enabled) exec_stats.heap_allocs++;                                                                                                 \
+        t->data = data;                                                                                                                              \
+        t->capacity = capacity;                                                                                                                      \
+        return true;                                                                                                                                 \
+    }                                                                                                                                                \
+    /* false, and nothing added, when the array couldn't grow */                                                                                     \
+    static inline bool push##name(struct name* t, type i) {                                                                                          \
+        if (t->size == t->capacity && !grow##name(t, t->size + 1)) return false;                                                                     \
+        t->data[t->size++] = i;                                                                                                                      \
+        return true;                                                                                                                                 \
+    }                                                                                                                                                \
+    /* copies `count` elements to the end with a single memcpy, or none of them if the array couldn't grow */                                        \
+    static inline bool append##name(struct name* t, const type* items, int count) {                                                                  \
+        if (count <= 0) return true;                                                                                                                 \
+        if (t->size + count > t->capacity && !grow##name(t, t->size + count)) return false;                                                          \
+        memcpy(t->data + t->size, items, (size_t)count * sizeof(type));                                                                              \
+        t->size += count;                                                                                                                            \
+        return true;                                                                                                                                 \
+    }                                                                                                                                                \
+    static inline type pop##name(struct name* t) {                                                                                                   \
+        DYNARR_CHECK(t->size > 0, "Cannot pop from an empty vector!");                                                                               \
+        return t->data[--t->size];                                                                                                                   \
+    }                                                                                                                                                \
+    static inline type get##name(struct name* t, int i) {                                                                                            \
+        DYNARR_CHECK(i >= 0 && i < t->size, "Index out of bounds!");                                                                                 \
         return t->data[i];                                                                                                                           \
-    }                                                                                                                                              \
-    void set##name(struct name* t, int i, type v) {                                                                                           \
-        if (i < 0 || i >= t->size) {                                                                                                                 \
-            fail("Index out of bounds!");                                                                                                            \
-        }                                                                                                                                            \
+    }                                                                                                                                                \
+    static inline void set##name(struct name* t, int i, type v) {                                                                                    \
+        DYNARR_CHECK(i >= 0 && i < t->size, "Index out of bounds!");                                                                                 \
         t->data[i] = v;                                                                                                                              \
-    }                                                                                                                                              \
-    void clear##name(struct name* t) { t->size = 0; }                                                                                       \
-    void del##name(struct name* t) {                                                                                                          \
-        free(t->data);                                                                                                                               \
-        free(t);                                                                                                                                     \
-    }                                                                                                                                              \
-    type remove##name(struct name* t, int i) {                                                                                                \
-        if (i < 0 || i >= t->size) {                                                                                                                 \
-            fail("Index out of bounds!");                                                                                                            \
-        }                                                                                                                                            \
+    }                                                                                                                                                \
+    static inline void clear##name(struct name* t) { t->size = 0; }                                                                                  \
+    static inline type remove##name(struct name* t, int i) {                                                                                         \
+        DYNARR_CHECK(i >= 0 && i < t->size, "Index out of bounds!");                                                                                 \
         type v = t->data[i];                                                                                                                         \
-        for (int j = i; j < t->size - 1; j++) {                                                                                                      \
-            t->data[j] = t->data[j + 1];                                                                                                             \
-        }                                                                                                                                            \
+        memmove(t->data + i, t->data + i + 1, (size_t)(t->size - i - 1) * sizeof(type));                                                             \
         t->size--;                                                                                                                                   \
         return v;                                                                                                                                    \
-    }                                                                                                                                              \
-    struct name* new##name();                                                                                                                        \
-    struct name* copy##name(struct name* in) {                                                                                                \
-        struct name* out = new##name();                                                                                                              \
-        for (int i = 0; i < in->size; i++) {                                                                                                         \
-            out->push(out, in->get(in, i));                                                                                                          \
-        }                                                                                                                                            \
-        return out;                                                                                                                                  \
-    }                                                                                                                                              \
-    struct name* new##name() {                                                                                                                \
+    }                                                                                                                                                \
+    /* hands the buffer to the caller, who frees it, and leaves t empty */                                                                           \
+    static inline type* release##name(struct name* t) {                                                                                              \
+        type* data = t->data;                                                                                                                        \
+        t->data = NULL;                                                                                                                              \
+        t->size = 0;                                                                                                                                 \
+        t->capacity = 0;                                                                                                                             \
+        return data;                                                                                                                                 \
+    }                                                                                                                                                \
+    /* t takes over the buffer of `from`, no copy, and `from` is left empty */                                                                       \
+    static inline void take##name(struct name* t, struct name* from) {                                                                               \
+        free(t->data);                                                                                                                               \
+        t->data = from->data;                                                                                                                        \
+        t->size = from->size;                                                                                                                        \
+        t->capacity = from->capacity;                                                                                                                \
+        release##name(from);                                                                                                                         \
+    }                                                                                                                                                \
+    static inline struct name* new##name() {                                                                                                         \
         struct name* t = (struct name*)malloc(sizeof(struct name));                                                                                  \
-        t->data = (type*)malloc(10 * sizeof(type));                                                                                                  \
+        t->data = NULL;                                                                                                                              \
         t->size = 0;                                                                                                                                 \
-        t->capacity = 10;                                                                                                                            \
-        t->push = &push##name;                                                                                                                       \
-        t->pop = &pop##name;                                                                                                                         \
-        t->get = &get##name;                                                                                                                         \
-        t->set = &set##name;                                                                                                                         \
-        t->clear = &clear##name;                                                                                                                     \
-        t->del = &del##name;                                                                                                                         \
-        t->remove = &remove##name;                                                                                                                   \
+        t->capacity = 0;                                                                                                                             \
         return t;                                                                                                                                    \
+    }                                                                                                                                                \
+    static inline void del##name(struct name* t) {                                                                                                   \
+        free(t->data);                                                                                                                               \
+        free(t);                                                                                                                                     \
     }
 
 
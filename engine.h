@@ -0,0 +1,120 @@
+#pragma once
+#ifndef _ENGINE_H
+#define _ENGINE_H
+
+#include "vm.h"
+#include "bytecode.h"
+#include "threaded.h"
+#include "jit.h"
+#include "dag.h"
+
+// picks how an InstructionArr gets executed, so the engines can be compared on the same program
+
+typedef enum VmEngine {
+    ENGINE_SWITCH, // run_instructions, straight off the InstructionArr
+    ENGINE_BYTECODE, // switch loop over BcInstr
+    ENGINE_THREADED, // direct-threaded dispatch over pre-decoded BcInstr
+    ENGINE_JIT, // x86-64 machine code, falls back to ENGINE_THREADED where there is no jit
+    ENGINE_PARALLEL // the switch vm over the dependency graph on every core, or serially where that doesn't pay
+} VmEngine;
+
+static const char* engine_names[] = {
+        [ENGINE_SWITCH] = "switch",
+        [ENGINE_BYTECODE] = "bytecode",
+        [ENGINE_THREADED] = "threaded",
+        [ENGINE_JIT] = "jit",
+        [ENGINE_PARALLEL] = "parallel",
+};
+
+bool engine_from_name(const char* name, VmEngine* engine) {
+    for (int i = 0; i < (int)(sizeof(engine_names) / sizeof(engine_names[0])); i++) {
+        if (strcmp(engine_names[i], name) == 0) {
+            *engine = (VmEngine)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// a program prepared for one engine, so the lowering cost isn't paid on every run
+typedef struct EngineProgram {
+    VmEngine engine;
+    InstructionArr* instructions;
+    BcProgram* bytecode;
+    ThreadedProgram* threaded;
+    JitProgram* jit;
+    DagProgram* dag;
+} EngineProgram;
+
+// returns NULL if the program can't be lowered for the engine
+EngineProgram* engine_prepare(InstructionArr* instructions, VmEngine engine) {
+    EngineProgram* program = malloc(sizeof(EngineProgram));
+    program->engine = engine;
+    program->instructions = instructions;
+    program->bytecode = NULL;
+    program->threaded = NULL;
+    program->jit = NULL;
+    program->dag = NULL;
+    if (engine == ENGINE_PARALLEL) {
+        program->dag = dag_prepare(instructions);
+    } else if (engine != ENGINE_SWITCH) {
+        program->bytecode = bc_compile(instructions);
+        if (program->bytecode == NULL) {
+            free(program);
+            return NULL;
+        }
+        if (engine == ENGINE_JIT) {
+            program->jit = jit_compile(program->bytecode);
+            if (program->jit) {
+                program->bytecode = NULL;
+            } else {
+                program->engine = engine = ENGINE_THREADED;
+            }
+        }
+        if (engine == ENGINE_THREADED) {
+            program->threaded = threaded_compile(program->bytecode);
+            program->bytecode = NULL;
+        }
+    }
+    return program;
+}
+
+void engine_run(EngineProgram* program) {
+    // the switch engine is timed, and profiled per op, by vm_execute itself. so is parallel, which runs on it with stats on
+    double start = stats_enabled ? stats_now() : 0;
+    switch (program->engine) {
+        case ENGINE_SWITCH:
+            run_instructions(program->instructions);
+            break;
+        case ENGINE_BYTECODE:
+            run_bytecode(program->bytecode);
+            break;
+        case ENGINE_THREADED:
+            run_threaded(program->threaded);
+            break;
+        case ENGINE_JIT:
+            run_jit(program->jit);
+            break;
+        case ENGINE_PARALLEL: {
+            InstrVM* vm = vm_create(program->instructions);
+            dag_run(program->dag, vm, NULL);
+            vm_free(vm);
+            output_flush();
+            break;
+        }
+    }
+    if (stats_enabled && program->engine != ENGINE_SWITCH && program->engine != ENGINE_PARALLEL) {
+        stats_add_time(STATS_EXECUTE, stats_now() - start);
+    }
+}
+
+// the instructions still belong to the caller
+void engine_program_free(EngineProgram* program) {
+    if (program->bytecode) bc_program_free(program->bytecode);
+    if (program->threaded) threaded_program_free(program->threaded);
+    if (program->jit) jit_program_free(program->jit);
+    if (program->dag) dag_program_free(program->dag);
+    free(program);
+}
+
+#endif //_ENGINE_H
@@ -0,0 +1,303 @@
+#pragma once
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode.h"
+#include "optimize.h"
+#include "parallel.h"
+#include "regalloc.h"
+#include "stream.h"
+
+// precompiled programs on disk, so a process can run a script without lexing, parsing or compiling it.
+// an image is a BcProgram written out as is: bytecode operands are register indices, the constant pool and
+// the print arguments are flat arrays, so nothing in it is a pointer. the names of the variables are kept in a
+// string table next to the register each one ends up in.
+// the file is a header followed by its sections, each 8-byte aligned:
+//   code       BcInstr[code_count]
+//   constants  double[constant_count]
+//   args       uint32_t[arg_count]
+//   symbols    int32_t[symbol_count], the register of every name once the program has run, -1 if unbound
+//   names      uint32_t[symbol_count], offset of every name in the strings
+//   strings    char[string_bytes], the names, each ending in '\0'
+// image_load maps the file and runs the bytecode straight out of the mapping. the sections are checked once when
+// it's loaded, so a truncated or corrupt file is an error instead of a wild read, but nothing is copied or patched.
+// numbers are stored in the byte order of the machine that wrote them, a file from the other order is rejected.
+
+#define IMAGE_MAGIC "EXPRIMG"
+#define IMAGE_VERSION 2
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+typedef struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint32_t frame_size;
+    uint32_t code_count;
+    uint32_t constant_count;
+    uint32_t arg_count;
+    uint32_t symbol_count;
+    uint32_t string_bytes;
+    uint32_t pad;
+    uint64_t code_offset;
+    uint64_t constants_offset;
+    uint64_t args_offset;
+    uint64_t symbols_offset;
+    uint64_t names_offset;
+    uint64_t strings_offset;
+    uint64_t file_size;
+} ImageHeader;
+
+// a loaded image. program is a BcProgram whose arrays point into the mapping, so it runs on anything that
+// takes a BcProgram and only reads it. it must not be freed with bc_program_free
+typedef struct ProgramImage {
+    void* map;
+    size_t size;
+    BcProgram program;
+    BcInstrArr code;
+    DoubleArr constants;
+    RegArr args;
+    RegArr inputs;
+    const uint32_t* names;
+    const char* strings;
+} ProgramImage;
+
+uint64_t image_align(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+bool image_write_section(FILE* out, uint64_t* at, uint64_t offset, const void* data, size_t bytes) {
+    static const char zeros[8] = {0};
+    if (offset > *at && fwrite(zeros, 1, offset - *at, out) != offset - *at) return false;
+    if (bytes > 0 && fwrite(data, 1, bytes, out) != bytes) return false;
+    *at = offset + bytes;
+    return true;
+}
+
+// writes a program made by bc_compile, with the names of the process-wide symbol table
+bool image_write(BcProgram* program, const char* path) {
+    if (program->inputs->size > 0) {
+        printf("ERROR: a program with free inputs can't be saved as an image\n");
+        return false;
+    }
+    // the errors name symbols of this process
+    for (int i = 0; i < program->code->size; i++) {
+        BcInstr* instr = &program->code->data[i];
+        if (instr->op == BC_ERROR) {
+            bc_report_error(instr->out, instr->a, instr->b);
+            printf("ERROR: a program with errors can't be saved as an image\n");
+            return false;
+        }
+    }
+    uint32_t symbol_total = program->symbol_count;
+    uint32_t* names = malloc((symbol_total + 1) * sizeof(uint32_t));
+    uint32_t string_bytes = 0;
+    for (uint32_t s = 0; s < symbol_total; s++) {
+        names[s] = string_bytes;
+        string_bytes += (uint32_t)strlen(symbol_name(s)) + 1;
+    }
+    char* strings = malloc(string_bytes + 1);
+    for (uint32_t s = 0; s < symbol_total; s++) {
+        strcpy(strings + names[s], symbol_name(s));
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.header_size = sizeof(ImageHeader);
+    header.frame_size = program->frame_size;
+    header.code_count = (uint32_t)program->code->size;
+    header.constant_count = (uint32_t)program->constants->size;
+    header.arg_count = (uint32_t)program->args->size;
+    header.symbol_count = symbol_total;
+    header.string_bytes = string_bytes;
+    header.code_offset = image_align(sizeof(ImageHeader));
+    header.constants_offset = image_align(header.code_offset + header.code_count * sizeof(BcInstr));
+    header.args_offset = image_align(header.constants_offset + header.constant_count * sizeof(double));
+    header.symbols_offset = image_align(header.args_offset + header.arg_count * sizeof(uint32_t));
+    header.names_offset = image_align(header.symbols_offset + symbol_total * sizeof(int32_t));
+    header.strings_offset = image_align(header.names_offset + symbol_total * sizeof(uint32_t));
+    header.file_size = header.strings_offset + string_bytes;
+
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        printf("ERROR: cannot write '%s'\n", path);
+        free(names);
+        free(strings);
+        return false;
+    }
+    uint64_t at = 0;
+    bool ok = image_write_section(out, &at, 0, &header, sizeof(header)) &&
+              image_write_section(out, &at, header.code_offset, program->code->data,
+                                  header.code_count * sizeof(BcInstr)) &&
+              image_write_section(out, &at, header.constants_offset, program->constants->data,
+                                  header.constant_count * sizeof(double)) &&
+              image_write_section(out, &at, header.args_offset, program->args->data,
+                                  header.arg_count * sizeof(uint32_t)) &&
+              image_write_section(out, &at, header.symbols_offset, program->symbol_regs,
+                                  symbol_total * sizeof(int32_t)) &&
+              image_write_section(out, &at, header.names_offset, names, symbol_total * sizeof(uint32_t)) &&
+              image_write_section(out, &at, header.strings_offset, strings, string_bytes);
+    if (fclose(out) != 0) ok = false;
+    if (!ok) printf("ERROR: failed writing '%s'\n", path);
+    free(names);
+    free(strings);
+    return ok;
+}
+
+// compiles a whole script the way the engines run it (optimized if asked, slots allocated), in parallel when it's
+// long enough, and writes its image. nothing is written if a statement has a syntax error
+bool image_compile(const char* src, const char* path, bool optimize) {
+    Arena* arena = arena_create();
+    bool failed;
+    InstructionArr* instructions = gen_code_parallel_checked(src, arena, NULL, &failed);
+    if (failed) {
+        printf("ERROR: the script has syntax errors, no image written\n");
+        free_instructions(instructions);
+        arena_free(arena);
+        return false;
+    }
+    if (optimize) optimize_instructions(instructions, NULL);
+    allocate_slots(instructions);
+    BcProgram* program = bc_compile(instructions);
+    bool ok = program != NULL && image_write(program, path);
+    if (program) bc_program_free(program);
+    free_instructions(instructions);
+    arena_free(arena);
+    return ok;
+}
+
+// image_compile on a script file, "-" is stdin
+bool image_compile_file(const char* script, const char* path, bool optimize) {
+    char* src = read_script(script);
+    if (src == NULL) return false;
+    bool ok = image_compile(src, path, optimize);
+    free(src);
+    return ok;
+}
+
+bool image_section_fits(const ImageHeader* header, uint64_t offset, uint64_t count, uint64_t item_size) {
+    return offset % 8 == 0 && offset >= sizeof(ImageHeader) && offset <= header->file_size &&
+           count <= (header->file_size - offset) / item_size;
+}
+
+// everything the bytecode loop trusts: every register inside the frame, every print inside the arguments
+bool image_check(const ProgramImage* image, const ImageHeader* header) {
+    uint64_t registers = (uint64_t)header->frame_size + header->constant_count;
+    for (uint32_t i = 0; i < header->code_count; i++) {
+        const BcInstr* instr = &image->code.data[i];
+        if (instr->op >= BC_ERROR || instr->out >= header->frame_size) return false;
+        if (instr->op == BC_PRINT) {
+            if ((uint64_t)instr->a + instr->b > header->arg_count) return false;
+        } else if (instr->a >= registers || (bc_is_binary(instr->op) && instr->b >= registers)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->arg_count; i++) {
+        if (image->args.data[i] >= registers) return false;
+    }
+    for (uint32_t s = 0; s < header->symbol_count; s++) {
+        int reg = image->program.symbol_regs[s];
+        if (reg < -1 || (reg >= 0 && (uint64_t)reg >= registers)) return false;
+        if (image->names[s] >= header->string_bytes) return false;
+    }
+    return header->string_bytes == 0 || image->strings[header->string_bytes - 1] == '\0';
+}
+
+void image_free(ProgramImage* image) {
+    munmap(image->map, image->size);
+    free(image);
+}
+
+// maps an image written by image_write, NULL (after printing the error) if it can't be used
+ProgramImage* image_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("ERROR: cannot open '%s'\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        printf("ERROR: '%s' is not a program image\n", path);
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("ERROR: cannot map '%s'\n", path);
+        return NULL;
+    }
+    const ImageHeader* header = map;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->byte_order != IMAGE_BYTE_ORDER) {
+        printf("ERROR: '%s' is not a program image\n", path);
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    if (header->version != IMAGE_VERSION || header->header_size != sizeof(ImageHeader)) {
+        printf("ERROR: '%s' is image version %u, expected %u\n", path, header->version, IMAGE_VERSION);
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+
+    ProgramImage* image = malloc(sizeof(ProgramImage));
+    image->map = map;
+    image->size = (size_t)st.st_size;
+    bool fits = header->file_size == image->size &&
+                image_section_fits(header, header->code_offset, header->code_count, sizeof(BcInstr)) &&
+                image_section_fits(header, header->constants_offset, header->constant_count, sizeof(double)) &&
+                image_section_fits(header, header->args_offset, header->arg_count, sizeof(uint32_t)) &&
+                image_section_fits(header, header->symbols_offset, header->symbol_count, sizeof(int32_t)) &&
+                image_section_fits(header, header->names_offset, header->symbol_count, sizeof(uint32_t)) &&
+                image_section_fits(header, header->strings_offset, header->string_bytes, 1);
+    if (!fits) {
+        printf("ERROR: '%s' is truncated or corrupt\n", path);
+        image_free(image);
+        return NULL;
+    }
+    const char* base = map;
+    image->code = (BcInstrArr){ (BcInstr*)(base + header->code_offset), (int)header->code_count, 0 };
+    image->constants = (DoubleArr){ (double*)(base + header->constants_offset), (int)header->constant_count, 0 };
+    image->args = (RegArr){ (uint32_t*)(base + header->args_offset), (int)header->arg_count, 0 };
+    image->inputs = (RegArr){ NULL, 0, 0 };
+    image->names = (const uint32_t*)(base + header->names_offset);
+    image->strings = base + header->strings_offset;
+    image->program = (BcProgram){
+            .code = &image->code,
+            .constants = &image->constants,
+            .args = &image->args,
+            .inputs = &image->inputs,
+            .symbol_regs = (int*)(base + header->symbols_offset),
+            .symbol_count = header->symbol_count,
+            .frame_size = header->frame_size,
+    };
+    if (!image_check(image, header)) {
+        printf("ERROR: '%s' is truncated or corrupt\n", path);
+        image_free(image);
+        return NULL;
+    }
+    return image;
+}
+
+// symbols of an image are its own, not the process-wide ones
+uint32_t image_symbol_count(const ProgramImage* image) {
+    return image->program.symbol_count;
+}
+
+const char* image_symbol_name(const ProgramImage* image, uint32_t symbol) {
+    return image->strings + image->names[symbol];
+}
+
+// runs the image in a fresh frame, like run_bytecode
+void image_run(ProgramImage* image) {
+    run_bytecode(&image->program);
+}
+
+#endif //_IMAGE_H
@@ -0,0 +1,265 @@
+#pragma once
+#ifndef _JIT_H
+#define _JIT_H
+
+#include "bytecode.h"
+
+// x86-64 jit: lowers bytecode to SSE2 machine code in an mmap'd buffer.
+// the generated function takes the register file (frame, then constants, then inputs) in rdi and keeps it in rbx.
+// registers stay in that memory frame, but xmm0 is tracked across instructions so a result that feeds the very
+// next instruction isn't loaded again. print calls back into jit_print, and the math that has no sse2 instruction
+// into jit_math, which also prints the errors.
+// jit_compile returns NULL on other platforms, and callers fall back to an interpreter.
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+typedef void (*JitFn)(double* regs);
+
+typedef struct JitProgram {
+    BcProgram* bytecode; // owns the constants and print arguments the code points into
+    JitFn fn;
+    void* code;
+    size_t code_capacity;
+    size_t code_size;
+} JitProgram;
+
+void jit_print(double* regs, const uint32_t* args, uint32_t count, uint32_t out) {
+    output_registers(regs, args, count);
+    regs[out] = 0;
+}
+
+// pow, exp, log, sin and cos, through the same functions the interpreters use, and the errors
+void jit_math(double* regs, uint32_t op, uint32_t out, uint32_t a, uint32_t b) {
+    switch ((BcOp)op) {
+        case BC_POW: regs[out] = pow(regs[a], regs[b]); break;
+        case BC_EXP: regs[out] = exp(regs[a]); break;
+        case BC_LOG: regs[out] = log(regs[a]); break;
+        case BC_SIN: regs[out] = sin(regs[a]); break;
+        case BC_COS: regs[out] = cos(regs[a]); break;
+        case BC_ERROR: bc_report_error(out, a, b); break;
+        default: break;
+    }
+}
+
+void jit_program_free(JitProgram* program) {
+#if JIT_SUPPORTED
+    if (program->code) munmap(program->code, program->code_capacity);
+#endif
+    bc_program_free(program->bytecode);
+    free(program);
+}
+
+#if JIT_SUPPORTED
+
+typedef struct JitWriter {
+    uint8_t* buf;
+    size_t size;
+    int64_t xmm0; // register whose value is in xmm0, -1 if none
+} JitWriter;
+
+void jit_byte(JitWriter* w, uint8_t b) {
+    w->buf[w->size++] = b;
+}
+
+void jit_u32(JitWriter* w, uint32_t v) {
+    memcpy(w->buf + w->size, &v, sizeof(v));
+    w->size += sizeof(v);
+}
+
+void jit_u64(JitWriter* w, uint64_t v) {
+    memcpy(w->buf + w->size, &v, sizeof(v));
+    w->size += sizeof(v);
+}
+
+// <prefix> 0F <op> with a [rbx + disp32] memory operand and xmm0/rax as the register operand
+void jit_sse_rbx(JitWriter* w, uint8_t prefix, uint8_t op, uint32_t reg) {
+    jit_byte(w, prefix);
+    jit_byte(w, 0x0F);
+    jit_byte(w, op);
+    jit_byte(w, 0x83); // mod=10 reg=000 rm=011 (rbx)
+    jit_u32(w, reg * 8);
+}
+
+void jit_load_xmm0(JitWriter* w, uint32_t reg) {
+    if (w->xmm0 == reg) return;
+    jit_sse_rbx(w, 0xF2, 0x10, reg); // movsd xmm0, [rbx + reg*8]
+    w->xmm0 = reg;
+}
+
+void jit_store_xmm0(JitWriter* w, uint32_t reg) {
+    jit_sse_rbx(w, 0xF2, 0x11, reg); // movsd [rbx + reg*8], xmm0
+    w->xmm0 = reg;
+}
+
+void jit_load_rax(JitWriter* w, uint32_t reg) {
+    jit_byte(w, 0x48); // mov rax, [rbx + reg*8]
+    jit_byte(w, 0x8B);
+    jit_byte(w, 0x83);
+    jit_u32(w, reg * 8);
+}
+
+void jit_store_rax(JitWriter* w, uint32_t reg) {
+    jit_byte(w, 0x48); // mov [rbx + reg*8], rax
+    jit_byte(w, 0x89);
+    jit_byte(w, 0x83);
+    jit_u32(w, reg * 8);
+    if (w->xmm0 == reg) w->xmm0 = -1;
+}
+
+// the longest instruction sequence a single BcInstr lowers to (a call)
+#define JIT_MAX_INSTR_BYTES 48
+
+// returns NULL if the program can't be jitted, the bytecode is only taken over on success
+JitProgram* jit_compile(BcProgram* bytecode) {
+    uint32_t reg_count = bc_register_count(bytecode);
+    if (reg_count >= (1u << 28)) {
+        // register offsets have to fit in a disp32
+        return NULL;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t capacity = ((size_t)bytecode->code->size * JIT_MAX_INSTR_BYTES + 64 + page - 1) & ~(page - 1);
+    void* code = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+
+    JitWriter w = { .buf = code, .size = 0, .xmm0 = -1 };
+    jit_byte(&w, 0x53); // push rbx, also realigns the stack to 16 for the print calls
+    jit_byte(&w, 0x48); // mov rbx, rdi
+    jit_byte(&w, 0x89);
+    jit_byte(&w, 0xFB);
+
+    const BcInstr* instrs = bytecode->code->data;
+    for (int i = 0; i < bytecode->code->size; i++) {
+        BcInstr instr = instrs[i];
+        switch ((BcOp)instr.op) {
+            case BC_ADD:
+            case BC_SUB:
+            case BC_MUL:
+            case BC_DIV: {
+                static const uint8_t ops[] = { [BC_ADD] = 0x58, [BC_SUB] = 0x5C, [BC_MUL] = 0x59, [BC_DIV] = 0x5E };
+                jit_load_xmm0(&w, instr.a);
+                jit_sse_rbx(&w, 0xF2, ops[instr.op], instr.b); // <op>sd xmm0, [rbx + b*8]
+                jit_store_xmm0(&w, instr.out);
+                break;
+            }
+            case BC_MIN:
+            case BC_MAX: {
+                // minsd/maxsd keep xmm0 only if it's strictly smaller/larger, like math_binary
+                jit_load_xmm0(&w, instr.a);
+                jit_sse_rbx(&w, 0xF2, instr.op == BC_MIN ? 0x5D : 0x5F, instr.b);
+                jit_store_xmm0(&w, instr.out);
+                break;
+            }
+            case BC_SQRT:
+                jit_sse_rbx(&w, 0xF2, 0x51, instr.a); // sqrtsd xmm0, [rbx + a*8]
+                jit_store_xmm0(&w, instr.out);
+                break;
+            case BC_NEG:
+            case BC_ABS:
+                // flip or clear the sign bit in an integer register, no constant needed
+                jit_load_rax(&w, instr.a);
+                jit_byte(&w, 0x48); // btc rax, 63 / btr rax, 63
+                jit_byte(&w, 0x0F);
+                jit_byte(&w, 0xBA);
+                jit_byte(&w, instr.op == BC_NEG ? 0xF8 : 0xF0);
+                jit_byte(&w, 63);
+                jit_store_rax(&w, instr.out);
+                break;
+            case BC_POW:
+            case BC_EXP:
+            case BC_LOG:
+            case BC_SIN:
+            case BC_COS:
+            case BC_ERROR:
+                jit_byte(&w, 0x48); // mov rdi, rbx
+                jit_byte(&w, 0x89);
+                jit_byte(&w, 0xDF);
+                jit_byte(&w, 0xBE); // mov esi, imm32
+                jit_u32(&w, instr.op);
+                jit_byte(&w, 0xBA); // mov edx, imm32
+                jit_u32(&w, instr.out);
+                jit_byte(&w, 0xB9); // mov ecx, imm32
+                jit_u32(&w, instr.a);
+                jit_byte(&w, 0x41); // mov r8d, imm32
+                jit_byte(&w, 0xB8);
+                jit_u32(&w, instr.b);
+                jit_byte(&w, 0x48); // mov rax, imm64
+                jit_byte(&w, 0xB8);
+                jit_u64(&w, (uint64_t)(uintptr_t)&jit_math);
+                jit_byte(&w, 0xFF); // call rax
+                jit_byte(&w, 0xD0);
+                w.xmm0 = -1; // caller-saved
+                break;
+            case BC_MOVE:
+                jit_load_rax(&w, instr.a);
+                jit_store_rax(&w, instr.out);
+                break;
+            case BC_PRINT:
+                jit_byte(&w, 0x48); // mov rdi, rbx
+                jit_byte(&w, 0x89);
+                jit_byte(&w, 0xDF);
+                jit_byte(&w, 0x48); // mov rsi, imm64
+                jit_byte(&w, 0xBE);
+                jit_u64(&w, (uint64_t)(uintptr_t)(bytecode->args->data + instr.a));
+                jit_byte(&w, 0xBA); // mov edx, imm32
+                jit_u32(&w, instr.b);
+                jit_byte(&w, 0xB9); // mov ecx, imm32
+                jit_u32(&w, instr.out);
+                jit_byte(&w, 0x48); // mov rax, imm64
+                jit_byte(&w, 0xB8);
+                jit_u64(&w, (uint64_t)(uintptr_t)&jit_print);
+                jit_byte(&w, 0xFF); // call rax
+                jit_byte(&w, 0xD0);
+                w.xmm0 = -1; // caller-saved
+                break;
+        }
+    }
+    jit_byte(&w, 0x5B); // pop rbx
+    jit_byte(&w, 0xC3); // ret
+
+    if (mprotect(code, capacity, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, capacity);
+        return NULL;
+    }
+    JitProgram* program = malloc(sizeof(JitProgram));
+    program->bytecode = bytecode;
+    program->code = code;
+    program->code_capacity = capacity;
+    program->code_size = w.size;
+    program->fn = (JitFn)code;
+    return program;
+}
+
+#else
+
+JitProgram* jit_compile(BcProgram* bytecode) {
+    (void)bytecode;
+    return NULL;
+}
+
+#endif
+
+// runs on a caller-provided register file of bc_register_count registers, so the results can be inspected
+void jit_run_frame(JitProgram* program, double* regs) {
+    BcProgram* bc = program->bytecode;
+    if (bc->constants->size > 0) {
+        memcpy(regs + bc->frame_size, bc->constants->data, bc->constants->size * sizeof(double));
+    }
+    program->fn(regs);
+}
+
+void run_jit(JitProgram* program) {
+    double* regs = malloc((bc_register_count(program->bytecode) + 1) * sizeof(double));
+    jit_run_frame(program, regs);
+    free(regs);
+    output_flush();
+}
+
+#endif //_JIT_H
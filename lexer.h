@@ -9,6 +9,17 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include "dynarr.h"
+#include "arena.h"
+
+// the scanners run once per token, a call costs about as much as the scan itself
+#define LEXER_HOT static inline __attribute__((always_inline))
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LEXER_SIMD 1
+#else
+#define LEXER_SIMD 0
+#endif
 
 typedef enum TokenType {
     // for some reason, if it starts at 0, the parser has a mental breakdown and explodes violently
@@ -22,34 +33,131 @@ typedef struct Token {
     uint32_t line;
 } Token;
 
+// ascii character classes, so the lexer doesn't depend on the locale the way isalpha does
+#define LC_SPACE 1
+#define LC_DIGIT 2
+#define LC_ALPHA 4
+
+static const uint8_t lexer_classes[256] = {
+        [' '] = LC_SPACE, ['\t'] = LC_SPACE, ['\r'] = LC_SPACE, ['\n'] = LC_SPACE,
+        ['0' ... '9'] = LC_DIGIT,
+        ['a' ... 'z'] = LC_ALPHA, ['A' ... 'Z'] = LC_ALPHA,
+};
+
 bool is_whitespace(char c) {
-    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    return lexer_classes[(uint8_t)c] & LC_SPACE;
 }
 
 bool is_digit(char c) {
-    return c >= '0' && c <= '9';
+    return lexer_classes[(uint8_t)c] & LC_DIGIT;
+}
+
+bool is_alpha(char c) {
+    return lexer_classes[(uint8_t)c] & LC_ALPHA;
+}
+
+// the scanners below return the first character at or after p that isn't in a class.
+// the SSE2 versions classify 16 bytes at a time. they only do aligned loads, which never cross into the next page,
+// so reading past the terminator is safe even though it's outside the string. asan doesn't know that.
+#if LEXER_SIMD
+
+// bit i is set if byte i of the block is in the class
+LEXER_HOT __attribute__((no_sanitize_address)) uint32_t lexer_block_mask(const char* block, int cls) {
+    __m128i c = _mm_load_si128((const __m128i*)block);
+    __m128i in;
+    switch (cls) {
+        case LC_SPACE:
+            in = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+                              _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\n'))));
+            break;
+        case LC_DIGIT:
+            // unsigned c - '0' < 10, as a signed compare after moving '0' to -128
+            in = _mm_cmplt_epi8(_mm_add_epi8(c, _mm_set1_epi8((char)(0x80 - '0'))), _mm_set1_epi8((char)(0x80 + 10)));
+            break;
+        default:
+            // setting bit 5 lowercases letters and maps nothing else onto them
+            c = _mm_or_si128(c, _mm_set1_epi8(0x20));
+            in = _mm_cmplt_epi8(_mm_add_epi8(c, _mm_set1_epi8((char)(0x80 - 'a'))), _mm_set1_epi8((char)(0x80 + 26)));
+            break;
+    }
+    return (uint32_t)_mm_movemask_epi8(in);
+}
+
+LEXER_HOT __attribute__((no_sanitize_address)) const char* lexer_scan_blocks(const char* p, int cls) {
+    uintptr_t offset = (uintptr_t)p & 15;
+    const char* block = p - offset;
+    // the bytes before p count as in the class
+    uint32_t mask = lexer_block_mask(block, cls) | ((1u << offset) - 1);
+    while (mask == 0xFFFF) {
+        block += 16;
+        mask = lexer_block_mask(block, cls);
+    }
+    return block + __builtin_ctz(~mask);
+}
+
+// newlines in [p, end)
+__attribute__((no_sanitize_address)) uint32_t lexer_count_newlines(const char* p, const char* end) {
+    uint32_t lines = 0;
+    if (end - p < 16) {
+        for (; p < end; p++) {
+            if (*p == '\n') lines++;
+        }
+        return lines;
+    }
+    uintptr_t offset = (uintptr_t)p & 15;
+    const char* block = p - offset;
+    uint32_t skip = (1u << offset) - 1;
+    for (; block < end; block += 16) {
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)block), _mm_set1_epi8('\n')));
+        mask &= ~skip;
+        if (end - block < 16) mask &= (1u << (end - block)) - 1;
+        lines += __builtin_popcount(mask);
+        skip = 0;
+    }
+    return lines;
+}
+
+#else
+
+LEXER_HOT const char* lexer_scan_blocks(const char* p, int cls) {
+    while (lexer_classes[(uint8_t)*p] & cls) p++;
+    return p;
+}
+
+uint32_t lexer_count_newlines(const char* p, const char* end) {
+    uint32_t lines = 0;
+    for (; p < end; p++) {
+        if (*p == '\n') lines++;
+    }
+    return lines;
+}
+
+#endif
+
+// most tokens and whitespace runs are only a few bytes, blocks only pay off once a run gets longer than that
+#define LEXER_SCALAR_PREFIX 8
+
+LEXER_HOT const char* lexer_scan(const char* p, int cls) {
+    for (int i = 0; i < LEXER_SCALAR_PREFIX; i++, p++) {
+        if (!(lexer_classes[(uint8_t)*p] & cls)) return p;
+    }
+    return lexer_scan_blocks(p, cls);
 }
 
 typedef struct Lexer {
     char *start;
     char *current;
     uint32_t line;
-    uint32_t length;
 } Lexer;
 
-Lexer* lexer_create(const char* expr) {
-    Lexer* lexer = malloc(sizeof(Lexer));
+Lexer* lexer_create(const char* expr, Arena* arena) {
+    Lexer* lexer = arena_alloc(arena, sizeof(Lexer));
     lexer->start = (char*)expr;
     lexer->current = lexer->start;
     lexer->line = 1;
-    lexer->length = strlen(expr);
     return lexer;
 }
 
-void lexer_free(Lexer* lexer) {
-    free(lexer);
-}
-
 Token lexer_make_token(Lexer* lexer, TokenType type) {
     Token token;
     token.type = type;
@@ -60,26 +168,34 @@ Token lexer_make_token(Lexer* lexer, TokenType type) {
 }
 
 Token lexer_number(Lexer* lexer) {
-    while (is_digit(*lexer->current)) lexer->current++;
+    lexer->current = (char*)lexer_scan(lexer->current, LC_DIGIT);
     if (*lexer->current == '.' && is_digit(*(lexer->current + 1))) {
-        lexer->current++;
-        while (is_digit(*lexer->current)) lexer->current++;
+        lexer->current = (char*)lexer_scan(lexer->current + 1, LC_DIGIT);
     }
     return lexer_make_token(lexer, TT_NUM);
 }
 
 Token lexer_identifier(Lexer* lexer) {
-    while (isalpha(*lexer->current)) lexer->current++;
+    lexer->current = (char*)lexer_scan(lexer->current, LC_ALPHA);
     return lexer_make_token(lexer, TT_IDENT);
 }
 
-Token lexer_next_token(Lexer* lexer) {
-    while (is_whitespace(*lexer->current)) {
-        if (*lexer->current == '\n') {
-            lexer->line++;
+LEXER_HOT void lexer_skip_whitespace(Lexer* lexer) {
+    char* p = lexer->current;
+    for (int i = 0; i < LEXER_SCALAR_PREFIX; i++, p++) {
+        if (!is_whitespace(*p)) {
+            lexer->current = p;
+            return;
         }
-        lexer->current++;
+        lexer->line += *p == '\n';
     }
+    char* end = (char*)lexer_scan_blocks(p, LC_SPACE);
+    lexer->line += lexer_count_newlines(p, end);
+    lexer->current = end;
+}
+
+Token lexer_next_token(Lexer* lexer) {
+    lexer_skip_whitespace(lexer);
     lexer->start = lexer->current;
     if (*lexer->current == '\0') return lexer_make_token(lexer, TT_EOF);
     lexer->current++;
@@ -94,7 +210,7 @@ Token lexer_next_token(Lexer* lexer) {
         case '=': return lexer_make_token(lexer, TT_ASSIGN);
         case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': return lexer_number(lexer);
         default: {
-            if (isalpha(*(lexer->current - 1))) return lexer_identifier(lexer);
+            if (is_alpha(*(lexer->current - 1))) return lexer_identifier(lexer);
             printf("ERROR %d: Unexpected character '%c'\n", lexer->line, *(lexer->current - 1));
             return lexer_make_token(lexer, TT_ERROR);
         }
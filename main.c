@@ -1,189 +1,217 @@
 #include <stdio.h>
 
-#include "asm.h"
+#include "engine.h"
+#include "image.h"
+#include "optimize.h"
+#include "parallel.h"
+#include "reactive.h"
+#include "regalloc.h"
+#include "server.h"
+#include "session.h"
+#include "stream.h"
 
-typedef struct InstrVM {
-    // Takes a pointer to the instruction array, and runs the instructions
-    // variables:
-    double vars[127]; // 127 variable max (for now)
-    // variable names:
-    char* var_names[127]; // to find the name of a variable: search through the array for that variable, the index is the var, vars[index] is the value, var_names[index] is the name
-    uint32_t var_count;
-
-    // todo: functions
-} InstrVM;
+// the whole script compiled at once, for the engines and the optimizer, which need the whole program.
+// the switch engine without --optimize streams it instead
+bool run_script(const char* path, VmEngine engine, bool optimize) {
+    char* src = read_script(path);
+    if (src == NULL) return false;
+    Arena* arena = arena_create();
+    // on every core once the script is long enough to pay for it
+    InstructionArr* instructions = gen_code_parallel(src, arena, NULL);
+    free(src);
+    if (optimize) optimize_instructions(instructions, NULL);
+    allocate_slots(instructions);
+    EngineProgram* program = engine_prepare(instructions, engine);
+    if (program) {
+        engine_run(program);
+        engine_program_free(program);
+    }
+    free_instructions(instructions);
+    arena_free(arena);
+    return program != NULL;
+}
 
-double vm_get_var(InstrVM* vm, Data var, uint32_t line) {
-    if (var.type == CONSTANT) {
-        return var.data.constant;
-    } else if (var.type == VARIABLE) {
-        return vm->vars[var.data.variable];
-    } else if (var.type == IDENTIFIER) {
-        for (int i = 0; i < vm->var_count; i++) {
-            if (strcmp(vm->var_names[i], var.data.identifier) == 0) {
-                return vm->vars[i];
+int main(int argc, char** argv) {
+    VmEngine engine = ENGINE_SWITCH;
+    bool optimize = false;
+    bool stats = false;
+    bool repl = false;
+    const char* script = NULL;
+    const char* compile_to = NULL;
+    const char* image_path = NULL;
+    // --set name=value, split at the '='
+    const char* set_names[argc];
+    double set_values[argc];
+    int set_count = 0;
+    const char* get_names[argc];
+    int get_count = 0;
+    const char* serve_path = NULL;
+    const char* client_path = NULL;
+    const char* load_path = NULL;
+    uint32_t workers = 0;
+    uint32_t clients = 4;
+    uint32_t requests = 10000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--optimize") == 0) {
+            optimize = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--repl") == 0) {
+            repl = true;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!engine_from_name(argv[++i], &engine)) {
+                printf("ERROR: unknown engine '%s'\n", argv[i]);
+                return 1;
             }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            OutputFormat format;
+            if (!output_format_from_name(argv[++i], &format)) {
+                printf("ERROR: unknown output format '%s'\n", argv[i]);
+                return 1;
+            }
+            output_set_format(format);
+        } else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc) {
+            char* equals = strchr(argv[++i], '=');
+            char* end = NULL;
+            if (equals) set_values[set_count] = strtod(equals + 1, &end);
+            if (equals == NULL || end == equals + 1 || *end != '\0') {
+                printf("ERROR: expected name=value, got '%s'\n", argv[i]);
+                return 1;
+            }
+            *equals = '\0';
+            set_names[set_count++] = argv[i];
+        } else if (strcmp(argv[i], "--get") == 0 && i + 1 < argc) {
+            get_names[get_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            client_path = argv[++i];
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            load_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            clients = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            requests = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc) {
+            compile_to = argv[++i];
+        } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            image_path = argv[++i];
+        } else if (script == NULL && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) {
+            script = argv[i];
+        } else {
+            printf("usage: %s [--optimize] [--stats] [--engine switch|bytecode|threaded|jit|parallel]\n"
+                   "          [--output fixed|shortest|binary] [script|-]\n"
+                   "       %s [--optimize] --compile image script|-\n"
+                   "       %s [--output fixed|shortest|binary] --image image\n"
+                   "       %s [--output fixed|shortest|binary] --repl\n"
+                   "       %s [--output fixed|shortest|binary] --set name=value... script|-\n"
+                   "       %s [--optimize] [--workers n] --serve socket\n"
+                   "       %s --client socket [--set name=value]... [--get name]... script|-\n"
+                   "       %s --load socket [--clients n] [--requests n] [--set name=value]... [--get name]... "
+                   "script|-\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 1;
         }
-        printf("ERROR %d: unknown identifier '%s'\n", line, var.data.identifier);
-        printf("var_count: %d\n", vm->var_count);
-    } else {
-        printf("ERROR %d: unknown data type\n", line);
     }
-    return 0;
-}
 
-#define max(a, b) ((a) > (b) ? (a) : (b))
+    stats_enable(stats);
 
-void update_vars(InstrVM* vm, int out) {
-    uint32_t prev_var_count = vm->var_count;
-    vm->var_count = max(vm->var_count, out + 1);
-    if (vm->var_count > prev_var_count) {
-        for (int i = prev_var_count; i < vm->var_count; i++) {
-            vm->var_names[i] = "\0";
+    if (serve_path) {
+        return server_serve(serve_path, workers, optimize) ? 0 : 1;
+    }
+    if (client_path || load_path) {
+        if (script == NULL) {
+            printf("ERROR: --client and --load need a script\n");
+            return 1;
+        }
+        char* src = read_script(script);
+        if (src == NULL) return 1;
+        bool ok;
+        if (client_path) {
+            ok = server_client(client_path, src, set_names, set_values, set_count, get_names, get_count);
+        } else {
+            size_t size;
+            char* frame = server_encode(src, set_names, set_values, set_count, get_names, get_count, &size);
+            ok = server_load_report(load_path, frame, size, clients ? clients : 1, requests);
+            free(frame);
         }
+        free(src);
+        return ok ? 0 : 1;
     }
-}
 
-void run_instructions(InstructionArr* instructions) {
-    InstrVM* vm = malloc(sizeof(InstrVM));
-    vm->var_count = 0;
-    for (int i = 0; i < instructions->size; i++) {
-        Instruction instr = instructions->data[i];
-        switch (instr.type) {
-            case BINARY:
-                switch (instr.data.binary.op) {
-                    case ADD:
-                        vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) + vm_get_var(vm, instr.data.binary.right, i);
-                        update_vars(vm, instr.out);
-                        break;
-                    case SUB:
-                        vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) - vm_get_var(vm, instr.data.binary.right, i);
-                        update_vars(vm, instr.out);
-                        break;
-                    case MUL:
-                        vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) * vm_get_var(vm, instr.data.binary.right, i);
-                        update_vars(vm, instr.out);
-                        break;
-                    case DIV:
-                        vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) / vm_get_var(vm, instr.data.binary.right, i);
-                        update_vars(vm, instr.out);
-                        break;
-                    case ASSIGN:
-                        if (instr.data.binary.left.type != IDENTIFIER) {
-                            printf("ERROR %d: left side of assignment must be an identifier\n", i);
-                            return;
-                        }
-                        // if identifer already exists, delete the old one AFTER creating the new one
-                        bool foundold = false;
-                        for (int i2 = 0; i2 < vm->var_count; i2++) {
-                            if (strcmp(vm->var_names[i2], instr.data.binary.left.data.identifier) == 0) {
-                                foundold = true;
-                                break;
-                            }
-                        }
-                        switch (instr.data.binary.right.type) {
-                            case CONSTANT:
-                                // create a new variable with the name of the left side, and the value of the right side
-                                if (instr.out != vm->var_count) {
-                                    printf("ERROR %d: cannot reassign a variable with const\n", i);
-                                    printf("out: %d, var_count: %d\n", instr.out, vm->var_count);
-                                    return;
-                                }
-                                vm->var_names[instr.out] = instr.data.binary.left.data.identifier;
-                                vm->vars[instr.out] = instr.data.binary.right.data.constant;
-                                vm->var_count++;
-                                break;
-                            case VARIABLE:
-                                vm->var_names[instr.data.binary.right.data.variable] = instr.data.binary.left.data.identifier;
-                                break;
-                            case IDENTIFIER: {
-                                bool found = false;
-                                for (int i2 = 0; i2 < vm->var_count; i2++) {
-                                    if (strcmp(vm->var_names[i2], instr.data.binary.right.data.identifier) == 0) {
-                                        if (instr.out != vm->var_count) {
-                                            printf("ERROR %d: cannot reassign a variable with ident\n", i);
-                                            printf("out: %d, var_count: %d\n", instr.out, vm->var_count);
-                                            return;
-                                        }
-                                        vm->var_names[instr.out] = instr.data.binary.left.data.identifier;
-                                        vm->vars[instr.out] = vm->vars[i2];
-                                        vm->var_count++;
-                                        found = true;
-                                        break;
-                                    }
-                                }
-                                if (!found) {
-                                    printf("ERROR %d: unknown copy identifier '%s'\n", i,
-                                           instr.data.binary.right.data.identifier);
-                                    return;
-                                }
-                                break;
-                            }
-                            default:
-                                printf("ERROR %d: right side of assignment must be a constant, variable, or identifier\n", i);
-                                return;
-                        }
-                        // delete old if exists
-                        if (foundold) {
-                            for (int i2 = 0; i2 < vm->var_count; i2++) {
-                                if (strcmp(vm->var_names[i2], instr.data.binary.left.data.identifier) == 0) {
-                                    vm->var_names[i2] = "\0";
-                                    break;
-                                }
-                            }
-                        }
+    if (compile_to) {
+        if (script == NULL) {
+            printf("ERROR: --compile needs a script\n");
+            return 1;
+        }
+        return image_compile_file(script, compile_to, optimize) ? 0 : 1;
+    }
+    if (image_path) {
+        // precompiled, so it always runs on the bytecode engine
+        ProgramImage* image = image_load(image_path);
+        if (image == NULL) return 1;
+        double start = stats_enabled ? stats_now() : 0;
+        image_run(image);
+        if (stats_enabled) stats_add_time(STATS_EXECUTE, stats_now() - start);
+        image_free(image);
+        if (stats) print_exec_stats();
+        return 0;
+    }
 
-                        break;
-                    case CALL:
-                        // only print for now
-                        if (instr.data.binary.left.type != IDENTIFIER) {
-                            printf("ERROR %d: call must be an identifier\n", i);
-                            return;
-                        }
-                        if (strcmp(instr.data.binary.left.data.identifier, "print") == 0) {
-                            if (instr.data.binary.right.type != ARGLIST) {
-                                printf("ERROR %d: print must have an argument list\n", i);
-                                return;
-                            }
-                            for (int i = 0; i < instr.data.binary.right.data.arglist.len; i++) {
-                                printf("%f ", vm_get_var(vm, instr.data.binary.right.data.arglist.args[i], i));
-                            }
-                            printf("\n");
-                            // return 0
-                            vm->vars[instr.out] = 0;
-                            update_vars(vm, instr.out);
-                        } else {
-                            printf("ERROR %d: unknown function '%s'\n", i, instr.data.binary.left.data.identifier);
-                        }
-                        break;
-                }
-                break;
-            case UNARY:
-                switch (instr.data.unary.op) {
-                    case NEG:
-                        vm->vars[instr.out] = -vm_get_var(vm, instr.data.unary.operand, i);
-                        break;
-                }
-                break;
+    if (script || repl || set_count > 0) {
+        // sessions and reactive programs run statements on the vm as they go, so the other options don't apply
+        if ((repl || set_count > 0) && (optimize || engine != ENGINE_SWITCH)) {
+            printf("ERROR: --repl and --set only run on the switch engine, without --optimize\n");
+            return 1;
+        }
+        if (set_count > 0) {
+            // the whole script is kept, then every --set re-runs what depends on it
+            bool ok = script && reactive_run_file(script, set_names, set_values, set_count);
+            if (!script) printf("ERROR: --set needs a script\n");
+            if (stats) print_exec_stats();
+            return ok ? 0 : 1;
         }
+        if (repl) {
+            // every line runs as soon as it's read, against the names the lines before it bound
+            Session* session = session_create();
+            session_repl(session, stdin);
+            session_free(session);
+            if (stats) print_exec_stats();
+            return 0;
+        }
+        bool ok = optimize || engine != ENGINE_SWITCH ? run_script(script, engine, optimize) : stream_run_file(script);
+        if (stats) print_exec_stats();
+        return ok ? 0 : 1;
     }
-//    for (int i = 0; i < vm->var_count; i++) {
-//        if (vm->var_names[i][0] != '\0') {
-//            printf("%%%d/'%s' = %f\n", i, vm->var_names[i], vm->vars[i]);
-//        } else {
-//            printf("%%%d = %f\n", i, vm->vars[i]);
-//
-//        }
-//    }
-    free(vm);
-}
 
-int main() {
-    InstructionArr* instructions = gen_code("x = (y = 10)");
+    Arena* arena = arena_create();
+    InstructionArr* instructions = gen_code("x = (y = 10)", arena);
     print_instructions(instructions);
+    if (optimize) {
+        OptStats stats;
+        optimize_instructions(instructions, &stats);
+        printf("optimized %d -> %d instructions (%d folded, %d simplified, %d reduced, %d eliminated)\n",
+               stats.before, stats.after, stats.folded, stats.simplified, stats.reduced, stats.eliminated);
+    }
+    // temporaries share slots once they are dead, so the frame doesn't grow with the script
+    uint32_t frame_before = instructions_frame_size(instructions);
+    uint32_t frame_after = allocate_slots(instructions);
+    if (optimize) {
+        printf("frame %u -> %u slots\n", frame_before, frame_after);
+        print_instructions(instructions);
+    }
 
-    run_instructions(instructions);
+    EngineProgram* program = engine_prepare(instructions, engine);
+    if (program) {
+        engine_run(program);
+        engine_program_free(program);
+    }
 
+    free_instructions(instructions);
+    arena_free(arena);
+
+    if (stats) print_exec_stats();
     return 0;
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,253 @@
+#pragma once
+#ifndef _NUMBER_H
+#define _NUMBER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "number_table.h"
+
+// decimal to double for number tokens (digits, optionally followed by '.' and digits), correctly rounded,
+// straight off the token's span: no copy, no allocation, no locale.
+// - the first 19 significant digits go into a uint64 w, so the value is about w * 10^q
+// - if w and 10^q are both exact doubles, a single multiply or divide rounds correctly (clinger's fast path)
+// - otherwise eisel-lemire: w times a 128-bit approximation of 5^q, which is always enough when w holds every digit
+// - with more than 19 digits the value lies in [w, w + 1) * 10^q. if both ends round to the same double that's
+//   the answer, otherwise the full digits are compared against the halfway points between the candidates,
+//   exactly, with big integers
+
+#define NUMBER_FAST_DIGITS 19
+// digits past this many can only break a tie, so they are only checked for being nonzero
+#define NUMBER_MAX_DIGITS 800
+// enough for NUMBER_MAX_DIGITS digits times the largest power of 5 the comparison needs
+#define NUMBER_BIG_LIMBS 128
+
+typedef struct NumberDecimal {
+    uint64_t w; // first NUMBER_FAST_DIGITS significant digits
+    int32_t q; // exponent of the last digit in w
+    bool truncated; // there were more significant digits than w holds
+} NumberDecimal;
+
+static const double number_exact_pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+NumberDecimal number_scan(const char* s, uint32_t len) {
+    NumberDecimal d = { 0, 0, false };
+    int digits = 0; // significant digits so far, leading zeros aren't
+    bool fraction = false;
+    for (uint32_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == '.') {
+            fraction = true;
+            continue;
+        }
+        if (digits < NUMBER_FAST_DIGITS) {
+            if (digits > 0 || c != '0') {
+                d.w = d.w * 10 + (uint64_t)(c - '0');
+                digits++;
+            }
+            if (fraction) d.q--;
+        } else {
+            // dropped, an integer digit still scales w
+            if (c != '0') d.truncated = true;
+            if (!fraction) d.q++;
+        }
+    }
+    return d;
+}
+
+uint64_t number_mul128(uint64_t a, uint64_t b, uint64_t* high) {
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *high = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+}
+
+// bits of the double nearest to w * 10^q, w != 0
+uint64_t number_lemire(uint64_t w, int32_t q) {
+    if (q < NUMBER_POW5_MIN) return 0;
+    if (q > NUMBER_POW5_MAX) return 0x7FF0000000000000ULL;
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    const uint64_t* pow5 = number_pow5[q - NUMBER_POW5_MIN];
+    // 55 bits of the product are needed, the second word only matters if the low bits of the first are all ones
+    uint64_t high;
+    uint64_t low = number_mul128(w, pow5[0], &high);
+    if ((high & 0x1FF) == 0x1FF) {
+        uint64_t second_high;
+        number_mul128(w, pow5[1], &second_high);
+        low += second_high;
+        if (second_high > low) high++;
+    }
+    int upper = (int)(high >> 63);
+    int shift = upper + 64 - 52 - 3;
+    uint64_t mantissa = high >> shift;
+    // floor(log2(10^q)) + 63, then the exponent bias
+    int32_t power2 = (int32_t)((((152170 + 65536) * (int64_t)q) >> 16) + 63) + upper - lz + 1023;
+    if (power2 <= 0) {
+        // subnormal
+        if (-power2 + 1 >= 64) return 0;
+        mantissa >>= -power2 + 1;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        power2 = mantissa < (1ULL << 52) ? 0 : 1;
+        return (mantissa & ((1ULL << 52) - 1)) | ((uint64_t)power2 << 52);
+    }
+    // exactly halfway between two doubles, which only happens for small q: round to even
+    if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == high) {
+        mantissa &= ~1ULL;
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ULL << 52)) {
+        mantissa = 1ULL << 52;
+        power2++;
+    }
+    if (power2 >= 0x7FF) return 0x7FF0000000000000ULL;
+    return (mantissa & ((1ULL << 52) - 1)) | ((uint64_t)power2 << 52);
+}
+
+// little-endian base 2^32 unsigned integer
+typedef struct NumberBig {
+    uint32_t limbs[NUMBER_BIG_LIMBS];
+    int len;
+} NumberBig;
+
+void number_big_mul_add(NumberBig* big, uint32_t mul, uint32_t add) {
+    uint64_t carry = add;
+    for (int i = 0; i < big->len; i++) {
+        uint64_t v = (uint64_t)big->limbs[i] * mul + carry;
+        big->limbs[i] = (uint32_t)v;
+        carry = v >> 32;
+    }
+    if (carry && big->len < NUMBER_BIG_LIMBS) big->limbs[big->len++] = (uint32_t)carry;
+}
+
+void number_big_mul_pow5(NumberBig* big, int n) {
+    // 5^13 is the largest power of 5 that fits a limb
+    for (; n >= 13; n -= 13) number_big_mul_add(big, 1220703125u, 0);
+    uint32_t rest = 1;
+    for (; n > 0; n--) rest *= 5;
+    number_big_mul_add(big, rest, 0);
+}
+
+void number_big_shl(NumberBig* big, int bits) {
+    int words = bits / 32;
+    bits %= 32;
+    if (big->len == 0) return;
+    if (big->len + words + 1 > NUMBER_BIG_LIMBS) {
+        words = NUMBER_BIG_LIMBS - big->len - 1;
+    }
+    big->limbs[big->len] = 0;
+    for (int i = big->len; i >= 0; i--) {
+        uint32_t v = big->limbs[i] << bits;
+        if (bits && i > 0) v |= big->limbs[i - 1] >> (32 - bits);
+        big->limbs[i + words] = v;
+    }
+    for (int i = 0; i < words; i++) big->limbs[i] = 0;
+    big->len += words + 1;
+    while (big->len > 0 && big->limbs[big->len - 1] == 0) big->len--;
+}
+
+int number_big_cmp(const NumberBig* a, const NumberBig* b) {
+    if (a->len != b->len) return a->len < b->len ? -1 : 1;
+    for (int i = a->len - 1; i >= 0; i--) {
+        if (a->limbs[i] != b->limbs[i]) return a->limbs[i] < b->limbs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// compares the decimal in s with the point halfway between the double `bits` and the next one up
+int number_cmp_halfway(const char* s, uint32_t len, uint64_t bits) {
+    NumberBig digits = { .len = 0 };
+    int32_t q = 0; // exponent of the last digit in `digits`
+    int count = 0;
+    bool fraction = false, rest = false;
+    uint32_t chunk = 0, chunk_mul = 1;
+    for (uint32_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == '.') {
+            fraction = true;
+            continue;
+        }
+        if (count == 0 && c == '0') {
+            if (fraction) q--;
+            continue;
+        }
+        if (count < NUMBER_MAX_DIGITS) {
+            chunk = chunk * 10 + (uint32_t)(c - '0');
+            chunk_mul *= 10;
+            if (chunk_mul == 1000000000u) {
+                number_big_mul_add(&digits, chunk_mul, chunk);
+                chunk = 0;
+                chunk_mul = 1;
+            }
+            count++;
+            if (fraction) q--;
+        } else {
+            if (c != '0') rest = true;
+            if (!fraction) q++;
+        }
+    }
+    if (chunk_mul > 1) {
+        number_big_mul_add(&digits, chunk_mul, chunk);
+    }
+
+    // halfway = (2m + 1) * 2^(e - 1)
+    uint64_t m = bits & ((1ULL << 52) - 1);
+    int32_t e = (int32_t)(bits >> 52);
+    if (e == 0) {
+        e = -1074;
+    } else {
+        m |= 1ULL << 52;
+        e -= 1075;
+    }
+    uint64_t half_m = 2 * m + 1;
+    NumberBig halfway = { .len = 0 };
+    halfway.limbs[halfway.len++] = (uint32_t)half_m;
+    if (half_m >> 32) halfway.limbs[halfway.len++] = (uint32_t)(half_m >> 32);
+
+    // digits * 5^q * 2^q against halfway * 2^(e - 1), with every exponent moved to where it's positive
+    if (q >= 0) number_big_mul_pow5(&digits, q);
+    else number_big_mul_pow5(&halfway, -q);
+    int32_t shift = q - (e - 1);
+    if (shift > 0) number_big_shl(&digits, shift);
+    else number_big_shl(&halfway, -shift);
+    int cmp = number_big_cmp(&digits, &halfway);
+    if (cmp == 0 && rest) cmp = 1;
+    return cmp;
+}
+
+double number_from_bits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// the double nearest to w * 10^q, where w holds every significant digit
+double number_from_decimal(uint64_t w, int32_t q) {
+    if (w == 0) return 0;
+    if (w <= (1ULL << 53) && q >= -22 && q <= 22) {
+        return q < 0 ? (double)w / number_exact_pow10[-q] : (double)w * number_exact_pow10[q];
+    }
+    return number_from_bits(number_lemire(w, q));
+}
+
+// the digits of a number token, which the lexer guarantees to be digits with at most one '.'
+double number_parse(const char* s, uint32_t len) {
+    NumberDecimal d = number_scan(s, len);
+    if (!d.truncated) return number_from_decimal(d.w, d.q);
+    uint64_t bits = number_lemire(d.w, d.q);
+    uint64_t upper = number_lemire(d.w + 1, d.q);
+    // the value is somewhere in [bits, upper], walk up until it's below a halfway point
+    while (bits < upper) {
+        int cmp = number_cmp_halfway(s, len, bits);
+        if (cmp < 0 || (cmp == 0 && (bits & 1) == 0)) break;
+        bits++;
+    }
+    return number_from_bits(bits);
+}
+
+#endif //_NUMBER_H
@@ -0,0 +1,391 @@
+#pragma once
+#ifndef _OPTIMIZE_H
+#define _OPTIMIZE_H
+
+#include "asm.h"
+
+// optimization pass that runs between gen_code and execution.
+// % slots are written exactly once, so a slot whose value is known at compile time (a constant, another slot,
+// or the current value of a named variable) doesn't need its instruction: every later use is rewritten instead.
+// - constant subexpressions are evaluated, including reads of names that were assigned a constant
+// - copies (+x) and exact identities (x * 1, 1 * x, x / 1, x - 0, x + -0, --x) are removed
+// - division by a power of two becomes multiplication by its reciprocal, x * -1 becomes -x
+// x + 0 is left alone: it turns -0 into +0, so it isn't an identity.
+// then dead code is removed: instructions whose result is never printed or read by anything that is.
+
+typedef struct OptStats {
+    int before;
+    int after;
+    int folded; // constant subexpressions evaluated at compile time
+    int simplified; // copies and identities removed
+    int reduced; // strength reductions
+    int eliminated; // dead instructions removed
+} OptStats;
+
+typedef struct Optimizer {
+    InstructionArr* out;
+    OptStats* stats;
+    // replacement for slots whose instruction was dropped
+    bool* slot_known;
+    Data* slot_value;
+    // slots whose instruction was kept, a known value in them is still written at run time
+    bool* slot_kept;
+    // slots whose value is the negation of another operand (a constant or slot), for --x
+    bool* slot_neg;
+    Data* slot_neg_of;
+    // slots known to hold a named variable's current value, chained per symbol.
+    // they have to be materialized before that variable is reassigned.
+    int* alias_head;
+    int* alias_next;
+    // names currently holding a known constant
+    bool* sym_const;
+    double* sym_value;
+} Optimizer;
+
+bool opt_is_const(Data d, double value) {
+    return d.type == CONSTANT && memcmp(&d.data.constant, &value, sizeof(double)) == 0;
+}
+
+// c and 1/c are both normal powers of two, so x / c == x * (1 / c) for every x
+bool opt_exact_reciprocal(double c) {
+    uint64_t bits;
+    memcpy(&bits, &c, sizeof(bits));
+    uint64_t exponent = (bits >> 52) & 0x7FF;
+    if ((bits & 0xFFFFFFFFFFFFFULL) != 0 || exponent == 0 || exponent == 0x7FF) return false;
+    // 1/c has exponent field 2046 - exponent, which has to be normal as well
+    return exponent != 2046 && exponent != 0;
+}
+
+Data opt_constant(double value) {
+    const Data d = {
+            .type = CONSTANT,
+            .data.constant = value
+    };
+    return d;
+}
+
+Data opt_resolve(Optimizer* opt, Data d) {
+    if (d.type == VARIABLE && d.data.variable >= 0 && opt->slot_known[d.data.variable]) {
+        return opt->slot_value[d.data.variable];
+    }
+    if (d.type == IDENTIFIER && opt->sym_const[d.data.ident.symbol]) {
+        return opt_constant(opt->sym_value[d.data.ident.symbol]);
+    }
+    return d;
+}
+
+// drops the instruction that writes slot, its uses get value instead
+void opt_replace(Optimizer* opt, int slot, Data value) {
+    opt->slot_known[slot] = true;
+    opt->slot_value[slot] = value;
+    opt->slot_kept[slot] = false;
+    if (value.type == IDENTIFIER) {
+        int symbol = value.data.ident.symbol;
+        opt->alias_next[slot] = opt->alias_head[symbol];
+        opt->alias_head[symbol] = slot;
+    }
+}
+
+void opt_push(Optimizer* opt, Instruction instr) {
+    pushInstructionArr(opt->out, instr);
+    if (instr.out >= 0) {
+        opt->slot_known[instr.out] = false;
+        opt->slot_neg[instr.out] = false;
+        opt->slot_kept[instr.out] = true;
+    }
+}
+
+// writes out every slot that still stands in for symbol's current value
+void opt_materialize(Optimizer* opt, int symbol) {
+    for (int slot = opt->alias_head[symbol]; slot != -1; slot = opt->alias_next[slot]) {
+        if (opt->slot_known[slot] && opt->slot_value[slot].type == IDENTIFIER
+            && opt->slot_value[slot].data.ident.symbol == symbol) {
+            Instruction set = {
+                    .out = slot,
+                    .type = SET,
+                    .data.set = opt->slot_value[slot]
+            };
+            opt_push(opt, set);
+        }
+    }
+    opt->alias_head[symbol] = -1;
+}
+
+void opt_binary(Optimizer* opt, Instruction instr) {
+    Data l = opt_resolve(opt, instr.data.binary.left);
+    Data r = opt_resolve(opt, instr.data.binary.right);
+    BinaryOp op = instr.data.binary.op;
+    if (l.type == CONSTANT && r.type == CONSTANT) {
+        opt_replace(opt, instr.out, opt_constant(math_binary(op, l.data.constant, r.data.constant)));
+        opt->stats->folded++;
+        return;
+    }
+    if ((op == MUL && opt_is_const(r, 1)) || (op == DIV && opt_is_const(r, 1))
+        || (op == SUB && opt_is_const(r, 0)) || (op == ADD && opt_is_const(r, -0.0))) {
+        opt_replace(opt, instr.out, l);
+        opt->stats->simplified++;
+        return;
+    }
+    if ((op == MUL && opt_is_const(l, 1)) || (op == ADD && opt_is_const(l, -0.0))) {
+        opt_replace(opt, instr.out, r);
+        opt->stats->simplified++;
+        return;
+    }
+    if (op == MUL && (opt_is_const(r, -1) || opt_is_const(l, -1))) {
+        Instruction neg = {
+                .out = instr.out,
+                .type = UNARY,
+                .data.unary = {
+                        .operand = opt_is_const(r, -1) ? l : r,
+                        .op = NEG
+                }
+        };
+        opt->stats->reduced++;
+        opt_push(opt, neg);
+        if (neg.data.unary.operand.type != IDENTIFIER) {
+            opt->slot_neg[neg.out] = true;
+            opt->slot_neg_of[neg.out] = neg.data.unary.operand;
+        }
+        return;
+    }
+    if (op == DIV && r.type == CONSTANT && opt_exact_reciprocal(r.data.constant)) {
+        op = MUL;
+        r = opt_constant(1.0 / r.data.constant);
+        opt->stats->reduced++;
+    }
+    instr.data.binary.left = l;
+    instr.data.binary.right = r;
+    instr.data.binary.op = op;
+    opt_push(opt, instr);
+}
+
+void opt_assign(Optimizer* opt, Instruction instr) {
+    Data left = instr.data.binary.left;
+    Data original = instr.data.binary.right;
+    Data r = opt_resolve(opt, original);
+    Data bound = r;
+    if (original.type == VARIABLE && original.data.variable >= 0 && opt->slot_kept[original.data.variable]) {
+        // the slot is still written, keep the rename instead of copying its value
+        bound = original;
+    }
+    if (left.type != IDENTIFIER) {
+        opt_push(opt, instr);
+        return;
+    }
+    int symbol = left.data.ident.symbol;
+    if (bound.type != VARIABLE && instr.out == -1) {
+        // the slot the name was going to be bound to got folded away, write the value into it instead
+        instr.out = original.data.variable;
+    }
+    instr.data.binary.right = bound;
+    if (instr.out >= 0) {
+        // written by this assignment, so it doesn't need materializing
+        opt->slot_known[instr.out] = false;
+    }
+    opt_materialize(opt, symbol);
+    opt_push(opt, instr);
+    opt->sym_const[symbol] = r.type == CONSTANT;
+    if (r.type == CONSTANT) {
+        opt->sym_value[symbol] = r.data.constant;
+        // the assignment has to stay to bind the name, but the value of the expression is known
+        if (bound.type == CONSTANT && instr.out >= 0) {
+            opt->slot_known[instr.out] = true;
+            opt->slot_value[instr.out] = r;
+        }
+    }
+}
+
+void opt_call(Optimizer* opt, Instruction instr) {
+    // the callee is never substituted, only the arguments
+    Data args = instr.data.binary.right;
+    if (args.type == ARGLIST) {
+        for (int i = 0; i < args.data.arglist.len; i++) {
+            args.data.arglist.args[i] = opt_resolve(opt, args.data.arglist.args[i]);
+        }
+    } else {
+        instr.data.binary.right = opt_resolve(opt, args);
+    }
+    opt_push(opt, instr);
+}
+
+void opt_unary(Optimizer* opt, Instruction instr) {
+    Data operand = opt_resolve(opt, instr.data.unary.operand);
+    UnaryOp op = instr.data.unary.op;
+    if (operand.type == CONSTANT) {
+        opt_replace(opt, instr.out, opt_constant(math_unary(op, operand.data.constant)));
+        opt->stats->folded++;
+        return;
+    }
+    if (op != NEG) {
+        instr.data.unary.operand = operand;
+        opt_push(opt, instr);
+        return;
+    }
+    if (operand.type == VARIABLE && opt->slot_neg[operand.data.variable]) {
+        opt_replace(opt, instr.out, opt->slot_neg_of[operand.data.variable]);
+        opt->stats->simplified++;
+        return;
+    }
+    instr.data.unary.operand = operand;
+    opt_push(opt, instr);
+    if (operand.type == VARIABLE) {
+        opt->slot_neg[instr.out] = true;
+        opt->slot_neg_of[instr.out] = operand;
+    }
+}
+
+// dead code elimination: a backward pass that keeps calls (the only side effect) and whatever they read,
+// directly or through names. with keep_names the last binding of every name counts as read as well, so the
+// variables keep the values they'd have had. errors of removed instructions, like reading an unknown name, go too.
+// runs on write-once slots, so before allocate_slots. returns the number of instructions removed
+typedef struct DeadCode {
+    bool* slot_live; // read by a kept instruction further on
+    bool* symbol_live; // the current binding is read further on
+} DeadCode;
+
+void dce_use(DeadCode* dc, Data d) {
+    if (d.type == VARIABLE && d.data.variable >= 0) {
+        dc->slot_live[d.data.variable] = true;
+    } else if (d.type == IDENTIFIER) {
+        dc->symbol_live[d.data.ident.symbol] = true;
+    } else if (d.type == ARGLIST) {
+        for (int i = 0; i < d.data.arglist.len; i++) {
+            dce_use(dc, d.data.arglist.args[i]);
+        }
+    }
+}
+
+bool dce_needed(DeadCode* dc, Instruction* instr) {
+    bool slot = instr->out >= 0 && dc->slot_live[instr->out];
+    if (instr->type != BINARY) return slot;
+    switch (instr->data.binary.op) {
+        case CALL:
+            return true;
+        case ASSIGN:
+            // a bad assignment is an error at run time, which stays
+            if (instr->data.binary.left.type != IDENTIFIER) return true;
+            return slot || dc->symbol_live[instr->data.binary.left.data.ident.symbol];
+        default:
+            return slot;
+    }
+}
+
+int eliminate_dead_code(InstructionArr* instructions, bool keep_names) {
+    uint32_t frame_size = instructions_frame_size(instructions) + 1;
+    uint32_t symbol_total = symbol_count() + 1;
+    DeadCode dc = {
+            .slot_live = calloc(frame_size, sizeof(bool)),
+            .symbol_live = malloc(symbol_total * sizeof(bool)),
+    };
+    for (uint32_t s = 0; s < symbol_total; s++) {
+        dc.symbol_live[s] = keep_names;
+    }
+    bool* keep = malloc((instructions->size + 1) * sizeof(bool));
+    for (int i = instructions->size - 1; i >= 0; i--) {
+        Instruction* instr = &instructions->data[i];
+        keep[i] = dce_needed(&dc, instr);
+        if (!keep[i]) continue;
+        // what this instruction writes isn't live before it, what it reads is
+        if (instr->out >= 0) dc.slot_live[instr->out] = false;
+        switch (instr->type) {
+            case BINARY:
+                if (instr->data.binary.op == ASSIGN && instr->data.binary.left.type == IDENTIFIER) {
+                    dc.symbol_live[instr->data.binary.left.data.ident.symbol] = false;
+                } else if (instr->data.binary.op != CALL) {
+                    dce_use(&dc, instr->data.binary.left);
+                }
+                dce_use(&dc, instr->data.binary.right);
+                break;
+            case UNARY:
+                dce_use(&dc, instr->data.unary.operand);
+                break;
+            case SET:
+                dce_use(&dc, instr->data.set);
+                break;
+        }
+    }
+    int kept = 0;
+    for (int i = 0; i < instructions->size; i++) {
+        if (keep[i]) instructions->data[kept++] = instructions->data[i];
+    }
+    int removed = instructions->size - kept;
+    instructions->size = kept;
+    free(keep);
+    free(dc.slot_live);
+    free(dc.symbol_live);
+    return removed;
+}
+
+// rewrites the instructions in place, stats can be NULL
+void optimize_instructions(InstructionArr* instructions, OptStats* stats) {
+    double start = stats_enabled ? stats_now() : 0;
+    OptStats local;
+    if (stats == NULL) stats = &local;
+    memset(stats, 0, sizeof(OptStats));
+    stats->before = instructions->size;
+
+    uint32_t frame_size = instructions_frame_size(instructions) + 1;
+    uint32_t symbol_total = symbol_count() + 1;
+    Optimizer opt = {
+            .out = newInstructionArr(),
+            .stats = stats,
+            .slot_known = calloc(frame_size, sizeof(bool)),
+            .slot_value = malloc(frame_size * sizeof(Data)),
+            .slot_kept = calloc(frame_size, sizeof(bool)),
+            .slot_neg = calloc(frame_size, sizeof(bool)),
+            .slot_neg_of = malloc(frame_size * sizeof(Data)),
+            .alias_head = malloc(symbol_total * sizeof(int)),
+            .alias_next = malloc(frame_size * sizeof(int)),
+            .sym_const = calloc(symbol_total, sizeof(bool)),
+            .sym_value = malloc(symbol_total * sizeof(double)),
+    };
+    for (uint32_t i = 0; i < symbol_total; i++) {
+        opt.alias_head[i] = -1;
+    }
+    reserveInstructionArr(opt.out, instructions->size);
+
+    for (int i = 0; i < instructions->size; i++) {
+        Instruction instr = instructions->data[i];
+        switch (instr.type) {
+            case BINARY:
+                switch (instr.data.binary.op) {
+                    case ASSIGN:
+                        opt_assign(&opt, instr);
+                        break;
+                    case CALL:
+                        opt_call(&opt, instr);
+                        break;
+                    default:
+                        opt_binary(&opt, instr);
+                        break;
+                }
+                break;
+            case UNARY:
+                opt_unary(&opt, instr);
+                break;
+            case SET:
+                opt_replace(&opt, instr.out, opt_resolve(&opt, instr.data.set));
+                stats->simplified++;
+                break;
+        }
+    }
+
+    // hand the rewritten buffer over to the caller's array
+    takeInstructionArr(instructions, opt.out);
+    delInstructionArr(opt.out);
+    stats->eliminated = eliminate_dead_code(instructions, true);
+    stats->after = instructions->size;
+
+    free(opt.slot_known);
+    free(opt.slot_value);
+    free(opt.slot_kept);
+    free(opt.slot_neg);
+    free(opt.slot_neg_of);
+    free(opt.alias_head);
+    free(opt.alias_next);
+    free(opt.sym_const);
+    free(opt.sym_value);
+    if (stats_enabled) stats_add_time(STATS_OPTIMIZE, stats_now() - start);
+}
+
+#endif //_OPTIMIZE_H
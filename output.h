@@ -0,0 +1,358 @@
+#pragma once
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "number.h"
+
+// what print writes. every engine formats its values straight into one process-wide buffer, which goes out with a
+// single write(2) when it fills up and at the end of every run, instead of a locked printf per value.
+// anything printed through stdio is flushed first, so it still comes out in order, and runtime errors flush the
+// buffer before they're printed. except on the dag engine's threads, where they come out ahead of whatever is
+// still in the buffer.
+// formats:
+//   fixed     "%f " per value and a newline per print, exactly what printf gives
+//   shortest  the fewest digits that read back as the same double, same layout
+//   binary    per print a uint32_t count and then the values as doubles, in the byte order of the machine
+// prints come from one thread at a time (the dag engine keeps every call in one chain), so the buffer isn't locked.
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+// the longest value there is: "%f" of -DBL_MAX is 317 characters
+#define OUTPUT_MAX_VALUE 384
+
+typedef enum OutputFormat {
+    OUTPUT_FIXED, OUTPUT_SHORTEST, OUTPUT_BINARY
+} OutputFormat;
+
+static const char* output_format_names[] = {
+        [OUTPUT_FIXED] = "fixed",
+        [OUTPUT_SHORTEST] = "shortest",
+        [OUTPUT_BINARY] = "binary",
+};
+
+typedef struct Output {
+    int fd;
+    OutputFormat format;
+    size_t len;
+    bool flush_at_exit; // registered with atexit, for output a run didn't flush
+    bool parallel; // prints run on one thread, errors on any of them
+    char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+static Output print_output = { STDOUT_FILENO, OUTPUT_FIXED, 0, false, false, {0} };
+
+bool output_format_from_name(const char* name, OutputFormat* format) {
+    for (int i = 0; i < (int)(sizeof(output_format_names) / sizeof(output_format_names[0])); i++) {
+        if (strcmp(output_format_names[i], name) == 0) {
+            *format = (OutputFormat)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void output_flush() {
+    if (print_output.len == 0) return;
+    fflush(stdout);
+    size_t done = 0;
+    while (done < print_output.len) {
+        ssize_t n = write(print_output.fd, print_output.buffer + done, print_output.len - done);
+        if (n < 0 && errno == EINTR) continue;
+        // nowhere left to report it, the output is dropped like printf would drop it
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    print_output.len = 0;
+}
+
+// called before a runtime error is printed, so it comes after the lines printed before it
+void output_before_error() {
+    if (!print_output.parallel) output_flush();
+}
+
+void output_set_format(OutputFormat format) {
+    output_flush();
+    print_output.format = format;
+}
+
+static inline char* output_reserve(size_t bytes) {
+    if (print_output.len + bytes > OUTPUT_BUFFER_SIZE) output_flush();
+    return print_output.buffer + print_output.len;
+}
+
+// writes value into out (at least 21 bytes), returns the length
+static inline int output_u64(char* out, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    for (int i = 0; i < n; i++) {
+        out[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+// "%f": the exact value of the double rounded to 6 decimals, ties to even. v = m * 2^e exactly, so the fraction is
+// m's low -e bits, and scaling those by 10^6 fits 128 bits. above 2^64 and for inf and nan it's snprintf
+int output_format_fixed(char* out, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int biased = (int)((bits >> 52) & 0x7FF);
+    if (biased >= 1023 + 64) return snprintf(out, OUTPUT_MAX_VALUE, "%f", v);
+    uint64_t m = bits & ((1ULL << 52) - 1);
+    if (biased == 0) {
+        biased = 1;
+    } else {
+        m |= 1ULL << 52;
+    }
+    int e = biased - 1075;
+    uint64_t integer = 0, micros = 0;
+    if (e >= 0) {
+        integer = m << e;
+    } else if (-e < 120) {
+        // below 2^-67 everything rounds to 0 and there are no ties
+        int s = -e;
+        unsigned __int128 mask = ((unsigned __int128)1 << s) - 1;
+        integer = s >= 64 ? 0 : m >> s;
+        unsigned __int128 scaled = ((unsigned __int128)m & mask) * 1000000u;
+        micros = (uint64_t)(scaled >> s);
+        unsigned __int128 rest = scaled & mask, half = (unsigned __int128)1 << (s - 1);
+        if (rest > half || (rest == half && (micros & 1))) micros++;
+        if (micros == 1000000) {
+            micros = 0;
+            integer++;
+        }
+    }
+    char* p = out;
+    if (bits >> 63) *p++ = '-';
+    p += output_u64(p, integer);
+    *p++ = '.';
+    for (int i = 5; i >= 0; i--) {
+        p[i] = (char)('0' + micros % 10);
+        micros /= 10;
+    }
+    return (int)(p + 6 - out);
+}
+
+static const uint64_t output_pow10[] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+        10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+        1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL
+};
+
+// floor(m * 2^e2 * 10^k), or one off where that is within a hair of an integer: m times the 128-bit
+// approximation of 5^k from the number parser's table, shifted by the powers of two
+uint64_t output_scaled(uint64_t m, int e2, int k) {
+    const uint64_t* pow5 = number_pow5[k - NUMBER_POW5_MIN];
+    uint64_t high, mid_high;
+    uint64_t mid = number_mul128(m, pow5[0], &high);
+    number_mul128(m, pow5[1], &mid_high);
+    mid += mid_high;
+    if (mid < mid_high) high++;
+    // the table holds 5^k * 2^(127 - floor(log2(5^k))), and floor(log2(5^k)) = floor(log2(10^k)) - k
+    int log2_pow5 = (int)((((152170 + 65536) * (int64_t)k) >> 16)) - k;
+    int shift = 127 - log2_pow5 - e2 - k - 64;
+    unsigned __int128 top = ((unsigned __int128)high << 64) | mid;
+    return (uint64_t)(top >> shift);
+}
+
+// whether p of the 17 digits in c, rounded, read back as v. c * 10^-k is v to within one unit of c
+bool output_round_trips(double v, uint64_t c, int k, int p, uint64_t* digits, int* exponent) {
+    int drop = 17 - p;
+    uint64_t d = c / output_pow10[drop], rest = c % output_pow10[drop];
+    // v is between d and d + 1 at this precision, the nearer one first
+    uint64_t first = rest * 2 < output_pow10[drop] ? d : d + 1;
+    uint64_t second = first == d ? d + 1 : d;
+    uint64_t candidates[2] = { first, second };
+    for (int i = 0; i < 2; i++) {
+        if (candidates[i] != 0 && number_from_decimal(candidates[i], drop - k) == v) {
+            *digits = candidates[i];
+            *exponent = drop - k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// through snprintf and strtod, for the tiny numbers that are out of the table's range
+void output_shortest_slow(double v, uint64_t* digits, int* exponent) {
+    char text[40];
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, v);
+        if (precision < 17 && strtod(text, NULL) != v) continue;
+        uint64_t d = 0;
+        char* p = text;
+        for (; *p != 'e'; p++) {
+            if (*p != '.') d = d * 10 + (uint64_t)(*p - '0');
+        }
+        *digits = d;
+        *exponent = atoi(p + 1) - (precision - 1);
+        return;
+    }
+}
+
+// digits * 10^exponent reads back as v (positive and finite) with as few digits as there can be.
+// v scaled to 17 digits always reads back. the shorter candidates are that rounded to fewer digits, and which
+// of those read back is checked with the parser's correctly rounded conversion. a precision that reads back
+// still does with a digit more, so the fewest is found by bisecting
+void output_shortest_digits(double v, uint64_t* digits, int* exponent) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int biased = (int)(bits >> 52);
+    uint64_t m = bits & ((1ULL << 52) - 1);
+    if (biased == 0) {
+        biased = 1;
+    } else {
+        m |= 1ULL << 52;
+    }
+    int e2 = biased - 1075;
+    // floor(log10(2^(e2 + 52))), which is floor(log10(v)) or one less. subnormals have fewer bits
+    int k = 16 - (m >> 52 ? (int)(((int64_t)(e2 + 52) * 78913) >> 18) : (int)floor(log10(v)));
+    if (k > NUMBER_POW5_MAX - 1) {
+        output_shortest_slow(v, digits, exponent);
+        return;
+    }
+    uint64_t c = output_scaled(m, e2, k);
+    if (c < output_pow10[16]) {
+        c = output_scaled(m, e2, ++k);
+    } else if (c >= output_pow10[17]) {
+        c = output_scaled(m, e2, --k);
+    }
+    int low = 1, high = 17;
+    *digits = c;
+    *exponent = -k;
+    output_round_trips(v, c, k, 17, digits, exponent);
+    while (low < high) {
+        int p = (low + high) / 2;
+        uint64_t d;
+        int e;
+        if (output_round_trips(v, c, k, p, &d, &e)) {
+            high = p;
+            *digits = d;
+            *exponent = e;
+        } else {
+            low = p + 1;
+        }
+    }
+}
+
+// shortest round-trip text, like %.17g but with only the digits it takes: plain notation from 1e-5 up to 1e17,
+// scientific outside of that
+int output_format_shortest(char* out, double v) {
+    char* p = out;
+    if (signbit(v)) {
+        *p++ = '-';
+        v = -v;
+    }
+    if (v != v || v == INFINITY) {
+        // printf's spelling, -nan included
+        memcpy(p, v != v ? "nan" : "inf", 3);
+        return (int)(p + 3 - out);
+    }
+    if (v == 0) {
+        *p++ = '0';
+        return (int)(p - out);
+    }
+    uint64_t digits = 0;
+    int exponent = 0;
+    output_shortest_digits(v, &digits, &exponent);
+    while (digits % 10 == 0) {
+        digits /= 10;
+        exponent++;
+    }
+    char text[20];
+    int n = output_u64(text, digits);
+    int point = n + exponent; // digits before the decimal point
+    if (point > -5 && point <= 17) {
+        if (point <= 0) {
+            *p++ = '0';
+            *p++ = '.';
+            for (int i = point; i < 0; i++) *p++ = '0';
+            memcpy(p, text, n);
+            p += n;
+        } else if (point >= n) {
+            memcpy(p, text, n);
+            p += n;
+            for (int i = n; i < point; i++) *p++ = '0';
+        } else {
+            memcpy(p, text, point);
+            p += point;
+            *p++ = '.';
+            memcpy(p, text + point, n - point);
+            p += n - point;
+        }
+    } else {
+        *p++ = text[0];
+        if (n > 1) {
+            *p++ = '.';
+            memcpy(p, text + 1, n - 1);
+            p += n - 1;
+        }
+        int e = point - 1;
+        *p++ = 'e';
+        *p++ = e < 0 ? '-' : '+';
+        if (e < 0) e = -e;
+        if (e < 10) *p++ = '0';
+        p += output_u64(p, (uint64_t)e);
+    }
+    return (int)(p - out);
+}
+
+// a print of count values is output_begin, count output_values and output_end
+static inline void output_begin(uint32_t count) {
+    if (!print_output.flush_at_exit) {
+        print_output.flush_at_exit = true;
+        atexit(output_flush);
+    }
+    if (print_output.format == OUTPUT_BINARY) {
+        memcpy(output_reserve(sizeof(count)), &count, sizeof(count));
+        print_output.len += sizeof(count);
+    }
+}
+
+static inline void output_value(double v) {
+    char* p = output_reserve(OUTPUT_MAX_VALUE);
+    switch (print_output.format) {
+        case OUTPUT_FIXED:
+            p += output_format_fixed(p, v);
+            *p++ = ' ';
+            break;
+        case OUTPUT_SHORTEST:
+            p += output_format_shortest(p, v);
+            *p++ = ' ';
+            break;
+        case OUTPUT_BINARY:
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+    }
+    print_output.len = (size_t)(p - print_output.buffer);
+}
+
+static inline void output_end() {
+    if (print_output.format != OUTPUT_BINARY) {
+        *output_reserve(1) = '\n';
+        print_output.len++;
+    }
+}
+
+// a print in bytecode form: the values are the registers listed in args
+static inline void output_registers(const double* regs, const uint32_t* args, uint32_t count) {
+    output_begin(count);
+    for (uint32_t j = 0; j < count; j++) {
+        output_value(regs[args[j]]);
+    }
+    output_end();
+}
+
+#endif //_OUTPUT_H
@@ -0,0 +1,189 @@
+#pragma once
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include "asm.h"
+#include "pool.h"
+
+// gen_code on every core: the same instructions, slot numbers and symbol indices, compiled in parallel.
+// the script is split at its ';'s up front and cut into chunks of consecutive statements. every chunk is compiled
+// on the pool as if it were a script of its own: slots numbered from 0, names interned into a table of its own,
+// arglists in an arena of its own. then, in program order, each chunk's names are interned into the process-wide
+// table (which gives them the indices the serial compiler would have) and its first slot is the slot count of
+// the chunks before it. a second parallel pass copies every chunk into place while renumbering.
+
+// below this many statements the threads aren't worth starting
+#define PARALLEL_MIN_STATEMENTS 256
+// chunks per thread, so a slow chunk doesn't hold up the others
+#define PARALLEL_CHUNKS_PER_THREAD 8
+
+typedef struct CompileChunk {
+    char** statements;
+    uint32_t count;
+    InstructionArr* instructions;
+    SymbolTable symbols;
+    Arena* arena;
+    uint32_t slots; // slots the chunk's statements use, numbered from 0
+    bool failed; // a statement had a syntax error
+    // filled in by the merge
+    int* symbol_map; // chunk symbol -> process-wide symbol
+    uint32_t first_slot;
+    int first_instruction;
+} CompileChunk;
+
+typedef struct ParallelCompile {
+    CompileChunk* chunks;
+    InstructionArr* out;
+} ParallelCompile;
+
+void parallel_compile_chunk(void* ctx, uint32_t index, uint32_t worker) {
+    (void)worker;
+    CompileChunk* chunk = &((ParallelCompile*)ctx)->chunks[index];
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < chunk->count; i++) {
+        AsmWriter* aw = asm_writer_create_into(chunk->statements[i], offset, chunk->arena, chunk->instructions,
+                                               &chunk->symbols);
+        offset = aw->cur_var;
+        if (aw->failed) chunk->failed = true;
+    }
+    chunk->slots = offset;
+}
+
+void parallel_relocate(CompileChunk* chunk, Data* d) {
+    if (d->type == VARIABLE && d->data.variable >= 0) {
+        d->data.variable += (int)chunk->first_slot;
+    } else if (d->type == IDENTIFIER) {
+        d->data.ident.symbol = chunk->symbol_map[d->data.ident.symbol];
+        d->data.ident.name = (char*)symbol_name(d->data.ident.symbol);
+    } else if (d->type == ARGLIST) {
+        for (int i = 0; i < d->data.arglist.len; i++) {
+            parallel_relocate(chunk, &d->data.arglist.args[i]);
+        }
+    }
+}
+
+// copies a chunk into its place in the result, moving its slots and symbols to where they are in the whole program
+void parallel_relocate_chunk(void* ctx, uint32_t index, uint32_t worker) {
+    (void)worker;
+    ParallelCompile* pc = ctx;
+    CompileChunk* chunk = &pc->chunks[index];
+    Instruction* out = pc->out->data + chunk->first_instruction;
+    for (int i = 0; i < chunk->instructions->size; i++) {
+        Instruction instr = chunk->instructions->data[i];
+        if (instr.out >= 0) instr.out += (int)chunk->first_slot;
+        switch (instr.type) {
+            case BINARY:
+                parallel_relocate(chunk, &instr.data.binary.left);
+                parallel_relocate(chunk, &instr.data.binary.right);
+                break;
+            case UNARY:
+                parallel_relocate(chunk, &instr.data.unary.operand);
+                break;
+            case SET:
+                parallel_relocate(chunk, &instr.data.set);
+                break;
+        }
+        out[i] = instr;
+    }
+}
+
+// same result as gen_code_checked(expr, arena, failed), pool NULL means pool_global().
+// the arena's allocator is called from the pool's threads.
+// with stats on, or a short script, or a single thread, this is just gen_code_checked, and doesn't start the pool
+InstructionArr* gen_code_parallel_checked(const char* expr, Arena* arena, ThreadPool* pool, bool* failed) {
+    if (stats_enabled) {
+        return gen_code_checked(expr, arena, failed);
+    }
+
+    // split exactly like gen_code's strtok: runs of characters between ';'s, empty ones skipped
+    size_t len = strlen(expr);
+    char* str = arena_strndup(arena, expr, len);
+    uint32_t count = 0, capacity = 1024;
+    char** statements = malloc(capacity * sizeof(char*));
+    for (char* p = str; *p;) {
+        if (*p == ';') {
+            p++;
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            statements = realloc(statements, capacity * sizeof(char*));
+        }
+        statements[count++] = p;
+        char* end = strchr(p, ';');
+        if (end == NULL) break;
+        *end = '\0';
+        p = end + 1;
+    }
+    if (pool == NULL && count >= PARALLEL_MIN_STATEMENTS) pool = pool_global();
+    if (count < PARALLEL_MIN_STATEMENTS || pool->thread_count == 1) {
+        free(statements);
+        return gen_code_checked(expr, arena, failed);
+    }
+
+    // chunks of about the same number of bytes
+    uint32_t chunk_count = pool->thread_count * PARALLEL_CHUNKS_PER_THREAD;
+    if (chunk_count > count) chunk_count = count;
+    CompileChunk* chunks = calloc(chunk_count, sizeof(CompileChunk));
+    size_t per_chunk = len / chunk_count + 1;
+    uint32_t next = 0;
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        CompileChunk* chunk = &chunks[c];
+        chunk->statements = statements + next;
+        size_t limit = (size_t)(statements[next] - str) + per_chunk;
+        // at least one statement, and enough left over for the chunks after this one
+        do {
+            next++;
+        } while (next < count && (size_t)(statements[next] - str) < limit && count - next > chunk_count - c - 1);
+        if (c == chunk_count - 1) next = count;
+        chunk->count = (uint32_t)(statements + next - chunk->statements);
+        chunk->instructions = newInstructionArr();
+        chunk->arena = arena_create_with(arena->allocator, arena->block_size);
+    }
+
+    ParallelCompile pc = { .chunks = chunks, .out = NULL };
+    pool_run(pool, chunk_count, parallel_compile_chunk, &pc);
+
+    // in program order, so names get the indices gen_code would have given them
+    uint32_t slots = 0;
+    int total = 0;
+    if (failed) *failed = false;
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        CompileChunk* chunk = &chunks[c];
+        if (failed && chunk->failed) *failed = true;
+        uint32_t names = symbol_table_count(&chunk->symbols);
+        chunk->symbol_map = malloc((names + 1) * sizeof(int));
+        for (uint32_t s = 0; s < names; s++) {
+            chunk->symbol_map[s] = symbol_intern(chunk->symbols.names->data[s]);
+        }
+        chunk->first_slot = slots;
+        chunk->first_instruction = total;
+        slots += chunk->slots;
+        total += chunk->instructions->size;
+    }
+    pc.out = newInstructionArr();
+    if (reserveInstructionArr(pc.out, total)) {
+        pc.out->size = total;
+        pool_run(pool, chunk_count, parallel_relocate_chunk, &pc);
+    } else if (failed) {
+        // out of memory, which was printed, and nothing was compiled
+        *failed = true;
+    }
+
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        free_instructions(chunks[c].instructions);
+        symbol_table_free(&chunks[c].symbols);
+        free(chunks[c].symbol_map);
+        // the arglists stay where they are, now owned by the caller's arena
+        arena_adopt(arena, chunks[c].arena);
+    }
+    free(chunks);
+    free(statements);
+    return pc.out;
+}
+
+InstructionArr* gen_code_parallel(const char* expr, Arena* arena, ThreadPool* pool) {
+    return gen_code_parallel_checked(expr, arena, pool, NULL);
+}
+
+#endif //_PARALLEL_H
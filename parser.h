@@ -3,6 +3,7 @@
 #define _PARSER_H
 
 #include "lexer.h"
+#include "number.h"
 
 typedef enum ExprNodeType {
     NT_ERROR, NT_NUMBER, NT_POSITIVE, NT_NEGATIVE, NT_ADD, NT_SUB, NT_MUL, NT_DIV, NT_IDENT, NT_CALL, NT_ARGS, NT_ASSIGN
@@ -53,9 +54,11 @@ static Precedence precedence[] = {
 };
 
 typedef struct Parser {
+    Arena* arena; // nodes and identifier strings live here, the tree is released with the arena
     Lexer* lexer;
     Token curr;
     bool has_first;
+    bool failed; // an error was printed, the tree has holes in it
 } Parser;
 
 void parser_advance(Parser* parser) {
@@ -65,28 +68,17 @@ void parser_advance(Parser* parser) {
 double token_to_double(Token token) {
     if (token.type != TT_NUM) {
         printf("Warning %d: token_to_double called on non-number token: %d\n", token.line, token.type);
+        return 0;
     }
-    char* str = malloc(token.length + 1);
-    memcpy(str, token.start, token.length);
-    str[token.length] = '\0';
-    double num = strtod(str, NULL);
-    free(str);
-    return num;
+    return number_parse(token.start, token.length);
 }
 
-ExprNode* parser_parse_expr(Parser* parser, Precedence prec);
-
-ExprNode* parser_parse_args(Parser* parser) {
-    ExprNode* node = malloc(sizeof(ExprNode));
+ExprNode* parser_new_node(Parser* parser, ExprNodeType type) {
+    ExprNode* node = arena_alloc(parser->arena, sizeof(ExprNode));
+    // infix nodes only get their type after this, they are counted then
+    if (stats_enabled && type != NT_ERROR) exec_stats.ast_nodes[type]++;
     node->top_level = false;
-    node->type = NT_ARGS;
-    node->binary.left = parser_parse_expr(parser, PREC_MIN);
-    if (parser->curr.type == TT_COMMA) {
-        parser_advance(parser);
-        node->binary.right = parser_parse_args(parser);
-    } else {
-        node->binary.right = NULL;
-    }
+    node->type = type;
     return node;
 }
 
@@ -95,9 +87,7 @@ ExprNode* parser_parse_number(Parser* parser) {
         printf("ERROR %d: Expected number\n", parser->curr.line);
         return NULL;
     }
-    ExprNode* node = malloc(sizeof(ExprNode));
-    node->top_level = false;
-    node->type = NT_NUMBER;
+    ExprNode* node = parser_new_node(parser, NT_NUMBER);
     node->number = token_to_double(parser->curr);
     parser_advance(parser);
     return node;
@@ -108,150 +98,230 @@ ExprNode* parser_parse_ident(Parser* parser) {
         printf("ERROR %d: Expected identifier\n", parser->curr.line);
         return NULL;
     }
-    ExprNode* node = malloc(sizeof(ExprNode));
-    node->top_level = false;
-    node->type = NT_IDENT;
-    node->ident.identifier = malloc(parser->curr.length + 1);
-    memcpy(node->ident.identifier, parser->curr.start, parser->curr.length);
-    node->ident.identifier[parser->curr.length] = '\0';
+    ExprNode* node = parser_new_node(parser, NT_IDENT);
+    node->ident.identifier = arena_strndup(parser->arena, parser->curr.start, parser->curr.length);
     parser_advance(parser);
     return node;
 }
 
-ExprNode* parser_parse_infix_expr(Parser* parser, Token op, ExprNode* left) {
-    ExprNode* node = malloc(sizeof(ExprNode));
-    node->top_level = false;
+// the parser is a pratt parser whose recursion lives on a heap-allocated stack of frames instead of the c stack,
+// so how deep an expression nests, or how many arguments a call has, is only bounded by memory.
+// every frame is one call of a recursive descent: parsing an expression, a terminal, an infix operator's right side
+// or an argument list, plus the point it resumes at once the frame it pushed has returned its node.
+// an argument list is a loop in its frame, not a frame per argument.
+
+typedef enum ParseStep {
+    PS_EXPR, PS_EXPR_LEFT, PS_EXPR_RIGHT, // parser_parse_expr, after the terminal, after an infix operator's right side
+    PS_TERMINAL, PS_PAREN, PS_UNARY, PS_CALL_PARENS, PS_CALL_BARE, // a terminal, after what it parsed
+    PS_ARGS, // after an argument
+} ParseStep;
+
+typedef struct ParseFrame {
+    ParseStep step;
+    Precedence prec;
+    ExprNode* node; // the expression so far, the unary or call being filled in, or the first argument
+    ExprNode* last; // the last argument
+} ParseFrame;
+
+dynarr(ParseFrameArr, ParseFrame);
+
+static inline void parser_push(struct ParseFrameArr* stack, ParseStep step, Precedence prec) {
+    ParseFrame frame = { .step = step, .prec = prec };
+    pushParseFrameArr(stack, frame);
+}
+
+// after a terminal: a number, name or parenthesis right after it makes it a call
+static inline bool parser_call_follows(Parser* parser) {
+    return parser->curr.type == TT_NUM || parser->curr.type == TT_LPAREN || parser->curr.type == TT_IDENT;
+}
+
+// starts the call on the terminal in the top frame, whose node is the callee
+static inline void parser_begin_call(Parser* parser, struct ParseFrameArr* stack) {
+    ParseFrame* frame = &stack->data[stack->size - 1];
+    ExprNode* call = parser_new_node(parser, NT_CALL);
+    call->binary.left = frame->node;
+    frame->node = call;
+    if (parser->curr.type == TT_LPAREN) {
+        // the parentheses belong to the call, so a call in the arguments can't take the commas after it
+        parser_advance(parser);
+        frame->step = PS_CALL_PARENS;
+    } else {
+        frame->step = PS_CALL_BARE;
+    }
+    ExprNode* args = parser_new_node(parser, NT_ARGS);
+    args->binary.right = NULL;
+    parser_push(stack, PS_ARGS, PREC_MIN);
+    stack->data[stack->size - 1].node = args;
+    stack->data[stack->size - 1].last = args;
+    parser_push(stack, PS_EXPR, PREC_MIN);
+}
+
+// the top frame's expression is complete up to the current token: either an infix operator binds tighter than the
+// frame's precedence and its right side is parsed next, or the expression is returned
+static inline void parser_operator(Parser* parser, struct ParseFrameArr* stack, ExprNode** result) {
+    ParseFrame* frame = &stack->data[stack->size - 1];
+    Token op = parser->curr;
+    Precedence next_prec = precedence[op.type];
+    if (next_prec == PREC_MIN || frame->prec >= next_prec) {
+        *result = frame->node;
+        stack->size--;
+        return;
+    }
+    parser_advance(parser);
+    ExprNode* node = parser_new_node(parser, NT_ERROR);
     switch (op.type) {
         case TT_PLUS: node->type = NT_ADD; break;
         case TT_MINUS: node->type = NT_SUB; break;
         case TT_STAR: node->type = NT_MUL; break;
         case TT_SLASH: node->type = NT_DIV; break;
         case TT_ASSIGN: node->type = NT_ASSIGN; break;
-        case TT_RPAREN: return left; // I don't know why this happens, but when I change the lexer tokens to start at 1, this isn't necessary, but i'm leaving it in
         default: node->type = NT_ERROR; printf("ERROR %d: infixExpr bad op %d\n", op.line, op.type); break;
     }
-    node->binary.left = left;
-    node->binary.right = parser_parse_expr(parser, precedence[op.type]);
-    return node;
+    if (stats_enabled) exec_stats.ast_nodes[node->type]++;
+    node->binary.left = frame->node;
+    frame->node = node;
+    frame->step = PS_EXPR_RIGHT;
+    parser_push(stack, PS_EXPR, precedence[op.type]);
 }
 
-ExprNode* parser_parse_terminal_expr(Parser* parser) {
-    ExprNode* node = NULL;
-    if (parser->curr.type == TT_NUM) {
-        node = parser_parse_number(parser);
-    } else if (parser->curr.type == TT_IDENT) {
-        node = parser_parse_ident(parser);
-        if (node == NULL) {
-            printf("ERROR %d: Expected identifier\n", parser->curr.line);
-        }
-    } else if (parser->curr.type == TT_LPAREN) {
-        parser_advance(parser);
-        node = parser_parse_expr(parser, PREC_MIN);
-        if (parser->curr.type == TT_RPAREN) {
-            parser_advance(parser);
-        } else if (parser->curr.type == TT_COMMA) {
-            // we need to progress to the next token
-        } else {
-            printf("ERROR %d: Expected ')'\n", parser->curr.line);
-            return NULL;
-        }
-    } else if (parser->curr.type == TT_PLUS) {
-        parser_advance(parser);
-        node = (ExprNode*)malloc(sizeof(ExprNode));
-        node->top_level = false;
-        node->type = NT_POSITIVE;
-        node->unary.operand = parser_parse_terminal_expr(parser);
-    } else if (parser->curr.type == TT_MINUS) {
-        parser_advance(parser);
-        node = (ExprNode*)malloc(sizeof(ExprNode));
-        node->top_level = false;
-        node->type = NT_NEGATIVE;
-        node->unary.operand = parser_parse_terminal_expr(parser);
+// the top frame's terminal is complete, unless it's the callee of a call
+static inline void parser_terminal_done(Parser* parser, struct ParseFrameArr* stack, ExprNode** result) {
+    if (parser_call_follows(parser)) {
+        parser_begin_call(parser, stack);
     } else {
-        printf("ERROR %d: Expected number or '(' or unary operator\n", parser->curr.line);
-        return NULL;
-    }
-    if (parser->curr.type == TT_NUM || parser->curr.type == TT_LPAREN || parser->curr.type == TT_IDENT) {
-        // call
-        ExprNode* call = (ExprNode*)malloc(sizeof(ExprNode));
-        call->top_level = false;
-        call->type = NT_CALL;
-        call->binary.left = node;
-        call->binary.right = parser_parse_args(parser);
-        node = call;
+        *result = stack->data[stack->size - 1].node;
+        stack->size--;
     }
-    return node;
 }
 
 ExprNode* parser_parse_expr(Parser* parser, Precedence prec) {
-    if (parser->curr.type == TT_EOF) {
-        printf("ERROR %d: Expected expression\n", parser->curr.line);
-        return NULL;
-    } else if (parser->curr.type == TT_COMMA) {
-        printf("ERROR %d: Unexpected ','\n", parser->curr.line);
-        return NULL;
-    }
-    ExprNode* left = parser_parse_terminal_expr(parser);
-    if (!parser->has_first) {
-        left->top_level = true;
-        parser->has_first = true;
-    }
-    Token op = parser->curr;
-    if (op.type == TT_EOF) {
-        return left;
-    } else if (op.type == TT_COMMA) {
-        return left;
-    } else if (op.type == TT_RPAREN) {
-        return left;
-    }
-    Precedence next_prec = precedence[op.type];
-    while (next_prec != PREC_MIN) {
-        if (prec >= next_prec) {
-            break;
-        } else {
-            parser_advance(parser);
-            left = parser_parse_infix_expr(parser, op, left);
-            op = parser->curr;
-            next_prec = precedence[op.type];
+    struct ParseFrameArr stack = {0};
+    parser_push(&stack, PS_EXPR, prec);
+    // what the last frame to finish returned
+    ExprNode* result = NULL;
+    while (stack.size > 0) {
+        ParseFrame* frame = &stack.data[stack.size - 1];
+        switch (frame->step) {
+            case PS_EXPR:
+                if (parser->curr.type == TT_EOF) {
+                    printf("ERROR %d: Expected expression\n", parser->curr.line);
+                    parser->failed = true;
+                    result = NULL;
+                    stack.size--;
+                } else if (parser->curr.type == TT_COMMA) {
+                    printf("ERROR %d: Unexpected ','\n", parser->curr.line);
+                    parser->failed = true;
+                    result = NULL;
+                    stack.size--;
+                } else {
+                    frame->step = PS_EXPR_LEFT;
+                    parser_push(&stack, PS_TERMINAL, PREC_MIN);
+                }
+                break;
+            case PS_EXPR_LEFT:
+                frame->node = result;
+                if (result && !parser->has_first) {
+                    result->top_level = true;
+                    parser->has_first = true;
+                }
+                parser_operator(parser, &stack, &result);
+                break;
+            case PS_EXPR_RIGHT:
+                frame->node->binary.right = result;
+                parser_operator(parser, &stack, &result);
+                break;
+            case PS_TERMINAL:
+                if (parser->curr.type == TT_NUM) {
+                    frame->node = parser_parse_number(parser);
+                } else if (parser->curr.type == TT_IDENT) {
+                    frame->node = parser_parse_ident(parser);
+                } else if (parser->curr.type == TT_LPAREN) {
+                    parser_advance(parser);
+                    frame->step = PS_PAREN;
+                    parser_push(&stack, PS_EXPR, PREC_MIN);
+                    break;
+                } else if (parser->curr.type == TT_PLUS || parser->curr.type == TT_MINUS) {
+                    ExprNodeType type = parser->curr.type == TT_PLUS ? NT_POSITIVE : NT_NEGATIVE;
+                    parser_advance(parser);
+                    frame->node = parser_new_node(parser, type);
+                    frame->step = PS_UNARY;
+                    parser_push(&stack, PS_TERMINAL, PREC_MIN);
+                    break;
+                } else {
+                    printf("ERROR %d: Expected number or '(' or unary operator\n", parser->curr.line);
+                    parser->failed = true;
+                    result = NULL;
+                    stack.size--;
+                    break;
+                }
+                parser_terminal_done(parser, &stack, &result);
+                break;
+            case PS_PAREN:
+                frame->node = result;
+                if (parser->curr.type == TT_RPAREN) {
+                    parser_advance(parser);
+                } else if (parser->curr.type != TT_COMMA) {
+                    // a ',' is left for the argument list the parenthesis is in
+                    printf("ERROR %d: Expected ')'\n", parser->curr.line);
+                    parser->failed = true;
+                    result = NULL;
+                    stack.size--;
+                    break;
+                }
+                parser_terminal_done(parser, &stack, &result);
+                break;
+            case PS_UNARY:
+                frame->node->unary.operand = result;
+                parser_terminal_done(parser, &stack, &result);
+                break;
+            case PS_CALL_PARENS:
+                frame->node->binary.right = result;
+                if (parser->curr.type != TT_RPAREN) {
+                    printf("ERROR %d: Expected ')'\n", parser->curr.line);
+                    parser->failed = true;
+                    result = NULL;
+                    stack.size--;
+                    break;
+                }
+                parser_advance(parser);
+                result = frame->node;
+                stack.size--;
+                break;
+            case PS_CALL_BARE:
+                frame->node->binary.right = result;
+                result = frame->node;
+                stack.size--;
+                break;
+            case PS_ARGS:
+                frame->last->binary.left = result;
+                if (parser->curr.type == TT_COMMA) {
+                    parser_advance(parser);
+                    ExprNode* next = parser_new_node(parser, NT_ARGS);
+                    next->binary.right = NULL;
+                    frame->last->binary.right = next;
+                    frame->last = next;
+                    parser_push(&stack, PS_EXPR, PREC_MIN);
+                } else {
+                    result = frame->node;
+                    stack.size--;
+                }
+                break;
         }
     }
-    return left;
+    free(stack.data);
+    return result;
 }
 
-
-Parser* parser_create(const char* expr) {
-    Parser* parser = malloc(sizeof(Parser));
-    parser->lexer = lexer_create(expr);
+Parser* parser_create(const char* expr, Arena* arena) {
+    Parser* parser = arena_alloc(arena, sizeof(Parser));
+    parser->arena = arena;
+    parser->lexer = lexer_create(expr, arena);
     parser->has_first = false;
+    parser->failed = false;
     parser_advance(parser);
     return parser;
 }
 
-void parser_free(Parser* parser) {
-    lexer_free(parser->lexer);
-    free(parser);
-}
-
-void __internal_tree_free(ExprNode* tree) {
-    if (tree->type == NT_NUMBER) {
-        free(tree);
-    } else if (tree->type == NT_POSITIVE || tree->type == NT_NEGATIVE) {
-        __internal_tree_free(tree->unary.operand);
-        free(tree);
-    } else {
-        __internal_tree_free(tree->binary.left);
-        __internal_tree_free(tree->binary.right);
-        free(tree);
-    }
-}
-
-void tree_free(ExprNode* tree) {
-    if (tree->top_level == false) {
-        printf("ERROR: Cannot free part of a tree!\n");
-    }
-    __internal_tree_free(tree);
-}
-
 void printTree(ExprNode *tree, uint32_t depth) {
     for(uint32_t i = 0; i < depth; i++) {
         if (i == depth - 1) {
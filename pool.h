@@ -0,0 +1,153 @@
+#pragma once
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// fixed set of worker threads that run parallel loops: pool_run calls task(ctx, index, worker) once for every index
+// below count, spread over the workers and the calling thread, and returns when all of them are done.
+// indices are handed out one at a time from a shared counter, so uneven tasks still balance.
+// the caller is worker 0, so a pool of one thread has no workers and runs everything inline.
+
+typedef void (*PoolTask)(void* ctx, uint32_t index, uint32_t worker);
+
+typedef struct ThreadPool {
+    pthread_t* threads;
+    uint32_t thread_count; // including the caller
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    uint64_t generation; // bumped for every pool_run, workers wait for it to change
+    uint32_t busy; // workers still inside the current run
+    bool stop;
+    PoolTask task;
+    void* ctx;
+    uint32_t count;
+    atomic_uint next;
+} ThreadPool;
+
+typedef struct PoolWorker {
+    ThreadPool* pool;
+    uint32_t id;
+} PoolWorker;
+
+void pool_drain(ThreadPool* pool, uint32_t worker) {
+    uint32_t index;
+    while ((index = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed)) < pool->count) {
+        pool->task(pool->ctx, index, worker);
+    }
+}
+
+void* pool_worker_main(void* arg) {
+    PoolWorker* self = arg;
+    ThreadPool* pool = self->pool;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stop) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        pool_drain(pool, self->id);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(self);
+    return NULL;
+}
+
+uint32_t pool_cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+// threads is the total, caller included. 0 means one per cpu
+ThreadPool* pool_create(uint32_t threads) {
+    ThreadPool* pool = malloc(sizeof(ThreadPool));
+    pool->thread_count = threads ? threads : pool_cpu_count();
+    pool->threads = malloc(pool->thread_count * sizeof(pthread_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->busy = 0;
+    pool->stop = false;
+    pool->task = NULL;
+    pool->ctx = NULL;
+    pool->count = 0;
+    atomic_init(&pool->next, 0);
+    for (uint32_t i = 1; i < pool->thread_count; i++) {
+        PoolWorker* worker = malloc(sizeof(PoolWorker));
+        worker->pool = pool;
+        worker->id = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_worker_main, worker) != 0) {
+            printf("ERROR: failed to start a pool thread, running with %u\n", i);
+            free(worker);
+            pool->thread_count = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+void pool_run(ThreadPool* pool, uint32_t count, PoolTask task, void* ctx) {
+    if (pool->thread_count == 1 || count <= 1) {
+        for (uint32_t i = 0; i < count; i++) task(ctx, i, 0);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->count = count;
+    atomic_store_explicit(&pool->next, 0, memory_order_relaxed);
+    pool->busy = pool->thread_count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_drain(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 1; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
+
+// process-wide pool with a thread per cpu, created on first use
+static ThreadPool* global_thread_pool = NULL;
+
+ThreadPool* pool_global() {
+    if (global_thread_pool == NULL) {
+        global_thread_pool = pool_create(0);
+    }
+    return global_thread_pool;
+}
+
+#endif //_POOL_H
@@ -0,0 +1,297 @@
+#pragma once
+#ifndef _REACTIVE_H
+#define _REACTIVE_H
+
+#include "stream.h"
+
+// a script kept live like a spreadsheet: compiled and run once, then reactive_set_input changes one of its inputs
+// and re-runs only the instructions whose value can change.
+// the dependency graph is between instructions: every slot is written by one instruction, and a name is read
+// through the slot it's bound to at that point in the program, which is followed statically like in dag.h.
+// to re-run an instruction on its own, names are resolved at compile time into a copy of the program, replay:
+// reads of a name become reads of its slot, and assignments that copy a value become SETs. assignments that only
+// bind a name to a slot have nothing to redo and aren't in the graph.
+// an input is a name's first assignment. setting it replaces the instruction that computed that value with the new
+// value, like editing the script would, so `rate = 5` and `rate = -5` both work and a computed name can be pinned.
+// dirty instructions run in program order, which is a topological order of the graph, and an instruction whose
+// value didn't change doesn't dirty the ones that read it. a print runs again when one of its arguments changed.
+
+typedef struct ReactiveProgram {
+    Arena* arena;
+    InstructionArr* instructions;
+    Instruction* replay;
+    InstrVM* vm;
+    int* input; // symbol -> instruction that computes its first value, -1 if the name is never assigned
+    uint32_t symbol_count;
+    // instructions that read an instruction's value, grouped per instruction
+    uint32_t* first_successor;
+    uint32_t* successors;
+    // dirty instructions, a min-heap so they come out in program order
+    uint32_t* heap;
+    uint32_t heap_size;
+    bool* queued;
+    uint32_t last_run; // instructions the last reactive_set_input ran, a full run is instructions->size
+    uint64_t total_run;
+    uint64_t total_skipped;
+} ReactiveProgram;
+
+void reactive_push(ReactiveProgram* program, uint32_t i) {
+    if (program->queued[i]) return;
+    program->queued[i] = true;
+    uint32_t at = program->heap_size++;
+    while (at > 0 && program->heap[(at - 1) / 2] > i) {
+        program->heap[at] = program->heap[(at - 1) / 2];
+        at = (at - 1) / 2;
+    }
+    program->heap[at] = i;
+}
+
+uint32_t reactive_pop(ReactiveProgram* program) {
+    uint32_t top = program->heap[0];
+    uint32_t last = program->heap[--program->heap_size];
+    uint32_t at = 0;
+    for (;;) {
+        uint32_t child = at * 2 + 1;
+        if (child >= program->heap_size) break;
+        if (child + 1 < program->heap_size && program->heap[child + 1] < program->heap[child]) child++;
+        if (program->heap[child] >= last) break;
+        program->heap[at] = program->heap[child];
+        at = child;
+    }
+    program->heap[at] = last;
+    program->queued[top] = false;
+    return top;
+}
+
+// a name read before it's bound was an error on the first run, which went on with 0
+void reactive_resolve(Data* d, int* bound, Arena* arena) {
+    if (d->type == IDENTIFIER) {
+        int slot = bound[d->data.ident.symbol];
+        if (slot >= 0) {
+            d->type = VARIABLE;
+            d->data.variable = slot;
+        } else {
+            d->type = CONSTANT;
+            d->data.constant = 0;
+        }
+    } else if (d->type == ARGLIST) {
+        // the arguments are shared with the compiled instructions
+        Data* args = arena_alloc(arena, d->data.arglist.len * sizeof(Data));
+        for (int i = 0; i < d->data.arglist.len; i++) {
+            args[i] = d->data.arglist.args[i];
+            reactive_resolve(&args[i], bound, arena);
+        }
+        d->data.arglist.args = args;
+    }
+}
+
+// the graph gets (from, to) pairs in edges, count says how many
+void reactive_edges_from(Data d, int* writer, uint32_t to, uint32_t** edges, uint32_t* count, uint32_t* capacity) {
+    if (d.type == VARIABLE && d.data.variable >= 0 && writer[d.data.variable] >= 0) {
+        if (*count == *capacity) {
+            *capacity *= 2;
+            *edges = realloc(*edges, *capacity * 2 * sizeof(uint32_t));
+        }
+        (*edges)[*count * 2] = (uint32_t)writer[d.data.variable];
+        (*edges)[*count * 2 + 1] = to;
+        (*count)++;
+    } else if (d.type == ARGLIST) {
+        for (int i = 0; i < d.data.arglist.len; i++) {
+            reactive_edges_from(d.data.arglist.args[i], writer, to, edges, count, capacity);
+        }
+    }
+}
+
+void reactive_free(ReactiveProgram* program) {
+    if (program->vm) vm_free(program->vm);
+    free_instructions(program->instructions);
+    arena_free(program->arena);
+    free(program->replay);
+    free(program->input);
+    free(program->first_successor);
+    free(program->successors);
+    free(program->heap);
+    free(program->queued);
+    free(program);
+}
+
+// compiles src and runs it once, NULL if that run stopped on an error
+ReactiveProgram* reactive_create(const char* src) {
+    ReactiveProgram* program = calloc(1, sizeof(ReactiveProgram));
+    program->arena = arena_create();
+    program->instructions = gen_code(src, program->arena);
+    InstructionArr* instructions = program->instructions;
+    uint32_t n = (uint32_t)instructions->size;
+    uint32_t frame_size = instructions_frame_size(instructions);
+    program->symbol_count = symbol_count();
+
+    program->vm = vm_create(instructions);
+    if (!vm_execute(program->vm, instructions)) {
+        reactive_free(program);
+        return NULL;
+    }
+
+    program->replay = malloc((n + 1) * sizeof(Instruction));
+    program->input = malloc((program->symbol_count + 1) * sizeof(int));
+    int* bound = malloc((program->symbol_count + 1) * sizeof(int));
+    int* writer = malloc((frame_size + 1) * sizeof(int));
+    for (uint32_t s = 0; s < program->symbol_count; s++) {
+        program->input[s] = -1;
+        bound[s] = -1;
+    }
+    for (uint32_t k = 0; k < frame_size; k++) {
+        writer[k] = -1;
+    }
+    uint32_t edge_count = 0, edge_capacity = 1024;
+    uint32_t* edges = malloc(edge_capacity * 2 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++) {
+        Instruction instr = instructions->data[i];
+        bool assign = instr.type == BINARY && instr.data.binary.op == ASSIGN;
+        // checked before resolving, a copy from a name resolves to a slot too
+        bool rename = assign && instr.data.binary.right.type == VARIABLE;
+        switch (instr.type) {
+            case BINARY:
+                if (instr.data.binary.op != CALL && instr.data.binary.op != ASSIGN) {
+                    reactive_resolve(&instr.data.binary.left, bound, program->arena);
+                }
+                reactive_resolve(&instr.data.binary.right, bound, program->arena);
+                break;
+            case UNARY:
+                reactive_resolve(&instr.data.unary.operand, bound, program->arena);
+                break;
+            case SET:
+                reactive_resolve(&instr.data.set, bound, program->arena);
+                break;
+        }
+        int bind = -1;
+        if (assign) {
+            // the first run would have stopped on anything but a name on the left
+            bind = instr.data.binary.left.data.ident.symbol;
+            Data right = instr.data.binary.right;
+            if (rename) {
+                bound[bind] = right.data.variable;
+                if (program->input[bind] < 0) program->input[bind] = writer[right.data.variable];
+                program->replay[i] = instr;
+                continue;
+            }
+            instr.type = SET;
+            instr.data.set = right;
+        }
+        program->replay[i] = instr;
+        if (instr.out >= 0) writer[instr.out] = (int)i;
+        if (bind >= 0) {
+            bound[bind] = instr.out;
+            if (program->input[bind] < 0) program->input[bind] = (int)i;
+        }
+        switch (instr.type) {
+            case BINARY:
+                if (instr.data.binary.op != CALL) {
+                    reactive_edges_from(instr.data.binary.left, writer, i, &edges, &edge_count, &edge_capacity);
+                }
+                reactive_edges_from(instr.data.binary.right, writer, i, &edges, &edge_count, &edge_capacity);
+                break;
+            case UNARY:
+                reactive_edges_from(instr.data.unary.operand, writer, i, &edges, &edge_count, &edge_capacity);
+                break;
+            case SET:
+                reactive_edges_from(instr.data.set, writer, i, &edges, &edge_count, &edge_capacity);
+                break;
+        }
+    }
+
+    program->first_successor = calloc(n + 2, sizeof(uint32_t));
+    program->successors = malloc((edge_count + 1) * sizeof(uint32_t));
+    for (uint32_t e = 0; e < edge_count; e++) {
+        program->first_successor[edges[e * 2] + 2]++;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        program->first_successor[i + 2] += program->first_successor[i + 1];
+    }
+    // first_successor[i + 1] is where the next successor of i goes, and ends up where i + 1 starts
+    for (uint32_t e = 0; e < edge_count; e++) {
+        program->successors[program->first_successor[edges[e * 2] + 1]++] = edges[e * 2 + 1];
+    }
+    program->heap = malloc((n + 1) * sizeof(uint32_t));
+    program->heap_size = 0;
+    program->queued = calloc(n + 1, sizeof(bool));
+
+    free(edges);
+    free(writer);
+    free(bound);
+    return program;
+}
+
+// runs the dirty instructions, false if one of them stopped on an error
+bool reactive_update(ReactiveProgram* program) {
+    InstrVM* vm = program->vm;
+    uint32_t run = 0;
+    bool ok = true;
+    while (ok && program->heap_size > 0) {
+        uint32_t i = reactive_pop(program);
+        Instruction instr = program->replay[i];
+        double before = instr.out >= 0 ? vm->vars[instr.out] : 0;
+        ok = vm_step(vm, instr, (int)i);
+        run++;
+        if (instr.out < 0 || memcmp(&before, &vm->vars[instr.out], sizeof(double)) == 0) continue;
+        for (uint32_t s = program->first_successor[i]; s < program->first_successor[i + 1]; s++) {
+            reactive_push(program, program->successors[s]);
+        }
+    }
+    while (program->heap_size > 0) {
+        reactive_pop(program);
+    }
+    program->last_run = run;
+    program->total_run += run;
+    program->total_skipped += (uint32_t)program->instructions->size - run;
+    output_flush();
+    return ok;
+}
+
+// false if the name isn't an input of the program
+bool reactive_set_input(ReactiveProgram* program, const char* name, double value) {
+    int symbol = symbol_find(name);
+    if (symbol < 0 || (uint32_t)symbol >= program->symbol_count || program->input[symbol] < 0) {
+        printf("ERROR: '%s' is not an input\n", name);
+        return false;
+    }
+    Instruction* instr = &program->replay[program->input[symbol]];
+    instr->type = SET;
+    instr->data.set.type = CONSTANT;
+    instr->data.set.data.constant = value;
+    reactive_push(program, (uint32_t)program->input[symbol]);
+    return reactive_update(program);
+}
+
+// false if the name isn't bound
+bool reactive_get(ReactiveProgram* program, const char* name, double* value) {
+    int symbol = symbol_find(name);
+    if (symbol < 0 || (uint32_t)symbol >= program->vm->symbol_count || program->vm->symbol_slots[symbol] < 0) {
+        return false;
+    }
+    *value = program->vm->vars[program->vm->symbol_slots[symbol]];
+    return true;
+}
+
+// the script at path, "-" for stdin, then every input in turn, with what each one re-ran
+bool reactive_run_file(const char* path, const char** names, const double* values, int count) {
+    char* src = read_script(path);
+    if (src == NULL) return false;
+    ReactiveProgram* program = reactive_create(src);
+    free(src);
+    output_flush();
+    if (program == NULL) return false;
+
+    bool ok = true;
+    for (int i = 0; ok && i < count; i++) {
+        ok = reactive_set_input(program, names[i], values[i]);
+        if (ok) {
+            uint32_t total = (uint32_t)program->instructions->size;
+            printf("reactive: %s = %g re-ran %u of %u instructions, skipped %u\n", names[i], values[i],
+                   program->last_run, total, total - program->last_run);
+        }
+    }
+    reactive_free(program);
+    return ok;
+}
+
+#endif //_REACTIVE_H
@@ -0,0 +1,202 @@
+#pragma once
+#ifndef _REGALLOC_H
+#define _REGALLOC_H
+
+#include "asm.h"
+
+// renumbers the % slots so that a slot is reused once its value is dead.
+// gen_code hands out a fresh slot for every temporary, so the frame grows with the length of the script;
+// after this pass it is only as big as the most values live at once.
+// a value is live from the instruction that writes it to its last read, either directly as %n or through a name
+// bound to it. names are bound in program order, so the bindings can be followed statically.
+// values still bound to a name at the end stay live, so the final variables can be inspected after running.
+
+typedef struct SlotAllocator {
+    // while walking: old slot -> instruction that last wrote it, -1 if none
+    int* slot_def;
+    // while walking: symbol -> instruction that wrote the slot the name is bound to, -1 if unbound
+    int* symbol_def;
+    // instruction -> last instruction that reads its output, -1 if it's never read
+    int* last_use;
+    // instructions whose output dies at an instruction, chained per instruction
+    int* die_head;
+    int* die_next;
+    // instruction -> new slot of its output
+    int* new_slot;
+    // new slots for old slots that are read without ever being written, -1 if not needed yet
+    int* orphan_slot;
+    int* free_slots;
+    int free_count;
+    int next_slot;
+} SlotAllocator;
+
+// the slot an instruction writes, -1 if it only binds a name
+int slots_written(Instruction* instr) {
+    if (instr->type == BINARY && instr->data.binary.op == ASSIGN && instr->data.binary.right.type == VARIABLE) {
+        return -1;
+    }
+    return instr->out;
+}
+
+void slots_use(SlotAllocator* sa, Data d, int line) {
+    int def = -1;
+    if (d.type == VARIABLE && d.data.variable >= 0) {
+        def = sa->slot_def[d.data.variable];
+    } else if (d.type == IDENTIFIER) {
+        def = sa->symbol_def[d.data.ident.symbol];
+    } else if (d.type == ARGLIST) {
+        for (int i = 0; i < d.data.arglist.len; i++) {
+            slots_use(sa, d.data.arglist.args[i], line);
+        }
+    }
+    if (def >= 0 && line > sa->last_use[def]) {
+        sa->last_use[def] = line;
+    }
+}
+
+void slots_rename(SlotAllocator* sa, Data* d) {
+    if (d->type == VARIABLE && d->data.variable >= 0) {
+        int old = d->data.variable;
+        if (sa->slot_def[old] >= 0) {
+            d->data.variable = sa->new_slot[sa->slot_def[old]];
+        } else {
+            // nothing wrote it, give it a slot of its own that is never reused
+            if (sa->orphan_slot[old] < 0) sa->orphan_slot[old] = sa->next_slot++;
+            d->data.variable = sa->orphan_slot[old];
+        }
+    } else if (d->type == ARGLIST) {
+        for (int i = 0; i < d->data.arglist.len; i++) {
+            slots_rename(sa, &d->data.arglist.args[i]);
+        }
+    }
+}
+
+// the operands of an instruction, except the names on the left of assignments and calls
+int slots_operands(Instruction* instr, Data** operands) {
+    switch (instr->type) {
+        case BINARY:
+            if (instr->data.binary.op == ASSIGN || instr->data.binary.op == CALL) {
+                operands[0] = &instr->data.binary.right;
+                return 1;
+            }
+            operands[0] = &instr->data.binary.left;
+            operands[1] = &instr->data.binary.right;
+            return 2;
+        case UNARY:
+            operands[0] = &instr->data.unary.operand;
+            return 1;
+        case SET:
+            operands[0] = &instr->data.set;
+            return 1;
+    }
+    return 0;
+}
+
+// follows the name bindings of an instruction, after its slot was written
+void slots_bind(SlotAllocator* sa, Instruction* instr, int line) {
+    if (instr->type != BINARY || instr->data.binary.op != ASSIGN || instr->data.binary.left.type != IDENTIFIER) {
+        return;
+    }
+    int symbol = instr->data.binary.left.data.ident.symbol;
+    Data right = instr->data.binary.right;
+    if (right.type == VARIABLE) {
+        sa->symbol_def[symbol] = right.data.variable >= 0 ? sa->slot_def[right.data.variable] : -1;
+    } else if (instr->out >= 0) {
+        sa->symbol_def[symbol] = line;
+    }
+}
+
+// rewrites the slots in place and returns the new frame size
+uint32_t allocate_slots(InstructionArr* instructions) {
+    int count = instructions->size;
+    uint32_t frame_size = instructions_frame_size(instructions);
+    uint32_t symbol_total = symbol_count();
+    SlotAllocator sa = {
+            .slot_def = malloc((frame_size + 1) * sizeof(int)),
+            .symbol_def = malloc((symbol_total + 1) * sizeof(int)),
+            .last_use = malloc((count + 1) * sizeof(int)),
+            .die_head = malloc((count + 1) * sizeof(int)),
+            .die_next = malloc((count + 1) * sizeof(int)),
+            .new_slot = malloc((count + 1) * sizeof(int)),
+            .orphan_slot = malloc((frame_size + 1) * sizeof(int)),
+            .free_slots = malloc((count + 1) * sizeof(int)),
+            .free_count = 0,
+            .next_slot = 0,
+    };
+    for (uint32_t i = 0; i < frame_size; i++) {
+        sa.slot_def[i] = -1;
+        sa.orphan_slot[i] = -1;
+    }
+    for (uint32_t i = 0; i < symbol_total; i++) {
+        sa.symbol_def[i] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        sa.last_use[i] = -1;
+        sa.die_head[i] = -1;
+    }
+
+    // liveness: find the last read of every value
+    Data* operands[2];
+    for (int i = 0; i < count; i++) {
+        Instruction* instr = &instructions->data[i];
+        int n = slots_operands(instr, operands);
+        for (int j = 0; j < n; j++) {
+            slots_use(&sa, *operands[j], i);
+        }
+        int out = slots_written(instr);
+        if (out >= 0) sa.slot_def[out] = i;
+        slots_bind(&sa, instr, i);
+    }
+    for (uint32_t s = 0; s < symbol_total; s++) {
+        if (sa.symbol_def[s] >= 0) sa.last_use[sa.symbol_def[s]] = count;
+    }
+    for (int i = 0; i < count; i++) {
+        int end = sa.last_use[i];
+        if (end >= 0 && end < count) {
+            sa.die_next[i] = sa.die_head[end];
+            sa.die_head[end] = i;
+        }
+    }
+
+    // allocation: walk again in the same order, reading the operands before their slots are freed,
+    // so an instruction can write into the slot of an operand it was the last to read
+    for (uint32_t i = 0; i < frame_size; i++) {
+        sa.slot_def[i] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        Instruction* instr = &instructions->data[i];
+        int n = slots_operands(instr, operands);
+        for (int j = 0; j < n; j++) {
+            slots_rename(&sa, operands[j]);
+        }
+        for (int dead = sa.die_head[i]; dead != -1; dead = sa.die_next[dead]) {
+            sa.free_slots[sa.free_count++] = sa.new_slot[dead];
+        }
+        int out = slots_written(instr);
+        if (out >= 0) {
+            // most recently freed first, it's the most likely to still be in cache
+            int slot = sa.free_count > 0 ? sa.free_slots[--sa.free_count] : sa.next_slot++;
+            sa.new_slot[i] = slot;
+            sa.slot_def[out] = i;
+            instr->out = slot;
+            if (sa.last_use[i] < 0) {
+                sa.free_slots[sa.free_count++] = slot;
+            }
+        } else if (instr->type == BINARY && instr->data.binary.op == ASSIGN) {
+            // a rename doesn't write anything
+            instr->out = -1;
+        }
+    }
+
+    free(sa.slot_def);
+    free(sa.symbol_def);
+    free(sa.last_use);
+    free(sa.die_head);
+    free(sa.die_next);
+    free(sa.new_slot);
+    free(sa.orphan_slot);
+    free(sa.free_slots);
+    return (uint32_t)sa.next_slot;
+}
+
+#endif //_REGALLOC_H
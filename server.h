@@ -0,0 +1,879 @@
+#pragma once
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+
+#include "cache.h"
+#include "pool.h"
+#include "vm.h"
+
+// a daemon that evaluates programs sent over a unix socket, so a caller doesn't pay for a process and a compile
+// per evaluation. compiled programs stay in a program cache, keyed by their source, and run on a fixed set of
+// worker threads, each with its own vm.
+// the main thread accepts connections and waits for them with epoll. a connection that has a request waiting goes
+// onto a queue, one worker reads and answers that one request, then hands the connection back to epoll. a request is
+// read with blocking reads, which is fine for local clients that write it in one go. one that doesn't, and stops
+// halfway, would hold its worker, so a request has SERVER_REQUEST_TIMEOUT_MS to arrive once it has started and its
+// connection is closed after that.
+// the cache and the symbol table aren't thread-safe, so looking a program up, compiling it and finding the names of
+// a request happen under one lock. the program is pinned in the cache while it runs outside the lock.
+// programs can't call anything but the math builtins: a print would go to the daemon's stdout, from any thread, so
+// a request names the variables it wants back instead. a name read before it's bound reads 0, with the error on the
+// daemon's stdout, like on the command line.
+//
+// every frame starts with a header of uint32_ts, in the byte order of the machine.
+// request: magic, kind, source_size, input_count, output_count, names_size, then
+//   input_count doubles: the values of the inputs
+//   names_size bytes: input_count and then output_count names, each ending in a '\0'
+//   source_size bytes: the program, without a '\0'
+// response: magic, status, value_count, message_size, then value_count doubles and message_size bytes of text.
+// an eval answers with the values of the outputs, NaN for a name the program didn't bind, a stats request with
+// the ServerStat values.
+
+#define SERVER_MAGIC 0x52505845u // "EXPR"
+#define SERVER_MAX_REQUEST (16 * 1024 * 1024)
+#define SERVER_MAX_EVENTS 64
+#define SERVER_REQUEST_TIMEOUT_MS 1000
+// latencies in nanoseconds, 8 buckets per power of two, so a percentile is within 12.5%
+#define SERVER_HISTOGRAM_SUB 8
+#define SERVER_HISTOGRAM_BUCKETS (SERVER_HISTOGRAM_SUB * 62)
+
+typedef enum ServerRequestKind {
+    SERVER_EVAL, SERVER_STATS
+} ServerRequestKind;
+
+typedef enum ServerStatus {
+    SERVER_OK, SERVER_BAD_REQUEST, SERVER_REJECTED, SERVER_FAILED
+} ServerStatus;
+
+typedef enum ServerStat {
+    SERVER_STAT_REQUESTS, SERVER_STAT_P50, SERVER_STAT_P90, SERVER_STAT_P99, SERVER_STAT_P999, SERVER_STAT_MAX,
+    SERVER_STAT_CACHE_HITS, SERVER_STAT_CACHE_MISSES, SERVER_STAT_COUNT
+} ServerStat;
+
+typedef struct ServerRequestHeader {
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t source_size;
+    uint32_t input_count;
+    uint32_t output_count;
+    uint32_t names_size;
+} ServerRequestHeader;
+
+typedef struct ServerResponseHeader {
+    uint32_t magic;
+    uint32_t status;
+    uint32_t value_count;
+    uint32_t message_size;
+} ServerResponseHeader;
+
+typedef struct ServerHistogram {
+    pthread_mutex_t lock; // the owner records, a stats request reads
+    uint64_t counts[SERVER_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} ServerHistogram;
+
+struct Server;
+
+typedef struct ServerWorker {
+    struct Server* server;
+    pthread_t thread;
+    InstrVM* vm;
+    char* frame; // the request being answered, and then the response
+    size_t frame_capacity;
+    // the request's names, inputs first, and their symbols, -1 for a name no program has
+    const char** names;
+    int* symbols;
+    uint32_t name_capacity;
+    uint64_t deadline; // server_now_ns by which the request being read has to be in
+    ServerHistogram latency;
+} ServerWorker;
+
+typedef struct Server {
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd; // written by server_stop
+    char* path;
+    pthread_mutex_t cache_lock;
+    ProgramCache* cache;
+    // connections with a request waiting, a ring
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int* queue;
+    uint32_t queue_head;
+    uint32_t queue_size;
+    uint32_t queue_capacity;
+    bool stopping;
+    // fd -> whether it's a connection, to close the ones still open at the end
+    bool* open;
+    int open_capacity;
+    ServerWorker* workers;
+    uint32_t worker_count;
+} Server;
+
+uint64_t server_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+uint32_t server_histogram_bucket(uint64_t ns) {
+    if (ns < SERVER_HISTOGRAM_SUB) return (uint32_t)ns;
+    int e = 63 - __builtin_clzll(ns); // at least 3
+    uint32_t bucket = SERVER_HISTOGRAM_SUB * (uint32_t)(e - 2) + (uint32_t)((ns >> (e - 3)) - SERVER_HISTOGRAM_SUB);
+    return bucket < SERVER_HISTOGRAM_BUCKETS ? bucket : SERVER_HISTOGRAM_BUCKETS - 1;
+}
+
+// the largest latency that falls into the bucket
+uint64_t server_histogram_upper(uint32_t bucket) {
+    if (bucket < SERVER_HISTOGRAM_SUB) return bucket;
+    uint32_t e = bucket / SERVER_HISTOGRAM_SUB + 2;
+    uint64_t sub = bucket % SERVER_HISTOGRAM_SUB + SERVER_HISTOGRAM_SUB;
+    return ((sub + 1) << (e - 3)) - 1;
+}
+
+void server_histogram_record(ServerHistogram* histogram, uint64_t ns) {
+    pthread_mutex_lock(&histogram->lock);
+    histogram->counts[server_histogram_bucket(ns)]++;
+    histogram->count++;
+    if (ns > histogram->max) histogram->max = ns;
+    pthread_mutex_unlock(&histogram->lock);
+}
+
+// adds from to into, only into has to be private
+void server_histogram_merge(ServerHistogram* into, ServerHistogram* from) {
+    pthread_mutex_lock(&from->lock);
+    for (uint32_t b = 0; b < SERVER_HISTOGRAM_BUCKETS; b++) {
+        into->counts[b] += from->counts[b];
+    }
+    into->count += from->count;
+    if (from->max > into->max) into->max = from->max;
+    pthread_mutex_unlock(&from->lock);
+}
+
+// the latency below which a fraction q of the requests fall, rounded up to the end of its bucket
+uint64_t server_histogram_percentile(ServerHistogram* histogram, double q) {
+    if (histogram->count == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)histogram->count);
+    if (rank >= histogram->count) rank = histogram->count - 1;
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < SERVER_HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->counts[b];
+        if (seen > rank) {
+            uint64_t upper = server_histogram_upper(b);
+            return upper < histogram->max ? upper : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// the latencies of every worker so far
+void server_latency(Server* server, ServerHistogram* total) {
+    memset(total, 0, sizeof(ServerHistogram));
+    for (uint32_t w = 0; w < server->worker_count; w++) {
+        server_histogram_merge(total, &server->workers[w].latency);
+    }
+}
+
+// false if the connection closed or failed first, or the deadline passed. a connection the server accepted
+// times out every recv after SERVER_REQUEST_TIMEOUT_MS, so it gets to check
+bool server_read_until(int fd, void* buffer, size_t size, uint64_t deadline) {
+    size_t done = 0;
+    while (done < size) {
+        if (server_now_ns() > deadline) return false;
+        ssize_t n = recv(fd, (char*)buffer + done, size - done, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+bool server_read_all(int fd, void* buffer, size_t size) {
+    return server_read_until(fd, buffer, size, UINT64_MAX);
+}
+
+bool server_write_all(int fd, const void* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        // a client that went away is an error on this connection, not a SIGPIPE for the process
+        ssize_t n = send(fd, (const char*)buffer + done, size - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+// false if it can't grow, and then the old frame is kept
+bool server_reserve(ServerWorker* worker, size_t size) {
+    if (size <= worker->frame_capacity) return true;
+    char* frame = realloc(worker->frame, size * 2);
+    if (frame == NULL) return false;
+    worker->frame = frame;
+    worker->frame_capacity = size * 2;
+    return true;
+}
+
+bool server_reserve_names(ServerWorker* worker, uint32_t names) {
+    if (names <= worker->name_capacity) return true;
+    const char** grown_names = realloc(worker->names, (size_t)names * 2 * sizeof(char*));
+    if (grown_names == NULL) return false;
+    worker->names = grown_names;
+    int* grown_symbols = realloc(worker->symbols, (size_t)names * 2 * sizeof(int));
+    if (grown_symbols == NULL) return false;
+    worker->symbols = grown_symbols;
+    worker->name_capacity = names * 2;
+    return true;
+}
+
+bool server_respond(int fd, ServerStatus status, const double* values, uint32_t value_count, const char* message) {
+    ServerResponseHeader header = {
+            .magic = SERVER_MAGIC,
+            .status = status,
+            .value_count = value_count,
+            .message_size = message ? (uint32_t)strlen(message) : 0,
+    };
+    // one write for the header and the values, the message only comes with errors
+    size_t size = sizeof(header) + value_count * sizeof(double);
+    char small[sizeof(header) + SERVER_STAT_COUNT * sizeof(double)];
+    char* frame = size <= sizeof(small) ? small : malloc(size);
+    memcpy(frame, &header, sizeof(header));
+    if (value_count > 0) memcpy(frame + sizeof(header), values, value_count * sizeof(double));
+    bool ok = server_write_all(fd, frame, size) && server_write_all(fd, message, header.message_size);
+    if (frame != small) free(frame);
+    return ok;
+}
+
+bool server_answer_stats(Server* server, int fd) {
+    ServerHistogram total;
+    server_latency(server, &total);
+    double values[SERVER_STAT_COUNT] = {
+            [SERVER_STAT_REQUESTS] = (double)total.count,
+            [SERVER_STAT_P50] = (double)server_histogram_percentile(&total, 0.5),
+            [SERVER_STAT_P90] = (double)server_histogram_percentile(&total, 0.9),
+            [SERVER_STAT_P99] = (double)server_histogram_percentile(&total, 0.99),
+            [SERVER_STAT_P999] = (double)server_histogram_percentile(&total, 0.999),
+            [SERVER_STAT_MAX] = (double)total.max,
+    };
+    pthread_mutex_lock(&server->cache_lock);
+    values[SERVER_STAT_CACHE_HITS] = (double)server->cache->stats.hits;
+    values[SERVER_STAT_CACHE_MISSES] = (double)server->cache->stats.misses;
+    pthread_mutex_unlock(&server->cache_lock);
+    return server_respond(fd, SERVER_OK, values, SERVER_STAT_COUNT, NULL);
+}
+
+// the request's header has been read, the rest is read here
+bool server_answer_eval(ServerWorker* worker, int fd, ServerRequestHeader* header) {
+    Server* server = worker->server;
+    uint64_t names = (uint64_t)header->input_count + header->output_count;
+    uint64_t size = (uint64_t)header->input_count * sizeof(double) + header->names_size + header->source_size;
+    if (size > SERVER_MAX_REQUEST || names > header->names_size ||
+        header->input_count > SERVER_MAX_REQUEST / 8 || header->output_count > SERVER_MAX_REQUEST / 8) {
+        // the rest of it isn't read, so the connection can't go on
+        server_respond(fd, SERVER_BAD_REQUEST, NULL, 0, "request too large");
+        return false;
+    }
+    // room for the '\0' after the source, and for the response's values after the request
+    size_t results_at = (size + 1 + 7) & ~(size_t)7;
+    if (!server_reserve(worker, results_at + (size_t)header->output_count * sizeof(double)) ||
+        !server_reserve_names(worker, (uint32_t)names)) {
+        server_respond(fd, SERVER_FAILED, NULL, 0, "out of memory");
+        return false;
+    }
+    if (!server_read_until(fd, worker->frame, size, worker->deadline)) return false;
+    char* frame = worker->frame;
+    double* inputs = (double*)frame;
+    char* name_text = frame + header->input_count * sizeof(double);
+    char* source = name_text + header->names_size;
+    source[header->source_size] = '\0';
+    double* results = (double*)(frame + results_at);
+
+    // the names, each ending in a '\0' inside names_size
+    const char* name = name_text;
+    for (uint32_t n = 0; n < names; n++) {
+        const char* end = memchr(name, '\0', (size_t)(source - name));
+        if (end == NULL) return server_respond(fd, SERVER_BAD_REQUEST, NULL, 0, "names don't match the counts");
+        worker->names[n] = name;
+        name = end + 1;
+    }
+
+    pthread_mutex_lock(&server->cache_lock);
+    CacheEntry* entry = program_cache_acquire(server->cache, source);
+    for (uint32_t n = 0; n < names; n++) {
+        worker->symbols[n] = symbol_find(worker->names[n]);
+    }
+    uint32_t symbol_total = symbol_count();
+    pthread_mutex_unlock(&server->cache_lock);
+
+    if (entry->calls > 0) {
+        pthread_mutex_lock(&server->cache_lock);
+        program_cache_release(server->cache, entry);
+        pthread_mutex_unlock(&server->cache_lock);
+        return server_respond(fd, SERVER_REJECTED, NULL, 0,
+                              "programs can't print or call functions on the server, ask for the names instead");
+    }
+
+    // the vm is sized by hand, vm_prepare would read the symbol count outside the lock
+    InstrVM* vm = worker->vm;
+    vm_reserve(vm, entry->frame_size + header->input_count);
+    if (symbol_total > vm->symbol_count) {
+        vm->symbol_slots = realloc(vm->symbol_slots, symbol_total * sizeof(int));
+        for (uint32_t s = vm->symbol_count; s < symbol_total; s++) {
+            vm->symbol_slots[s] = -1;
+        }
+        vm->symbol_count = symbol_total;
+    }
+    // inputs go after the program's slots, a name no program has can't be read by this one
+    for (uint32_t k = 0; k < header->input_count; k++) {
+        if (worker->symbols[k] < 0) continue;
+        int slot = (int)(entry->frame_size + k);
+        memcpy(&vm->vars[slot], &inputs[k], sizeof(double));
+        vm->symbol_slots[worker->symbols[k]] = slot;
+    }
+    bool ok = vm_execute(vm, &entry->program);
+    for (uint32_t k = 0; k < header->output_count; k++) {
+        int symbol = worker->symbols[header->input_count + k];
+        int slot = symbol >= 0 ? vm->symbol_slots[symbol] : -1;
+        double value = slot >= 0 ? vm->vars[slot] : NAN;
+        memcpy(&results[k], &value, sizeof(double));
+    }
+    // the next request starts with no names bound
+    for (uint32_t k = 0; k < header->input_count; k++) {
+        if (worker->symbols[k] >= 0) vm->symbol_slots[worker->symbols[k]] = -1;
+    }
+    for (int i = 0; i < entry->program.size; i++) {
+        Instruction* instr = &entry->program.data[i];
+        if (instr->type == BINARY && instr->data.binary.op == ASSIGN && instr->data.binary.left.type == IDENTIFIER) {
+            vm->symbol_slots[instr->data.binary.left.data.ident.symbol] = -1;
+        }
+    }
+
+    pthread_mutex_lock(&server->cache_lock);
+    program_cache_release(server->cache, entry);
+    pthread_mutex_unlock(&server->cache_lock);
+    if (!ok) return server_respond(fd, SERVER_FAILED, NULL, 0, "the program stopped on an error");
+    return server_respond(fd, SERVER_OK, results, header->output_count, NULL);
+}
+
+// one request from the connection, false if the connection has to be closed
+bool server_answer(ServerWorker* worker, int fd) {
+    ServerRequestHeader header;
+    worker->deadline = server_now_ns() + (uint64_t)SERVER_REQUEST_TIMEOUT_MS * 1000000;
+    if (!server_read_until(fd, &header, sizeof(header), worker->deadline)) return false;
+    uint64_t start = server_now_ns();
+    bool ok;
+    if (header.magic != SERVER_MAGIC) {
+        // nothing after it can be trusted, not even where the next request starts
+        server_respond(fd, SERVER_BAD_REQUEST, NULL, 0, "bad magic");
+        return false;
+    } else if (header.kind == SERVER_STATS) {
+        ok = server_answer_stats(worker->server, fd);
+    } else if (header.kind == SERVER_EVAL) {
+        ok = server_answer_eval(worker, fd, &header);
+    } else {
+        server_respond(fd, SERVER_BAD_REQUEST, NULL, 0, "unknown request kind");
+        return false;
+    }
+    if (header.kind == SERVER_EVAL) server_histogram_record(&worker->latency, server_now_ns() - start);
+    return ok;
+}
+
+void server_close(Server* server, int fd) {
+    pthread_mutex_lock(&server->lock);
+    server->open[fd] = false;
+    pthread_mutex_unlock(&server->lock);
+    close(fd);
+}
+
+void* server_worker_main(void* arg) {
+    ServerWorker* worker = arg;
+    Server* server = worker->server;
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (!server->stopping && server->queue_size == 0) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        int fd = server->queue[server->queue_head];
+        server->queue_head = (server->queue_head + 1) % server->queue_capacity;
+        server->queue_size--;
+        pthread_mutex_unlock(&server->lock);
+
+        if (!server_answer(worker, fd)) {
+            server_close(server, fd);
+            continue;
+        }
+        // re-armed under the lock, the queue can only hand the connection to another worker after it's released
+        struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT, .data.fd = fd };
+        pthread_mutex_lock(&server->lock);
+        bool armed = epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0;
+        if (!armed) server->open[fd] = false;
+        pthread_mutex_unlock(&server->lock);
+        if (!armed) close(fd);
+    }
+    return NULL;
+}
+
+void server_enqueue(Server* server, int fd) {
+    pthread_mutex_lock(&server->lock);
+    if (server->queue_size == server->queue_capacity) {
+        // unrolled into the new ring from its head
+        int* queue = malloc(server->queue_capacity * 2 * sizeof(int));
+        for (uint32_t i = 0; i < server->queue_size; i++) {
+            queue[i] = server->queue[(server->queue_head + i) % server->queue_capacity];
+        }
+        free(server->queue);
+        server->queue = queue;
+        server->queue_head = 0;
+        server->queue_capacity *= 2;
+    }
+    server->queue[(server->queue_head + server->queue_size++) % server->queue_capacity] = fd;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+void server_accept(Server* server) {
+    for (;;) {
+        // blocking, accept doesn't pass O_NONBLOCK on
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            // EAGAIN once the backlog is empty, anything else is the client's problem
+            return;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        // a client that stops sending, or reading its response, only holds a worker this long at a time
+        struct timeval timeout = { .tv_sec = SERVER_REQUEST_TIMEOUT_MS / 1000,
+                                   .tv_usec = SERVER_REQUEST_TIMEOUT_MS % 1000 * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        pthread_mutex_lock(&server->lock);
+        if (fd >= server->open_capacity) {
+            int capacity = fd * 2 + 1;
+            server->open = realloc(server->open, capacity * sizeof(bool));
+            memset(server->open + server->open_capacity, 0, (capacity - server->open_capacity) * sizeof(bool));
+            server->open_capacity = capacity;
+        }
+        server->open[fd] = true;
+        pthread_mutex_unlock(&server->lock);
+        struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT, .data.fd = fd };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) server_close(server, fd);
+    }
+}
+
+void server_free(Server* server);
+
+// listens on path with workers threads, 0 for one per cpu. NULL if the socket can't be set up, or stats are on:
+// the workers would all count into exec_stats at once
+Server* server_create(const char* path, uint32_t workers, bool optimize) {
+    if (stats_enabled) {
+        printf("ERROR: the server can't run with --stats, the counters aren't shared between workers\n");
+        return NULL;
+    }
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("ERROR: socket path '%s' is too long\n", path);
+        return NULL;
+    }
+    strcpy(address.sun_path, path);
+    // a socket left behind by a daemon that didn't stop cleanly, anything else at the path stays
+    struct stat existing;
+    if (stat(path, &existing) == 0 && S_ISSOCK(existing.st_mode)) unlink(path);
+
+    Server* server = calloc(1, sizeof(Server));
+    server->epoll_fd = -1;
+    server->wake_fd = -1;
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, 128) != 0) {
+        printf("ERROR: cannot listen on '%s': %s\n", path, strerror(errno));
+        server_free(server);
+        return NULL;
+    }
+    server->path = strdup(path);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event listen_event = { .events = EPOLLIN, .data.fd = server->listen_fd };
+    struct epoll_event wake_event = { .events = EPOLLIN, .data.fd = server->wake_fd };
+    if (server->epoll_fd < 0 || server->wake_fd < 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &listen_event) != 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &wake_event) != 0) {
+        printf("ERROR: cannot wait on '%s': %s\n", path, strerror(errno));
+        server_free(server);
+        return NULL;
+    }
+    server->cache = program_cache_create(PROGRAM_CACHE_DEFAULT_BUDGET, optimize);
+    pthread_mutex_init(&server->cache_lock, NULL);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+    server->queue_capacity = 64;
+    server->queue = malloc(server->queue_capacity * sizeof(int));
+
+    server->worker_count = workers ? workers : pool_cpu_count();
+    server->workers = calloc(server->worker_count, sizeof(ServerWorker));
+    for (uint32_t w = 0; w < server->worker_count; w++) {
+        ServerWorker* worker = &server->workers[w];
+        worker->server = server;
+        worker->vm = vm_create(&(InstructionArr){0});
+        pthread_mutex_init(&worker->latency.lock, NULL);
+        if (pthread_create(&worker->thread, NULL, server_worker_main, worker) != 0) {
+            printf("ERROR: failed to start a server worker, running with %u\n", w);
+            vm_free(worker->vm);
+            pthread_mutex_destroy(&worker->latency.lock);
+            server->worker_count = w;
+            break;
+        }
+    }
+    return server;
+}
+
+// waits for connections until server_stop
+void server_run(Server* server) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    for (;;) {
+        int count = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            printf("ERROR: epoll_wait failed: %s\n", strerror(errno));
+            return;
+        }
+        for (int e = 0; e < count; e++) {
+            int fd = events[e].data.fd;
+            if (fd == server->wake_fd) {
+                return;
+            } else if (fd == server->listen_fd) {
+                server_accept(server);
+            } else {
+                server_enqueue(server, fd);
+            }
+        }
+    }
+}
+
+// makes server_run return, safe from a signal handler
+void server_stop(Server* server) {
+    uint64_t one = 1;
+    ssize_t written = write(server->wake_fd, &one, sizeof(one));
+    (void)written;
+}
+
+// stops the workers, closes the connections that are still open and removes the socket
+void server_free(Server* server) {
+    if (server->workers) {
+        pthread_mutex_lock(&server->lock);
+        server->stopping = true;
+        pthread_cond_broadcast(&server->ready);
+        // a worker in the middle of reading a request gets the end of it now, instead of at its deadline
+        for (int fd = 0; fd < server->open_capacity; fd++) {
+            if (server->open[fd]) shutdown(fd, SHUT_RD);
+        }
+        pthread_mutex_unlock(&server->lock);
+        for (uint32_t w = 0; w < server->worker_count; w++) {
+            pthread_join(server->workers[w].thread, NULL);
+            vm_free(server->workers[w].vm);
+            free(server->workers[w].frame);
+            free(server->workers[w].names);
+            free(server->workers[w].symbols);
+            pthread_mutex_destroy(&server->workers[w].latency.lock);
+        }
+        free(server->workers);
+        for (int fd = 0; fd < server->open_capacity; fd++) {
+            if (server->open[fd]) close(fd);
+        }
+        program_cache_free(server->cache);
+        pthread_mutex_destroy(&server->cache_lock);
+        pthread_mutex_destroy(&server->lock);
+        pthread_cond_destroy(&server->ready);
+    }
+    if (server->listen_fd >= 0) close(server->listen_fd);
+    if (server->epoll_fd >= 0) close(server->epoll_fd);
+    if (server->wake_fd >= 0) close(server->wake_fd);
+    if (server->path) unlink(server->path);
+    free(server->path);
+    free(server->open);
+    free(server->queue);
+    free(server);
+}
+
+void print_server_latency(Server* server) {
+    ServerHistogram total;
+    server_latency(server, &total);
+    printf("server: %llu requests, latency p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           (unsigned long long)total.count, server_histogram_percentile(&total, 0.5) / 1e3,
+           server_histogram_percentile(&total, 0.9) / 1e3, server_histogram_percentile(&total, 0.99) / 1e3,
+           server_histogram_percentile(&total, 0.999) / 1e3, total.max / 1e3);
+    print_cache_stats(server->cache);
+}
+
+static Server* server_signal_target = NULL;
+
+void server_on_signal(int signal) {
+    (void)signal;
+    if (server_signal_target) server_stop(server_signal_target);
+}
+
+// the daemon behind --serve: runs until SIGINT or SIGTERM, then prints the latencies
+bool server_serve(const char* path, uint32_t workers, bool optimize) {
+    Server* server = server_create(path, workers, optimize);
+    if (server == NULL) return false;
+    server_signal_target = server;
+    struct sigaction action = { .sa_handler = server_on_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    printf("serving on %s with %u workers\n", path, server->worker_count);
+    fflush(stdout);
+    server_run(server);
+    print_server_latency(server);
+    server_signal_target = NULL;
+    server_free(server);
+    return true;
+}
+
+// the client side
+
+typedef struct ServerReply {
+    ServerStatus status;
+    double* values;
+    uint32_t value_count;
+    uint32_t value_capacity;
+    char* message; // '\0'-terminated, empty on success
+    uint32_t message_capacity;
+} ServerReply;
+
+// a connected fd, -1 if there's no server at path
+int server_connect(const char* path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("ERROR: socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        printf("ERROR: cannot connect to '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// an eval request as one frame, to send as often as needed
+char* server_encode(const char* source, const char** inputs, const double* values, uint32_t input_count,
+                    const char** outputs, uint32_t output_count, size_t* size) {
+    ServerRequestHeader header = {
+            .magic = SERVER_MAGIC,
+            .kind = SERVER_EVAL,
+            .source_size = (uint32_t)strlen(source),
+            .input_count = input_count,
+            .output_count = output_count,
+    };
+    for (uint32_t n = 0; n < input_count; n++) header.names_size += (uint32_t)strlen(inputs[n]) + 1;
+    for (uint32_t n = 0; n < output_count; n++) header.names_size += (uint32_t)strlen(outputs[n]) + 1;
+    *size = sizeof(header) + input_count * sizeof(double) + header.names_size + header.source_size;
+    char* frame = malloc(*size);
+    char* at = frame;
+    memcpy(at, &header, sizeof(header));
+    at += sizeof(header);
+    if (input_count > 0) memcpy(at, values, input_count * sizeof(double));
+    at += input_count * sizeof(double);
+    for (uint32_t n = 0; n < input_count + output_count; n++) {
+        const char* name = n < input_count ? inputs[n] : outputs[n - input_count];
+        size_t len = strlen(name) + 1;
+        memcpy(at, name, len);
+        at += len;
+    }
+    memcpy(at, source, header.source_size);
+    return frame;
+}
+
+// sends a frame and reads the response into reply, false if the connection failed
+bool server_exchange(int fd, const char* frame, size_t size, ServerReply* reply) {
+    ServerResponseHeader header;
+    if (!server_write_all(fd, frame, size) || !server_read_all(fd, &header, sizeof(header)) ||
+        header.magic != SERVER_MAGIC) {
+        return false;
+    }
+    if (header.value_count > reply->value_capacity) {
+        reply->value_capacity = header.value_count;
+        reply->values = realloc(reply->values, reply->value_capacity * sizeof(double));
+    }
+    if (header.message_size + 1 > reply->message_capacity) {
+        reply->message_capacity = header.message_size + 1;
+        reply->message = realloc(reply->message, reply->message_capacity);
+    }
+    reply->status = (ServerStatus)header.status;
+    reply->value_count = header.value_count;
+    if (!server_read_all(fd, reply->values, header.value_count * sizeof(double)) ||
+        !server_read_all(fd, reply->message, header.message_size)) {
+        return false;
+    }
+    reply->message[header.message_size] = '\0';
+    return true;
+}
+
+bool server_fetch_stats(int fd, ServerReply* reply) {
+    ServerRequestHeader header = { .magic = SERVER_MAGIC, .kind = SERVER_STATS };
+    return server_exchange(fd, (const char*)&header, sizeof(header), reply) &&
+           reply->value_count == SERVER_STAT_COUNT;
+}
+
+void server_reply_free(ServerReply* reply) {
+    free(reply->values);
+    free(reply->message);
+}
+
+// the client behind --client: one request, then a line per output
+bool server_client(const char* path, const char* source, const char** inputs, const double* values,
+                   uint32_t input_count, const char** outputs, uint32_t output_count) {
+    int fd = server_connect(path);
+    if (fd < 0) return false;
+    size_t size;
+    char* frame = server_encode(source, inputs, values, input_count, outputs, output_count, &size);
+    ServerReply reply = {0};
+    bool ok = server_exchange(fd, frame, size, &reply);
+    if (!ok) {
+        printf("ERROR: the server closed the connection\n");
+    } else if (reply.status != SERVER_OK) {
+        printf("ERROR: %s\n", reply.message);
+        ok = false;
+    } else {
+        for (uint32_t k = 0; k < reply.value_count; k++) {
+            printf("%s = %.17g\n", outputs[k], reply.values[k]);
+        }
+    }
+    server_reply_free(&reply);
+    free(frame);
+    close(fd);
+    return ok;
+}
+
+typedef struct ServerLoadClient {
+    const char* path;
+    const char* frame;
+    size_t size;
+    uint32_t requests;
+    uint64_t* latencies; // of this client's answered requests, the first answered of them
+    uint32_t answered;
+    uint32_t failures;
+} ServerLoadClient;
+
+void* server_load_client(void* arg) {
+    ServerLoadClient* client = arg;
+    int fd = server_connect(client->path);
+    if (fd < 0) {
+        client->failures = client->requests;
+        return NULL;
+    }
+    ServerReply reply = {0};
+    for (uint32_t r = 0; r < client->requests; r++) {
+        uint64_t start = server_now_ns();
+        if (!server_exchange(fd, client->frame, client->size, &reply)) {
+            client->failures += client->requests - r;
+            break;
+        }
+        uint64_t latency = server_now_ns() - start;
+        // a failure isn't a sample, it would pull the percentiles toward however fast it failed
+        if (reply.status != SERVER_OK) {
+            client->failures++;
+        } else {
+            client->latencies[client->answered++] = latency;
+        }
+    }
+    server_reply_free(&reply);
+    close(fd);
+    return NULL;
+}
+
+int server_compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct ServerLoadResult {
+    uint64_t requests;
+    uint64_t answered; // the latencies are of these, requests - failures
+    uint64_t failures;
+    double seconds;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+} ServerLoadResult;
+
+// clients connections at once, each sending requests copies of frame and waiting for every answer.
+// latencies are what the clients saw for the requests that were answered, in nanoseconds
+ServerLoadResult server_load(const char* path, const char* frame, size_t size, uint32_t clients, uint32_t requests) {
+    ServerLoadClient* load = calloc(clients, sizeof(ServerLoadClient));
+    pthread_t* threads = malloc(clients * sizeof(pthread_t));
+    uint64_t* latencies = calloc((size_t)clients * requests + 1, sizeof(uint64_t));
+    uint64_t start = server_now_ns();
+    for (uint32_t c = 0; c < clients; c++) {
+        load[c] = (ServerLoadClient){ path, frame, size, requests, latencies + (size_t)c * requests, 0, 0 };
+        pthread_create(&threads[c], NULL, server_load_client, &load[c]);
+    }
+    ServerLoadResult result = {0};
+    for (uint32_t c = 0; c < clients; c++) {
+        pthread_join(threads[c], NULL);
+        result.failures += load[c].failures;
+    }
+    result.seconds = (double)(server_now_ns() - start) / 1e9;
+    result.requests = (uint64_t)clients * requests;
+    // every client's samples moved together, in front of the slots they didn't use
+    for (uint32_t c = 0; c < clients; c++) {
+        memmove(latencies + result.answered, load[c].latencies, load[c].answered * sizeof(uint64_t));
+        result.answered += load[c].answered;
+    }
+    qsort(latencies, result.answered, sizeof(uint64_t), server_compare_u64);
+    if (result.answered > 0) {
+        result.p50 = latencies[result.answered / 2];
+        result.p99 = latencies[result.answered * 99 / 100];
+        result.max = latencies[result.answered - 1];
+    }
+    free(latencies);
+    free(threads);
+    free(load);
+    return result;
+}
+
+// the load generator behind --load: the client-side latencies, then what the server measured
+bool server_load_report(const char* path, const char* frame, size_t size, uint32_t clients, uint32_t requests) {
+    ServerLoadResult result = server_load(path, frame, size, clients, requests);
+    printf("load: %u clients x %u requests in %.3f s, %.0f answered/s, %llu failed\n", clients, requests,
+           result.seconds, result.answered / result.seconds, (unsigned long long)result.failures);
+    if (result.answered > 0) {
+        printf("client latency of the %llu answered: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               (unsigned long long)result.answered, result.p50 / 1e3, result.p99 / 1e3, result.max / 1e3);
+    } else {
+        printf("client latency: no request was answered\n");
+    }
+    int fd = server_connect(path);
+    if (fd < 0) return false;
+    ServerReply reply = {0};
+    bool ok = server_fetch_stats(fd, &reply);
+    if (ok) {
+        double* v = reply.values;
+        printf("server latency: %.0f requests, p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us, "
+               "%.0f compiles\n", v[SERVER_STAT_REQUESTS], v[SERVER_STAT_P50] / 1e3, v[SERVER_STAT_P90] / 1e3,
+               v[SERVER_STAT_P99] / 1e3, v[SERVER_STAT_P999] / 1e3, v[SERVER_STAT_MAX] / 1e3,
+               v[SERVER_STAT_CACHE_MISSES]);
+    }
+    server_reply_free(&reply);
+    close(fd);
+    return ok && result.failures == 0;
+}
+
+#endif //_SERVER_H
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include "stream.h"
+
+// an interpreter that keeps its state between calls, for a repl or a program that embeds the language.
+// the session owns a stream runner: one vm whose frame starts with a home slot per name, so every session_eval
+// compiles only the source it's given, with its slots numbered after the homes and its names resolved against the
+// ones bound so far, and runs only that. a call costs what its own statements cost, however many came before it.
+
+typedef struct Session {
+    StreamRunner* runner;
+    uint64_t evals;
+} Session;
+
+Session* session_create() {
+    Session* session = malloc(sizeof(Session));
+    session->runner = stream_create();
+    session->evals = 0;
+    return session;
+}
+
+void session_free(Session* session) {
+    stream_free(session->runner);
+    free(session);
+}
+
+// runs ';'-separated statements, the last one doesn't need its ';'. stops at the first statement that fails and
+// returns false, what ran before it stays
+bool session_eval(Session* session, const char* src, size_t len) {
+    StreamRunner* runner = session->runner;
+    bool ok = stream_feed(runner, src, len) && stream_finish(runner);
+    // a failed statement leaves the rest of the source behind
+    runner->pending_size = 0;
+    session->evals++;
+    output_flush();
+    return ok;
+}
+
+// false if the name isn't bound
+bool session_get(Session* session, const char* name, double* value) {
+    return stream_get_var(session->runner, name, value);
+}
+
+// binds the name like an assignment would, for inputs from the embedding program
+void session_set(Session* session, const char* name, double value) {
+    stream_set_var(session->runner, name, value);
+}
+
+// a line at a time from in, until it ends. a line that fails has printed its error, the next one runs anyway
+void session_repl(Session* session, FILE* in) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    while ((len = getline(&line, &capacity, in)) > 0) {
+        session_eval(session, line, (size_t)len);
+    }
+    free(line);
+}
+
+#endif //_SESSION_H
@@ -0,0 +1,82 @@
+#pragma once
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// opt-in instrumentation: phase times, node and instruction counts, per-op execution counts and cycles,
+// identifier lookups and allocations, all counted into one process-wide ExecStats.
+// nothing is recorded unless stats_enabled is set, and when it isn't every hook is a single branch on it.
+// the vm checks it once per run and then picks a profiled copy of its loop, so the hot loop has no hooks at all.
+
+// enough for every ExprNodeType, BinaryOp and UnaryOp
+#define STATS_MAX_KINDS 16
+
+typedef enum StatsPhase {
+    STATS_LEX, STATS_PARSE, STATS_CODEGEN, STATS_OPTIMIZE, STATS_EXECUTE, STATS_PHASE_COUNT
+} StatsPhase;
+
+typedef struct ExecStats {
+    double phase_seconds[STATS_PHASE_COUNT];
+    uint64_t statements;
+    uint64_t tokens;
+    uint64_t ast_nodes[STATS_MAX_KINDS]; // by ExprNodeType
+    uint64_t instructions; // emitted by codegen
+    uint64_t max_statement_instructions;
+    // executed, by BinaryOp and UnaryOp. cycles are timestamp counter ticks, or nanoseconds without one
+    uint64_t binary_count[STATS_MAX_KINDS];
+    uint64_t binary_cycles[STATS_MAX_KINDS];
+    uint64_t unary_count[STATS_MAX_KINDS];
+    uint64_t unary_cycles[STATS_MAX_KINDS];
+    uint64_t set_count;
+    uint64_t set_cycles;
+    uint64_t executed;
+    uint64_t ident_lookups; // names resolved to slots while running
+    uint64_t arena_allocs;
+    uint64_t arena_blocks;
+    uint64_t heap_allocs; // dynarr buffers, created or grown
+} ExecStats;
+
+static bool stats_enabled = false;
+static ExecStats exec_stats;
+
+void stats_reset() {
+    memset(&exec_stats, 0, sizeof(ExecStats));
+}
+
+// turns recording on or off, the numbers so far are kept
+void stats_enable(bool enabled) {
+    stats_enabled = enabled;
+}
+
+const ExecStats* stats_get() {
+    return &exec_stats;
+}
+
+double stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t stats_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+void stats_add_time(StatsPhase phase, double seconds) {
+    exec_stats.phase_seconds[phase] += seconds > 0 ? seconds : 0;
+}
+
+#endif //_STATS_H
@@ -0,0 +1,254 @@
+#pragma once
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include "vm.h"
+
+// compiles and runs a script one statement at a time, so memory doesn't grow with the length of the script
+// and the first statements run before the rest has been read.
+// statements run on one persistent vm. named variables live in the first `pinned` slots of its frame, one home slot
+// per name, and every statement is compiled with its slots starting after them. once a statement has run, the
+// names it assigned are copied to their home slots, and its instructions and arena are thrown away.
+// statements only refer to earlier ones by name, so the frame is the named variables plus one statement.
+
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+typedef struct StreamStats {
+    uint64_t bytes;
+    uint64_t statements;
+    uint64_t instructions;
+    uint32_t max_frame_size;
+} StreamStats;
+
+typedef struct StreamRunner {
+    InstrVM* vm;
+    Arena* arena; // one statement's compilation, reset after every statement
+    InstructionArr* instructions; // one statement's instructions, cleared after every statement
+    int* home; // symbol -> home slot, -1 if the name was never assigned
+    uint32_t home_count;
+    uint32_t pinned;
+    // the start of a statement whose ';' hasn't been read yet
+    char* pending;
+    size_t pending_size;
+    size_t pending_capacity;
+    StreamStats stats;
+} StreamRunner;
+
+StreamRunner* stream_create() {
+    StreamRunner* runner = malloc(sizeof(StreamRunner));
+    runner->instructions = newInstructionArr();
+    runner->vm = vm_create(runner->instructions);
+    runner->arena = arena_create();
+    runner->home = NULL;
+    runner->home_count = 0;
+    runner->pinned = 0;
+    runner->pending = NULL;
+    runner->pending_size = 0;
+    runner->pending_capacity = 0;
+    memset(&runner->stats, 0, sizeof(StreamStats));
+    return runner;
+}
+
+void stream_free(StreamRunner* runner) {
+    vm_free(runner->vm);
+    free_instructions(runner->instructions);
+    arena_free(runner->arena);
+    free(runner->home);
+    free(runner->pending);
+    free(runner);
+}
+
+// value of a named variable after the statements run so far
+bool stream_get_var(StreamRunner* runner, const char* name, double* value) {
+    int symbol = symbol_find(name);
+    if (symbol < 0 || (uint32_t)symbol >= runner->vm->symbol_count || runner->vm->symbol_slots[symbol] < 0) {
+        return false;
+    }
+    *value = runner->vm->vars[runner->vm->symbol_slots[symbol]];
+    return true;
+}
+
+// the home slot of a name, a new one if it didn't have one. the vm has to have a slot for the symbol
+int stream_home(StreamRunner* runner, int symbol) {
+    InstrVM* vm = runner->vm;
+    if (runner->home_count < vm->symbol_count) {
+        runner->home = realloc(runner->home, vm->symbol_count * sizeof(int));
+        for (uint32_t i = runner->home_count; i < vm->symbol_count; i++) {
+            runner->home[i] = -1;
+        }
+        runner->home_count = vm->symbol_count;
+    }
+    if (runner->home[symbol] < 0) {
+        runner->home[symbol] = (int)runner->pinned++;
+    }
+    return runner->home[symbol];
+}
+
+// binds a name to a value, as if a statement had assigned it
+void stream_set_var(StreamRunner* runner, const char* name, double value) {
+    int symbol = symbol_intern(name);
+    InstrVM* vm = runner->vm;
+    clearInstructionArr(runner->instructions);
+    vm_prepare(vm, runner->instructions);
+    int home = stream_home(runner, symbol);
+    vm_reserve(vm, runner->pinned);
+    vm->vars[home] = value;
+    vm->symbol_slots[symbol] = home;
+}
+
+// moves the names a statement assigned from its slots to their home slots
+void stream_rehome(StreamRunner* runner, InstructionArr* instructions) {
+    InstrVM* vm = runner->vm;
+    // read every value before writing any, a new home slot can be a slot the statement still uses
+    int* assigned = arena_alloc(runner->arena, (instructions->size + 1) * sizeof(int));
+    double* values = arena_alloc(runner->arena, (instructions->size + 1) * sizeof(double));
+    int count = 0;
+    for (int i = 0; i < instructions->size; i++) {
+        Instruction* instr = &instructions->data[i];
+        if (instr->type != BINARY || instr->data.binary.op != ASSIGN || instr->data.binary.left.type != IDENTIFIER) {
+            continue;
+        }
+        int symbol = instr->data.binary.left.data.ident.symbol;
+        if (vm->symbol_slots[symbol] < 0) continue;
+        assigned[count] = symbol;
+        values[count] = vm->vars[vm->symbol_slots[symbol]];
+        count++;
+    }
+    for (int i = 0; i < count; i++) {
+        stream_home(runner, assigned[i]);
+    }
+    vm_reserve(vm, runner->pinned);
+    for (int i = 0; i < count; i++) {
+        vm->vars[runner->home[assigned[i]]] = values[i];
+        vm->symbol_slots[assigned[i]] = runner->home[assigned[i]];
+    }
+}
+
+// compiles and runs one statement without its ';', returns false if it failed to run
+bool stream_statement(StreamRunner* runner, const char* src, size_t len) {
+    size_t i = 0;
+    while (i < len && is_whitespace(src[i])) i++;
+    if (i == len) return true;
+
+    char* statement = arena_strndup(runner->arena, src, len);
+    InstructionArr* instructions = runner->instructions;
+    clearInstructionArr(instructions);
+    asm_writer_create_into(statement, runner->pinned, runner->arena, instructions, NULL);
+    vm_prepare(runner->vm, instructions);
+    bool ok = vm_execute(runner->vm, instructions);
+    if (ok) {
+        stream_rehome(runner, instructions);
+    }
+    runner->stats.statements++;
+    runner->stats.instructions += instructions->size;
+    if (runner->vm->frame_size > runner->stats.max_frame_size) {
+        runner->stats.max_frame_size = runner->vm->frame_size;
+    }
+    arena_reset(runner->arena);
+    return ok;
+}
+
+void stream_pending_append(StreamRunner* runner, const char* data, size_t len) {
+    if (runner->pending_size + len > runner->pending_capacity) {
+        runner->pending_capacity = (runner->pending_size + len) * 2;
+        runner->pending = realloc(runner->pending, runner->pending_capacity);
+    }
+    memcpy(runner->pending + runner->pending_size, data, len);
+    runner->pending_size += len;
+}
+
+// runs every statement in data that ends with a ';', and keeps the rest until more data comes in
+bool stream_feed(StreamRunner* runner, const char* data, size_t len) {
+    runner->stats.bytes += len;
+    const char* end = data + len;
+    while (data < end) {
+        const char* semicolon = memchr(data, ';', end - data);
+        if (semicolon == NULL) {
+            stream_pending_append(runner, data, end - data);
+            break;
+        }
+        bool ok;
+        if (runner->pending_size > 0) {
+            stream_pending_append(runner, data, semicolon - data);
+            ok = stream_statement(runner, runner->pending, runner->pending_size);
+            runner->pending_size = 0;
+        } else {
+            ok = stream_statement(runner, data, semicolon - data);
+        }
+        if (!ok) return false;
+        data = semicolon + 1;
+    }
+    return true;
+}
+
+// runs the last statement if the input didn't end with a ';'
+bool stream_finish(StreamRunner* runner) {
+    bool ok = stream_statement(runner, runner->pending, runner->pending_size);
+    runner->pending_size = 0;
+    return ok;
+}
+
+// reads in in chunks, until the end of the input or the first statement that fails
+bool stream_run(StreamRunner* runner, FILE* in) {
+    char* chunk = malloc(STREAM_CHUNK_SIZE);
+    bool ok = true;
+    size_t read;
+    while (ok && (read = fread(chunk, 1, STREAM_CHUNK_SIZE, in)) > 0) {
+        ok = stream_feed(runner, chunk, read);
+        // what this chunk printed goes out before blocking on the next one
+        output_flush();
+    }
+    if (ok && ferror(in)) {
+        printf("ERROR: failed to read the input\n");
+        ok = false;
+    }
+    free(chunk);
+    ok = ok && stream_finish(runner);
+    output_flush();
+    return ok;
+}
+
+// the whole file at path as a string, "-" reads stdin. NULL if it can't be opened or read
+char* read_script(const char* path) {
+    FILE* in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (in == NULL) {
+        printf("ERROR: cannot open '%s'\n", path);
+        return NULL;
+    }
+    size_t len = 0, cap = 4096;
+    char* src = malloc(cap);
+    size_t got;
+    while ((got = fread(src + len, 1, cap - len - 1, in)) > 0) {
+        len += got;
+        if (cap - len - 1 == 0) {
+            cap *= 2;
+            src = realloc(src, cap);
+        }
+    }
+    src[len] = '\0';
+    // a read error looks like the end of the file to fread, and what came before it isn't the whole script
+    bool failed = ferror(in);
+    if (in != stdin) fclose(in);
+    if (failed) {
+        printf("ERROR: failed to read '%s'\n", path);
+        free(src);
+        return NULL;
+    }
+    return src;
+}
+
+// path "-" reads stdin
+bool stream_run_file(const char* path) {
+    FILE* in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (in == NULL) {
+        printf("ERROR: cannot open '%s'\n", path);
+        return false;
+    }
+    StreamRunner* runner = stream_create();
+    bool ok = stream_run(runner, in);
+    stream_free(runner);
+    if (in != stdin) fclose(in);
+    return ok;
+}
+
+#endif //_STREAM_H
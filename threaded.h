@@ -0,0 +1,170 @@
+#pragma once
+#ifndef _THREADED_H
+#define _THREADED_H
+
+#include "bytecode.h"
+
+// direct-threaded engine: every bytecode instruction is pre-decoded into the address of its handler plus operands,
+// so dispatch is one indirect jump at the end of each handler instead of a bounds-checked switch at the top of a loop.
+// gcc and clang get computed goto (labels as values), anything else calls one function per instruction.
+// define VM_NO_COMPUTED_GOTO to force the fallback.
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+struct ThreadedInstr;
+typedef void (*ThreadedHandler)(const struct ThreadedInstr* ip, double* regs, const uint32_t* args);
+
+typedef struct ThreadedInstr {
+    union {
+        const void* label; // computed goto
+        ThreadedHandler fn; // fallback
+    } handler;
+    uint32_t out;
+    uint32_t a;
+    uint32_t b;
+} ThreadedInstr;
+
+typedef struct ThreadedProgram {
+    ThreadedInstr* code; // ends with a halt instruction
+    uint32_t size;
+    BcProgram* bytecode; // owns the constants and print arguments
+} ThreadedProgram;
+
+#define THREADED_HALT (BC_LAST_OP + 1)
+
+void threaded_print(const ThreadedInstr* ip, double* regs, const uint32_t* args) {
+    output_registers(regs, args + ip->a, ip->b);
+    regs[ip->out] = 0;
+}
+
+void threaded_error(const ThreadedInstr* ip, double* regs, const uint32_t* args) {
+    (void)regs;
+    (void)args;
+    bc_report_error(ip->out, ip->a, ip->b);
+}
+
+#if VM_COMPUTED_GOTO
+
+// with labels != NULL this only hands out the handler addresses, which can't be taken outside the function
+void threaded_exec(const ThreadedInstr* ip, double* regs, const uint32_t* args, const void** labels) {
+    static const void* const table[] = {
+            [BC_ADD] = &&op_add, [BC_SUB] = &&op_sub, [BC_MUL] = &&op_mul, [BC_DIV] = &&op_div,
+            [BC_NEG] = &&op_neg, [BC_MOVE] = &&op_move, [BC_PRINT] = &&op_print,
+            [BC_POW] = &&op_pow, [BC_MIN] = &&op_min, [BC_MAX] = &&op_max,
+            [BC_SQRT] = &&op_sqrt, [BC_EXP] = &&op_exp, [BC_LOG] = &&op_log, [BC_ABS] = &&op_abs,
+            [BC_SIN] = &&op_sin, [BC_COS] = &&op_cos, [BC_ERROR] = &&op_error, [THREADED_HALT] = &&op_halt
+    };
+    if (labels) {
+        memcpy(labels, table, sizeof(table));
+        return;
+    }
+#define DISPATCH() goto *ip->handler.label
+    DISPATCH();
+    op_add: regs[ip->out] = regs[ip->a] + regs[ip->b]; ip++; DISPATCH();
+    op_sub: regs[ip->out] = regs[ip->a] - regs[ip->b]; ip++; DISPATCH();
+    op_mul: regs[ip->out] = regs[ip->a] * regs[ip->b]; ip++; DISPATCH();
+    op_div: regs[ip->out] = regs[ip->a] / regs[ip->b]; ip++; DISPATCH();
+    op_neg: regs[ip->out] = -regs[ip->a]; ip++; DISPATCH();
+    op_move: regs[ip->out] = regs[ip->a]; ip++; DISPATCH();
+    op_print: threaded_print(ip, regs, args); ip++; DISPATCH();
+    op_pow: regs[ip->out] = pow(regs[ip->a], regs[ip->b]); ip++; DISPATCH();
+    op_min: regs[ip->out] = math_binary(MINIMUM, regs[ip->a], regs[ip->b]); ip++; DISPATCH();
+    op_max: regs[ip->out] = math_binary(MAXIMUM, regs[ip->a], regs[ip->b]); ip++; DISPATCH();
+    op_sqrt: regs[ip->out] = sqrt(regs[ip->a]); ip++; DISPATCH();
+    op_exp: regs[ip->out] = exp(regs[ip->a]); ip++; DISPATCH();
+    op_log: regs[ip->out] = log(regs[ip->a]); ip++; DISPATCH();
+    op_abs: regs[ip->out] = fabs(regs[ip->a]); ip++; DISPATCH();
+    op_sin: regs[ip->out] = sin(regs[ip->a]); ip++; DISPATCH();
+    op_cos: regs[ip->out] = cos(regs[ip->a]); ip++; DISPATCH();
+    op_error: threaded_error(ip, regs, args); ip++; DISPATCH();
+    op_halt: return;
+#undef DISPATCH
+}
+
+#else
+
+void threaded_add(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = regs[ip->a] + regs[ip->b]; }
+void threaded_sub(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = regs[ip->a] - regs[ip->b]; }
+void threaded_mul(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = regs[ip->a] * regs[ip->b]; }
+void threaded_div(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = regs[ip->a] / regs[ip->b]; }
+void threaded_neg(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = -regs[ip->a]; }
+void threaded_move(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = regs[ip->a]; }
+void threaded_pow(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = pow(regs[ip->a], regs[ip->b]); }
+void threaded_min(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = math_binary(MINIMUM, regs[ip->a], regs[ip->b]); }
+void threaded_max(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = math_binary(MAXIMUM, regs[ip->a], regs[ip->b]); }
+void threaded_sqrt(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = sqrt(regs[ip->a]); }
+void threaded_exp(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = exp(regs[ip->a]); }
+void threaded_log(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = log(regs[ip->a]); }
+void threaded_abs(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = fabs(regs[ip->a]); }
+void threaded_sin(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = sin(regs[ip->a]); }
+void threaded_cos(const ThreadedInstr* ip, double* regs, const uint32_t* args) { (void)args; regs[ip->out] = cos(regs[ip->a]); }
+
+void threaded_exec(const ThreadedInstr* ip, double* regs, const uint32_t* args, const void** labels) {
+    (void)labels;
+    for (; ip->handler.fn; ip++) {
+        ip->handler.fn(ip, regs, args);
+    }
+}
+
+#endif
+
+// takes ownership of the bytecode
+ThreadedProgram* threaded_compile(BcProgram* bytecode) {
+    ThreadedProgram* program = malloc(sizeof(ThreadedProgram));
+    program->bytecode = bytecode;
+    program->size = bytecode->code->size + 1;
+    program->code = malloc(program->size * sizeof(ThreadedInstr));
+#if VM_COMPUTED_GOTO
+    const void* labels[THREADED_HALT + 1];
+    threaded_exec(NULL, NULL, NULL, labels);
+#else
+    const ThreadedHandler handlers[THREADED_HALT + 1] = {
+            [BC_ADD] = threaded_add, [BC_SUB] = threaded_sub, [BC_MUL] = threaded_mul, [BC_DIV] = threaded_div,
+            [BC_NEG] = threaded_neg, [BC_MOVE] = threaded_move, [BC_PRINT] = threaded_print,
+            [BC_POW] = threaded_pow, [BC_MIN] = threaded_min, [BC_MAX] = threaded_max,
+            [BC_SQRT] = threaded_sqrt, [BC_EXP] = threaded_exp, [BC_LOG] = threaded_log, [BC_ABS] = threaded_abs,
+            [BC_SIN] = threaded_sin, [BC_COS] = threaded_cos, [BC_ERROR] = threaded_error, [THREADED_HALT] = NULL
+    };
+#endif
+    for (uint32_t i = 0; i < program->size; i++) {
+        uint8_t op = THREADED_HALT;
+        ThreadedInstr* instr = &program->code[i];
+        instr->out = instr->a = instr->b = 0;
+        if (i < program->size - 1) {
+            BcInstr bc = bytecode->code->data[i];
+            op = bc.op;
+            instr->out = bc.out;
+            instr->a = bc.a;
+            instr->b = bc.b;
+        }
+#if VM_COMPUTED_GOTO
+        instr->handler.label = labels[op];
+#else
+        instr->handler.fn = handlers[op];
+#endif
+    }
+    return program;
+}
+
+void threaded_program_free(ThreadedProgram* program) {
+    bc_program_free(program->bytecode);
+    free(program->code);
+    free(program);
+}
+
+void run_threaded(ThreadedProgram* program) {
+    BcProgram* bc = program->bytecode;
+    double* regs = malloc((bc_register_count(bc) + 1) * sizeof(double));
+    if (bc->constants->size > 0) {
+        memcpy(regs + bc->frame_size, bc->constants->data, bc->constants->size * sizeof(double));
+    }
+    threaded_exec(program->code, regs, bc->args->data, NULL);
+    free(regs);
+    output_flush();
+}
+
+#endif //_THREADED_H
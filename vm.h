@@ -0,0 +1,324 @@
+#pragma once
+#ifndef _VM_H
+#define _VM_H
+
+#include "asm.h"
+#include "output.h"
+
+typedef struct InstrVM {
+    // Takes a pointer to the instruction array, and runs the instructions
+    // variables:
+    double* vars; // sized from the instructions before running
+    uint32_t frame_size;
+    // named variables: symbol index -> index into vars, -1 if the name isn't bound yet
+    // names are resolved to symbols at codegen time, so nothing here touches a string
+    int* symbol_slots;
+    uint32_t symbol_count;
+
+    // todo: functions
+} InstrVM;
+
+void vm_reserve(InstrVM* vm, uint32_t frame_size) {
+    if (frame_size > vm->frame_size || vm->vars == NULL) {
+        vm->vars = realloc(vm->vars, (frame_size ? frame_size : 1) * sizeof(double));
+        if (frame_size > vm->frame_size) vm->frame_size = frame_size;
+    }
+}
+
+// grows the vm so it can run instructions, keeping the variables it already has.
+// this is what lets one vm run a program piece by piece.
+void vm_prepare(InstrVM* vm, InstructionArr* instructions) {
+    vm_reserve(vm, instructions_frame_size(instructions));
+    uint32_t count = symbol_count();
+    if (count > vm->symbol_count || vm->symbol_slots == NULL) {
+        vm->symbol_slots = realloc(vm->symbol_slots, (count ? count : 1) * sizeof(int));
+        for (uint32_t i = vm->symbol_count; i < count; i++) {
+            vm->symbol_slots[i] = -1;
+        }
+        vm->symbol_count = count;
+    }
+}
+
+InstrVM* vm_create(InstructionArr* instructions) {
+    InstrVM* vm = malloc(sizeof(InstrVM));
+    vm->vars = NULL;
+    vm->frame_size = 0;
+    vm->symbol_slots = NULL;
+    vm->symbol_count = 0;
+    vm_prepare(vm, instructions);
+    return vm;
+}
+
+void vm_free(InstrVM* vm) {
+    free(vm->vars);
+    free(vm->symbol_slots);
+    free(vm);
+}
+
+double vm_get_var(InstrVM* vm, Data var, uint32_t line) {
+    if (var.type == CONSTANT) {
+        return var.data.constant;
+    } else if (var.type == VARIABLE) {
+        return vm->vars[var.data.variable];
+    } else if (var.type == IDENTIFIER) {
+        int slot = vm->symbol_slots[var.data.ident.symbol];
+        if (slot >= 0) {
+            return vm->vars[slot];
+        }
+        output_before_error();
+        printf("ERROR %d: unknown identifier '%s'\n", line, var.data.ident.name);
+    } else {
+        output_before_error();
+        printf("ERROR %d: unknown data type\n", line);
+    }
+    return 0;
+}
+
+// one instruction, false if execution has to stop on an error.
+// inlined into both loops below, so the plain one runs exactly as if it were written out
+#define VM_HOT static inline __attribute__((always_inline))
+
+VM_HOT bool vm_step(InstrVM* vm, Instruction instr, int i) {
+    switch (instr.type) {
+        case BINARY:
+            switch (instr.data.binary.op) {
+                case ADD:
+                    vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) + vm_get_var(vm, instr.data.binary.right, i);
+                    break;
+                case SUB:
+                    vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) - vm_get_var(vm, instr.data.binary.right, i);
+                    break;
+                case MUL:
+                    vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) * vm_get_var(vm, instr.data.binary.right, i);
+                    break;
+                case DIV:
+                    vm->vars[instr.out] = vm_get_var(vm, instr.data.binary.left, i) / vm_get_var(vm, instr.data.binary.right, i);
+                    break;
+                case ASSIGN: {
+                    if (instr.data.binary.left.type != IDENTIFIER) {
+                        output_before_error();
+                        printf("ERROR %d: left side of assignment must be an identifier\n", i);
+                        return false;
+                    }
+                    // rebinding the symbol drops the old slot, which then lives on as an unnamed variable
+                    int* slot = &vm->symbol_slots[instr.data.binary.left.data.ident.symbol];
+                    switch (instr.data.binary.right.type) {
+                        case CONSTANT:
+                            // create a new variable with the name of the left side, and the value of the right side
+                            vm->vars[instr.out] = instr.data.binary.right.data.constant;
+                            *slot = instr.out;
+                            break;
+                        case VARIABLE:
+                            *slot = instr.data.binary.right.data.variable;
+                            break;
+                        case IDENTIFIER: {
+                            int src = vm->symbol_slots[instr.data.binary.right.data.ident.symbol];
+                            if (src < 0) {
+                                output_before_error();
+                                printf("ERROR %d: unknown copy identifier '%s'\n", i,
+                                       instr.data.binary.right.data.ident.name);
+                                return false;
+                            }
+                            vm->vars[instr.out] = vm->vars[src];
+                            *slot = instr.out;
+                            break;
+                        }
+                        default:
+                            output_before_error();
+                            printf("ERROR %d: right side of assignment must be a constant, variable, or identifier\n", i);
+                            return false;
+                    }
+                    break;
+                }
+                case CALL: {
+                    Data callee = instr.data.binary.left;
+                    if (callee.type == IDENTIFIER) {
+                        // not a builtin, there are no other functions yet
+                        output_before_error();
+                        printf("ERROR %d: unknown function '%s'\n", i, callee.data.ident.name);
+                        vm->vars[instr.out] = 0;
+                        break;
+                    }
+                    if (callee.type != FUNCTION) {
+                        output_before_error();
+                        printf("ERROR %d: call must be an identifier\n", i);
+                        return false;
+                    }
+                    if (callee.data.function != BUILTIN_PRINT) {
+                        // a math builtin with the wrong number of arguments, the right number compiles to an op
+                        output_before_error();
+                        printf("ERROR %d: '%s' takes %d argument(s)\n", i, builtins[callee.data.function].name,
+                               builtin_arity(callee.data.function));
+                        vm->vars[instr.out] = 0;
+                        break;
+                    }
+                    if (instr.data.binary.right.type != ARGLIST) {
+                        output_before_error();
+                        printf("ERROR %d: print must have an argument list\n", i);
+                        return false;
+                    }
+                    // an unknown name's error comes before the line instead of in the middle of it, and it prints 0
+                    Data* args = instr.data.binary.right.data.arglist.args;
+                    int len = instr.data.binary.right.data.arglist.len;
+                    for (int j = 0; j < len; j++) {
+                        if (args[j].type == IDENTIFIER && vm->symbol_slots[args[j].data.ident.symbol] < 0) {
+                            vm_get_var(vm, args[j], i);
+                        }
+                    }
+                    output_begin((uint32_t)len);
+                    for (int j = 0; j < len; j++) {
+                        bool unknown = args[j].type == IDENTIFIER && vm->symbol_slots[args[j].data.ident.symbol] < 0;
+                        output_value(unknown ? 0 : vm_get_var(vm, args[j], i));
+                    }
+                    output_end();
+                    // return 0
+                    vm->vars[instr.out] = 0;
+                    break;
+                }
+                case POW:
+                case MINIMUM:
+                case MAXIMUM:
+                    vm->vars[instr.out] = math_binary(instr.data.binary.op, vm_get_var(vm, instr.data.binary.left, i),
+                                                      vm_get_var(vm, instr.data.binary.right, i));
+                    break;
+            }
+            break;
+        case UNARY:
+            switch (instr.data.unary.op) {
+                case NEG:
+                    vm->vars[instr.out] = -vm_get_var(vm, instr.data.unary.operand, i);
+                    break;
+                default:
+                    vm->vars[instr.out] = math_unary(instr.data.unary.op, vm_get_var(vm, instr.data.unary.operand, i));
+                    break;
+            }
+            break;
+        case SET:
+            vm->vars[instr.out] = vm_get_var(vm, instr.data.set, i);
+            break;
+    }
+    return true;
+}
+
+// symbol slots the instruction reads or binds while running, for the stats
+uint64_t vm_count_data_lookups(Data d) {
+    if (d.type == IDENTIFIER) return 1;
+    uint64_t count = 0;
+    if (d.type == ARGLIST) {
+        for (int i = 0; i < d.data.arglist.len; i++) {
+            count += vm_count_data_lookups(d.data.arglist.args[i]);
+        }
+    }
+    return count;
+}
+
+uint64_t vm_count_lookups(Instruction* instr) {
+    switch (instr->type) {
+        case BINARY:
+            // a call's callee is resolved at compile time, not looked up
+            return (instr->data.binary.op == CALL ? 0 : vm_count_data_lookups(instr->data.binary.left)) +
+                   vm_count_data_lookups(instr->data.binary.right);
+        case UNARY:
+            return vm_count_data_lookups(instr->data.unary.operand);
+        case SET:
+            return vm_count_data_lookups(instr->data.set);
+    }
+    return 0;
+}
+
+// vm_execute with stats on: counts and times every instruction by its op
+bool vm_execute_profiled(InstrVM* vm, InstructionArr* instructions) {
+    double start = stats_now();
+    bool ok = true;
+    for (int i = 0; ok && i < instructions->size; i++) {
+        Instruction instr = instructions->data[i];
+        exec_stats.ident_lookups += vm_count_lookups(&instr);
+        uint64_t before = stats_cycles();
+        ok = vm_step(vm, instr, i);
+        uint64_t cycles = stats_cycles() - before;
+        exec_stats.executed++;
+        switch (instr.type) {
+            case BINARY:
+                exec_stats.binary_count[instr.data.binary.op]++;
+                exec_stats.binary_cycles[instr.data.binary.op] += cycles;
+                break;
+            case UNARY:
+                exec_stats.unary_count[instr.data.unary.op]++;
+                exec_stats.unary_cycles[instr.data.unary.op] += cycles;
+                break;
+            case SET:
+                exec_stats.set_count++;
+                exec_stats.set_cycles += cycles;
+                break;
+        }
+    }
+    stats_add_time(STATS_EXECUTE, stats_now() - start);
+    return ok;
+}
+
+// runs the instructions on a vm made by vm_create, returns false if execution stopped on an error.
+// the vm keeps the final state, so callers can look at the variables afterwards.
+bool vm_execute(InstrVM* vm, InstructionArr* instructions) {
+    if (stats_enabled) {
+        return vm_execute_profiled(vm, instructions);
+    }
+    for (int i = 0; i < instructions->size; i++) {
+        if (!vm_step(vm, instructions->data[i], i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void run_instructions(InstructionArr* instructions) {
+    InstrVM* vm = vm_create(instructions);
+    vm_execute(vm, instructions);
+    vm_free(vm);
+    output_flush();
+}
+
+// the report behind --stats, the numbers themselves are in stats_get()
+void print_exec_stats() {
+    static const char* phase_names[] = { "lex", "parse", "codegen", "optimize", "execute" };
+    static const char* node_names[] = {
+            "error", "number", "positive", "negative", "add", "sub", "mul", "div", "ident", "call", "args", "assign"
+    };
+    static const char* binary_names[] = { "add", "sub", "mul", "div", "call", "assign", "pow", "min", "max" };
+    static const char* unary_names[] = { "neg", "sqrt", "exp", "log", "abs", "sin", "cos" };
+    const ExecStats* stats = stats_get();
+
+    printf("phases:\n");
+    for (int p = 0; p < STATS_PHASE_COUNT; p++) {
+        printf("  %-10s %12.6f s\n", phase_names[p], stats->phase_seconds[p]);
+    }
+    printf("compilation: %llu statements, %llu tokens, %llu instructions (%.1f per statement, at most %llu)\n",
+           (unsigned long long)stats->statements, (unsigned long long)stats->tokens,
+           (unsigned long long)stats->instructions,
+           stats->statements ? (double)stats->instructions / stats->statements : 0.0,
+           (unsigned long long)stats->max_statement_instructions);
+    printf("ast nodes:\n");
+    for (int t = 0; t < (int)(sizeof(node_names) / sizeof(node_names[0])); t++) {
+        if (stats->ast_nodes[t]) printf("  %-10s %12llu\n", node_names[t], (unsigned long long)stats->ast_nodes[t]);
+    }
+    printf("executed: %llu instructions, %llu identifier lookups\n",
+           (unsigned long long)stats->executed, (unsigned long long)stats->ident_lookups);
+    printf("  %-10s %12s %14s %10s\n", "op", "count", "cycles", "per op");
+    for (int op = 0; op < (int)(sizeof(binary_names) / sizeof(binary_names[0])); op++) {
+        if (stats->binary_count[op] == 0) continue;
+        printf("  %-10s %12llu %14llu %10.1f\n", binary_names[op], (unsigned long long)stats->binary_count[op],
+               (unsigned long long)stats->binary_cycles[op], (double)stats->binary_cycles[op] / stats->binary_count[op]);
+    }
+    for (int op = 0; op < (int)(sizeof(unary_names) / sizeof(unary_names[0])); op++) {
+        if (stats->unary_count[op] == 0) continue;
+        printf("  %-10s %12llu %14llu %10.1f\n", unary_names[op], (unsigned long long)stats->unary_count[op],
+               (unsigned long long)stats->unary_cycles[op], (double)stats->unary_cycles[op] / stats->unary_count[op]);
+    }
+    if (stats->set_count) {
+        printf("  %-10s %12llu %14llu %10.1f\n", "set", (unsigned long long)stats->set_count,
+               (unsigned long long)stats->set_cycles, (double)stats->set_cycles / stats->set_count);
+    }
+    printf("allocations: %llu arena, %llu arena blocks, %llu heap\n", (unsigned long long)stats->arena_allocs,
+           (unsigned long long)stats->arena_blocks, (unsigned long long)stats->heap_allocs);
+}
+
+#endif //_VM_H